@@ -21,6 +21,12 @@
 #include "Koliada.h"
 #include "interface/dw3000.h"
 
+#include "ssRange.h"
+#include "frameRing.h"
+#ifdef USE_DWSIM
+#include "dwSim.h"
+#endif
+
 #define USE_RANGING
 #define RF_CHANNEL 5 // test using channel 5
 
@@ -37,6 +43,8 @@
 #if USE_INTERFACES
 	void initDrivers();
 	static RADIO radio;
+#elif defined(USE_DWSIM)
+	static RADIO radio;
 #else
 	// Define a UDP class object
 	DefineUdp(radio);
@@ -47,12 +55,39 @@
 #define kRxBufSize 64
 static byte rxBuf[kRxBufSize];
 
+// received frames, queued by the interrupt handler for the application
+static _frameRing rxRing;
+
+static void rxFrameHandler(frameRecord rec, void *context)
+	{
+	// skip the protocol headers
+	print("%s\n", (char *)&rec->data[3]);
+	}
+
 StaticEvent(rxEvent);
 void rxEventHandler(EVENT e, byte *buf, word len)
 	{
 	// running in application context
-	print("%s\n", (char *)buf);
+	// take every frame queued since the event was posted
+	frameRingDrain(&rxRing, rxFrameHandler, NULL, 0);
+	}
+
+#ifdef USE_RANGING
+// range results (filled by ssRangeAllAsync)
+#define kMaxRangees 8
+static _ssRangeData rangeResults[kMaxRangees];
+
+StaticEvent(rangeDone);
+void rangeDoneHandler(EVENT e, ssRangeData results, word count)
+	{
+	// running in application context
+	// posted by the ranger once the collection window has closed
+	if (!count)
+		debug("no response!\n");
+	for (word i = 0; i < count; i++)
+		debug("%04X[%02X]: %ldmm\n", results[i].rangee, results[i].seq, (long)results[i].mm);
 	}
+#endif
 
 StaticDelegate(rxReady);
 static void rxReadyHandler(byte *buf, word len)
@@ -87,12 +122,25 @@ static void rxReadyHandler(byte *buf, word len)
 	//dump(buf, len, 1);
 
 	// qualify and pass up to the application
+	frameRecord rec;
 	switch (buf[2])
 		{
-		// post the rxEvent
 		case ':':// protocol id
-			// skip the protocol headers
-			PostEvent(rxEvent, &rxBuf[3], len - 3);
+			// queue a copy of the frame - the next one will overwrite rxBuf
+			if (!(rec = frameRingReserve(&rxRing)))
+				// application is behind, frame dropped (see rxRing.drops)
+				break;
+			if (len >= kFrameDataSize)
+				len = kFrameDataSize - 1;
+			rec->rssi = buf[0];
+			rec->corr = buf[1];
+			rec->len = len;
+			memcpy(rec->data, buf, len);
+			rec->data[len] = '\0';
+
+			// post the rxEvent (unless the application has yet to see the last one)
+			if (frameRingCommit(&rxRing))
+				PostEvent(rxEvent, rec->data, len);
 			break;
 
 		// default is ignored
@@ -100,10 +148,10 @@ static void rxReadyHandler(byte *buf, word len)
 			break;
 		}
 
-	// Here, we have an overly simple protocol and do no buffering or queuing - any
-	// new incoming frame will overwrite the rxBuf before or during the handling
-	// of it by the application. A 'real' application will have buffering and/or
-	// queuing and buffer/queue protection will be implicitly defined by the protocol.
+	// Here, we have an overly simple protocol, but the frames are queued so a
+	// burst of incoming frames will not overwrite the rxBuf before or during the
+	// handling of them by the application. Frames are only lost if the ring fills,
+	// and a 'real' protocol will define what happens then (retry, ack, etc.).
 	//
 	// For a more complex example see: https://docs.koliada.com/kes/examples/TestRadio
 	}
@@ -134,6 +182,9 @@ void abortHandler(int sig)
 #ifdef USE_DW3000
 	#define SELECTED_RADIO "DW3000"
 #endif
+#ifdef USE_DWSIM
+	#define SELECTED_RADIO "DWSIM"	// host build, simulated radios (see dwSim.c)
+#endif
 #ifndef SELECTED_RADIO
 	#error You must select a radio for this test!
 #endif
@@ -148,6 +199,14 @@ void TEST()
 #if USE_INTERFACES
 	initDrivers();
 	radio = IINTERFACE.Find(SELECTED_RADIO);
+#elif defined(USE_DWSIM)
+	// this node at the origin, with a few (auto responding) anchors around it
+	static _dwSimConfig simConfig = {0.01, 0.02, 500.0, 42};
+	dwSimInit(&simConfig);
+	radio = dwSimCreate(0, 0.0, 0.0, 0.0, 0.0);
+	dwSimCreate(0xA001, 12.5, 3.0, 0.0, 0.0);
+	dwSimCreate(0xA002, -8.0, 0.0, 7.5, 0.0);
+	dwSimCreate(0xA003, 3.0, -12.0, -4.0, 2.5);
 #else
 	// create a radio endpoint instance
 	objectCreate(radio, SELECTED_RADIO);
@@ -157,6 +216,9 @@ void TEST()
 	// set up for single-sided two way ranging
 	debug("\nSetting up to RANGE from %s\n\n", typeof(radio)->Name);
 	ssInit(radio);
+
+	objectCreate(rangeDone);
+	OnEvent(rangeDone, (HANDLER) rangeDoneHandler);
 #else
 	// set up for two way radio tests
 	debug("\nSetting up to Tx/Rx from %s\n\n", typeof(radio)->Name);
@@ -178,7 +240,8 @@ void TEST()
 	assert(kTxBufSize <= maxFrameSize);
 	assert(kRxBufSize <= maxFrameSize);
 
-	// create the rxEvent
+	// create the rx queue and the rxEvent
+	frameRingInit(&rxRing);
 	objectCreate(rxEvent);
 	OnEvent(rxEvent, (HANDLER) rxEventHandler);
 
@@ -210,13 +273,14 @@ void TEST()
 
 #ifdef USE_RANGING
 
-		// send a (broadcast) range request returning the result
-		// to target a specific node we need it's address and this test would not
-		// then be 'symetric' across all nodes
-		_ssRangeData result;
-		ssRangeTo(radio, BCAST_ADDR, &result);
-		
-		// result can be handler in ssRangTo or here
+		// send a (broadcast) range request returning the results of every node
+		// that answers - to target a specific node we need it's address and this
+		// test would not then be 'symetric' across all nodes
+		//
+		// this returns as soon as the poll is away and the results are handled in
+		// rangeDoneHandler (above), so we're straight back to waiting for keys
+		if (ssRangeAllAsync(radio, rangeResults, kMaxRangees, rangeDone) < 0)
+			debug("busy!\n");
 
 #else
 
@@ -22,6 +22,8 @@
 #include "Koliada.h"
 #include "interface/radio.h"
 
+#include "frameRing.h"
+
 // In this test we do basic input/output using the installed radio adapter (if any).
 // There are two build configs, one to build a sender (Tx) and one to build a receiver
 // (Rx). For a more complex example see: https://docs.koliada.com/kes/examples/TestRadio
@@ -54,11 +56,21 @@
 #define kRxBufSize 64
 static byte rxBuf[kRxBufSize];
 
+// received frames, queued by the interrupt handler for the application
+static _frameRing rxRing;
+
+static void rxFrameHandler(frameRecord rec, void *context)
+	{
+	// skip the protocol headers
+	print("%s\n", (char *)&rec->data[3]);
+	}
+
 StaticEvent(rxEvent);
 void rxEventHandler(EVENT e, byte *buf, word len)
 	{
 	// running in application context
-	print("%s\n", (char *)buf);
+	// take every frame queued since the event was posted
+	frameRingDrain(&rxRing, rxFrameHandler, NULL, 0);
 	}
 
 StaticDelegate(rxReady);
@@ -93,12 +105,25 @@ void rxReadyHandler(byte *buf, word len)
 	dump(buf, len, 1);
 
 	// qualify and pass up to the application
+	frameRecord rec;
 	switch (buf[2])
 		{
-		// post the rxEvent
 		case ':':// protocol id
-			// skip the protocol headers
-			PostEvent(rxEvent, &rxBuf[3], len - 3);
+			// queue a copy of the frame - the next one will overwrite rxBuf
+			if (!(rec = frameRingReserve(&rxRing)))
+				// application is behind, frame dropped (see rxRing.drops)
+				break;
+			if (len >= kFrameDataSize)
+				len = kFrameDataSize - 1;
+			rec->rssi = buf[0];
+			rec->corr = buf[1];
+			rec->len = len;
+			memcpy(rec->data, buf, len);
+			rec->data[len] = '\0';
+
+			// post the rxEvent (unless the application has yet to see the last one)
+			if (frameRingCommit(&rxRing))
+				PostEvent(rxEvent, rec->data, len);
 			break;
 
 		// default is ignored
@@ -106,10 +131,10 @@ void rxReadyHandler(byte *buf, word len)
 			break;
 		}
 
-	// Here, we have an overly simple protocol and do no buffering or queuing - any
-	// new incoming frame will overwrite the rxBuf before or during the handling
-	// of it by the application. A 'real' application will have buffering and/or
-	// queuing and buffer/queue protection will be implicitly defined by the protocol.
+	// Here, we have an overly simple protocol, but the frames are queued so a
+	// burst of incoming frames will not overwrite the rxBuf before or during the
+	// handling of them by the application. Frames are only lost if the ring fills,
+	// and a 'real' protocol will define what happens then (retry, ack, etc.).
 	//
 	// For a more complex example see: https://docs.koliada.com/kes/examples/TestRadio
 	}
@@ -158,7 +183,8 @@ void TEST()
 	print("Max frame size = %u\n", maxFrameSize);
 	assert(kRxBufSize <= maxFrameSize);
 
-	// create the rxEvent
+	// create the rx queue and the rxEvent
+	frameRingInit(&rxRing);
 	objectCreate(rxEvent);
 	OnEvent(rxEvent, (HANDLER) rxEventHandler);
 
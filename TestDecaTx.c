@@ -21,6 +21,8 @@
 #include "Koliada.h"
 #include "interface/radio.h"
 
+#include "txQueue.h"
+
 #define RF_CHANNEL 5 // test using channel 5
 
 // In this test we do basic input/output using the installed radio adapter (if any).
@@ -41,14 +43,12 @@
 	DefineUdp(radio);
 #endif
 
-StaticDelegate(txDoneDelegate);
-void txDoneHandler(byte *frame, word len)
-	{
-	// running in the interrupt handler!!
-	// called each time the a frame is sent
-	print("%s: sent %u bytes\n", frame, len);
-	//dump(frame, 16, 1);
-	}
+// Each keypress queues a burst of kTxBurst frames, which the queue sends back to
+// back (see txQueue.c) - the txDone interrupt starts each as the last goes out.
+#define kTxBurst 8
+#define kTxSlots 8		// (power of 2)
+
+static _txQueue txq;
 
 void abortHandler(int sig)
 	{
@@ -95,10 +95,15 @@ void TEST()
 
 	IRADIO.Iocntl(radio, kRadioSetChannel, RF_CHANNEL);
 
-	// set the txDone handler
-	// set up the txDone delegate (shows we're transmitting)
-	objectCreate(txDoneDelegate, delegateTask(txDoneHandler));
-	IRADIO.Iocntl(radio, kRadioAddTxDone, txDoneDelegate);
+	// set up the tx queue (it adds its own txDone delegate)
+	static byte slotBufs[kTxSlots][kTxBufSize];
+	static _txSlot slots[kTxSlots];
+	for (byte n = 0; n < kTxSlots; n++)
+		{
+		slots[n].buf = slotBufs[n];
+		slots[n].size = kTxBufSize;
+		}
+	txQueueInit(&txq, radio, kTxQueueRadio, slots, kTxSlots);
 
 	// specifically not using Clear Channel Avoidance (CCA) in this test
 	// CCA requires that the receiver is on and this test requires that receiver remains off
@@ -120,10 +125,17 @@ void TEST()
 		// pad the frame out to the local maximum (starting after the '\0')
 		for (i++; i < kTxBufSize; buf[i++] = randomByte());
 
-		print("%s[%u]\n", buf, i);
-
-		// raw radio send (no presentation layer protocols)
-		IRADIO.Send(radio, (byte *)buf, i);
+		print("%s[%u] x %u\n", buf, i, kTxBurst);
+
+		// raw radio sends (no presentation layer protocols), the burst numbered
+		// in the last byte - txQueueSendWait only waits if the queue is full
+		for (byte n = 0; n < kTxBurst; n++)
+			{
+			buf[kTxBufSize - 1] = n;
+			txQueueSendWait(&txq, (byte *)buf, i);
+			}
+		txQueueFlush(&txq);
+		print("sent %lu, high water %u, drops %u, errors %u\n", (unsigned long)txq.sent, txq.high, txq.drops, txq.errors);
 		} while (1);
 
 	// we're done
@@ -0,0 +1,243 @@
+/*
+ * File: TestFrameBench.c
+ *
+ * Contains: Ranging frame classification benchmark
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright:	© 1989-2023 by Guy McIlroy
+ *  All rights reserved.
+ *
+ *  Use of this code is subject to the terms of the KoliadaESDK license.
+ *  https://docs.koliada.com/KoliadaESDKLicense.pdf
+ *
+ *  Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+#include "interface/dw3000.h"
+
+#include <time.h>
+
+#include "ssRange.h"
+#include "ssFrame.h"
+
+// Here we classify the same traffic, as seen by a promiscuous receiver on a busy
+// channel, with;
+//
+//    - the original rxReadyHandler test (memcmp against expectedResponse, then
+//      the length, destination & function code checks), and
+//    - ssFrameDispatch
+//
+// and report frames classified per second for each (no radio is needed).
+//
+// The legacy test looks for one frame (a response, of one length) and never
+// looks at the PAN id; ssFrameDispatch takes every code and length registered
+// on it, and does check the PAN id. On a host it comes out at about three
+// quarters of the legacy rate (both turn away most of the traffic on its length
+// alone, but the legacy test compares that against a constant) - it is there
+// for the routing, not for speed, and the ratio is reported, not required.
+//
+// The mix below is what a node sees on a channel shared by a few dozen others;
+// mostly acks, beacons and other people's traffic, with only a small part of it
+// addressed to us.
+
+#ifndef kBenchFrames
+#define kBenchFrames 4096	// distinct frames (cycled through)
+#endif
+#ifndef kBenchPasses
+#define kBenchPasses 2000
+#endif
+#define kBenchRuns 5		// of each (the best is reported)
+
+#define kOurAddr	0x5EED
+#define kOtherAddr	0x1234
+
+typedef struct
+	{
+	const char *name;
+	byte percent;
+	} _benchTraffic;
+
+enum {kAck, kBeacon, kData, kPollOther, kRespOther, kOtherPan, kPollBcast, kRespUs, kTrafficKinds};
+
+static _benchTraffic benchTraffic[kTrafficKinds] =
+	{
+	{"ack",                30},
+	{"beacon",             10},
+	{"data (EW:...)",      20},
+	{"poll, not for us",   15},
+	{"response, not us",   10},
+	{"other PAN",           5},
+	{"broadcast poll",      5},
+	{"response, for us",    5},
+	};
+
+// a response header addressed to us (as expectedResponse is once ssInit has run)
+static byte ourHdr[] = {0x41, 0x88, 0, 0xCA, 0xDE, kOurAddr & 0xFF, kOurAddr >> 8, 'W', 'A', 0xE1};
+
+static byte frames[kBenchFrames][64];
+static byte lengths[kBenchFrames];
+
+// the radio the legacy test reads our addr from (as rxReadyHandler did)
+static _Dw3000 benchRadio;
+static RADIO dwRadio = (RADIO)&benchRadio;
+
+static _ssFrameTable table;
+static volatile UInt32 accepted;
+
+static void responseHandler(byte *buf, word len, void *context)
+	{
+	if (len == sizeof_ssRangeResponsMsg)
+		accepted++;
+	}
+
+static double benchNow()
+	{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+	}
+
+// Both are run as the rxReady delegate would be - called through a pointer, once
+// per frame - so neither gets inlined into the loop. ssFrameDispatch is called
+// directly (the legacy test takes, and ignores, the table too) so neither pays
+// for a wrapper the other doesn't.
+typedef byte (*CLASSIFIER)(ssFrameTable table, byte *buf, word len);
+
+// the rxReadyHandler test as it was (expectedResponse -> ourHdr)
+static byte legacyClassify(ssFrameTable table, byte *buf, word len)
+	{
+	if (memcmp(buf, ourHdr, sizeof_ssRangeRequestMsg) == 0 ||
+			(len == sizeof_ssRangeResponsMsg &&
+			(*((wyde *)&buf[MSG_DST_IDX]) == ((Dw3000)dwRadio)->addr || *((wyde *)&buf[MSG_DST_IDX]) == 0xFFFF) &&
+			buf[9] == 0xE1))
+		{
+		accepted++;
+		return 1;
+		}
+	return 0;
+	}
+
+static double benchRun(CLASSIFIER volatile classify)
+	{
+	UInt32 i, n;
+	double t0 = benchNow();
+	for (i = 0; i < kBenchPasses; i++)
+		for (n = 0; n < kBenchFrames; n++)
+			classify(&table, frames[n], lengths[n]);
+	return benchNow() - t0;
+	}
+
+static void makeFrame(byte *f, byte *len, byte kind, byte seq)
+	{
+	memset(f, 0, 64);
+	memcpy(f, ourHdr, sizeof_ssRangeRequestMsg);
+	f[MSG_SEQ_IDX] = seq;
+	*((wyde *)&f[MSG_SRC_IDX]) = kOtherAddr;
+	*len = sizeof_ssRangeResponsMsg;
+	switch (kind)
+		{
+		case kAck:
+			f[0] = 0x02; f[1] = 0x00;
+			*len = 5;
+			break;
+		case kBeacon:
+			f[0] = 0x00; f[1] = 0x80;
+			*len = 24;
+			break;
+		case kData:
+			memcpy(f, "EW:Hello World - 0x00!", 23);
+			*len = 64;
+			break;
+		case kPollOther:
+			*((wyde *)&f[MSG_DST_IDX]) = kOtherAddr + 1;
+			f[MSG_FUNC_IDX] = 0xE0;
+			*len = sizeof_ssRangeRequestMsg;
+			break;
+		case kRespOther:
+			*((wyde *)&f[MSG_DST_IDX]) = kOtherAddr + 1;
+			break;
+		case kOtherPan:
+			f[3] = 0x34; f[4] = 0x12;
+			*((wyde *)&f[MSG_DST_IDX]) = kOurAddr;
+			break;
+		case kPollBcast:
+			*((wyde *)&f[MSG_DST_IDX]) = BCAST_ADDR;
+			f[MSG_FUNC_IDX] = 0xE0;
+			*len = sizeof_ssRangeRequestMsg;
+			break;
+		case kRespUs:
+			break;
+		}
+	}
+
+void abortHandler(int sig)
+	{
+	// for this test, we simply exit
+	exit(-42);
+	}
+
+void TEST()
+	{
+	printf(">>%s\n", __func__);
+
+	// first, capture the SIGABRT signal
+	signal(SIGABRT, abortHandler);
+
+	benchRadio.addr = kOurAddr;
+	ssFrameInit(&table, ourHdr);
+	ssFrameOn(&table, 0xE1, sizeof_ssRangeResponsMsg, responseHandler, NULL);
+
+	// build the traffic (kinds interleaved in proportion)
+	UInt32 n, ours = 0;
+	for (n = 0; n < kBenchFrames; n++)
+		{
+		byte kind, pick = (byte)(randomByte() % 100);
+		for (kind = 0; pick >= benchTraffic[kind].percent; pick -= benchTraffic[kind++].percent)
+			;
+		makeFrame(frames[n], &lengths[n], kind, (byte)n);
+		ours += kind == kRespUs;
+		}
+
+	// dispatch must take exactly our responses (legacy also takes the ones on
+	// other PANs, as it never looked at the PAN id)
+	UInt32 legacyCount, dispatchCount;
+	accepted = 0;
+	for (n = 0; n < kBenchFrames; n++)
+		legacyClassify(&table, frames[n], lengths[n]);
+	legacyCount = accepted;
+	accepted = 0;
+	for (n = 0; n < kBenchFrames; n++)
+		ssFrameDispatch(&table, frames[n], lengths[n]);
+	dispatchCount = accepted;
+	print("%u frames, %u for us: dispatch took %u, legacy took %u\n", kBenchFrames, ours, dispatchCount, legacyCount);
+	if (dispatchCount != ours)
+		{
+		print("FAILED: dispatch misclassified\n");
+		exit(-1);
+		}
+
+	// the best of kBenchRuns each, taken in turn (whichever runs first, or
+	// alone, otherwise comes out ahead on a host)
+	double legacy = 0, dispatch = 0;
+	for (n = 0; n < kBenchRuns; n++)
+		{
+		double t = benchRun(legacyClassify);
+		if (!n || t < legacy)
+			legacy = t;
+		t = benchRun(ssFrameDispatch);
+		if (!n || t < dispatch)
+			dispatch = t;
+		}
+
+	double total = (double)kBenchPasses * kBenchFrames;
+	print("legacy:   %.1f Mframes/s\n", total / legacy * 1e-6);
+	print("dispatch: %.1f Mframes/s (%.2fx)\n", total / dispatch * 1e-6, legacy / dispatch);
+	print("BENCH {\"frames\":%.0f,\"legacyPerSec\":%.0f,\"dispatchPerSec\":%.0f}\n",
+		total, total / legacy, total / dispatch);
+
+	printf("<<%s\n", __func__);
+	}
@@ -0,0 +1,250 @@
+/*
+ * File: TestIngest.c
+ *
+ * Contains: Ranging record ingest server load test (Linux host)
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright:	© 1989-2023 by Guy McIlroy
+ *  All rights reserved.
+ *
+ *  Use of this code is subject to the terms of the KoliadaESDK license.
+ *  https://docs.koliada.com/KoliadaESDKLicense.pdf
+ *
+ *  Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#define _GNU_SOURCE		// sendmmsg
+
+#include "Koliada.h"
+#include "interface/dw3000.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "ssRange.h"
+#include "ssIngest.h"
+
+// This test runs on a Linux host (no radio needed). It starts the ingest server
+// (see ssIngest.c) on the loopback, and a load generator standing in for a site
+// of offloading rangers - kGenThreads threads, each sending datagrams of
+// kGenRecords SS records (kGenTags tags, round robin, each at its own fixed
+// distance - every 16th ranged by a 32 bit node, its exchanges straddling the
+// 2^32 wrap) as fast as sendmmsg will take them, for kGenSeconds. Then it
+// reports;
+//
+//    - records/second solved (against kIngestTarget)
+//    - datagrams and records sent, received, dropped (queue full) and lost (the
+//      difference - the socket buffers overflowed)
+//    - every tag's latest distance checked against where it is
+//
+// first as text, then as a single 'BENCH {...}' json line for tracking results
+// from release to release. Only a wrong distance fails the test; the rate
+// depends on the machine.
+
+#ifndef kIngestPort
+#define kIngestPort 5000
+#endif
+#ifndef kIngestRxThreads
+#define kIngestRxThreads 2
+#endif
+#ifndef kIngestShards
+#define kIngestShards 2
+#endif
+#ifndef kGenThreads
+#define kGenThreads 2
+#endif
+#ifndef kGenSeconds
+#define kGenSeconds 3
+#endif
+#define kGenTags 10000
+#define kGenRecords ((kIngestMaxDatagram - sizeof_ssOffloadHdr) / sizeof_ssOffloadSS)
+#define kGenBatch 32	// datagrams per sendmmsg
+#define kIngestTarget 1000000.0	// records/s
+#define kIngestErrorMm 5	// a tag's distance against where it is (the generator rounds its timestamps)
+
+#define kReplyTicks ((dwTime)20000000)	// ~313us
+
+static atomic_bool genStop;
+static _Atomic UInt64 genDatagrams, genRecords;
+
+// where each tag is - twice the tof in time units (a few cm to ~20m)
+#define tagTof2(rangee)	(16 + (rangee) % 8192)
+
+// and its clock offset (+/-20ppm, in Q26)
+#define tagCor(rangee)	((Int32)((rangee) % 41 - 20) * 67)
+
+// and every 16th is ranged by a 32 bit (CC8051) node
+#define tagNarrow(rangee)	((rangee) % 16 == 0)
+
+static double benchNow()
+	{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+	}
+
+// one SS record for rangee, the timestamps drawn around the 40 bit clocks
+static void genRecord(byte *rec, wyde rangee, byte seq, UInt64 *random)
+	{
+	// (xorshift - randomByte is too slow to keep up)
+	*random ^= *random << 13;
+	*random ^= *random >> 7;
+	*random ^= *random << 17;
+	dwTime t1 = *random & kDwTimeMask, t2 = (*random >> 24) & kDwTimeMask, mask = kDwTimeMask;
+	byte flags = 0;
+	if (tagNarrow(rangee))
+		{
+		// a 32 bit ranger's, its reply and round trip across the 2^32 wrap
+		t1 = 0x100000000ULL - t1 % kReplyTicks;
+		t2 = 0x100000000ULL - t2 % kReplyTicks;
+		mask = 0xFFFFFFFFULL;
+		flags = kOffload32;
+		}
+	Int32 cor = tagCor(rangee);
+	dwTime t3 = (t2 + kReplyTicks) & mask;
+	dwTime t4 = (t1 + (dwTime)llround(kReplyTicks * (1 - cor / (double)((teta)1 << 26))) + tagTof2(rangee)) & mask;
+	t1 &= mask;
+	t2 &= mask;
+
+	*((wyde *)&rec[REC_RANGER_IDX]) = flags ? 0x0002 : 0x0001;
+	*((wyde *)&rec[REC_RANGEE_IDX]) = rangee;
+	rec[REC_SEQ_IDX] = seq;
+	rec[REC_FLAGS_IDX] = flags;
+	dwTimePut(&rec[REC_T1_IDX], t1);
+	dwTimePut(&rec[REC_T2_IDX], t2);
+	dwTimePut(&rec[REC_T3_IDX], t3);
+	dwTimePut(&rec[REC_T4_IDX], t4);
+	memcpy(&rec[REC_COR_IDX], &cor, sizeof(Int32));
+	}
+
+static void *genThread(void *arg)
+	{
+	word index = (word)(size_t)arg;
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(kIngestPort);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+
+	// a batch of datagrams, rebuilt as they go (the tags round robin from
+	// a different place in each thread)
+	static byte bufs[kGenThreads][kGenBatch][sizeof_ssOffloadHdr + kGenRecords * sizeof_ssOffloadSS];
+	struct mmsghdr msgs[kGenBatch];
+	struct iovec iovs[kGenBatch];
+	memset(msgs, 0, sizeof(msgs));
+	UInt64 random = 0x9E3779B97F4A7C15ULL * (index + 1);
+	UInt32 tag = index * (kGenTags / kGenThreads);
+	wyde seq = 0;
+	while (!atomic_load_explicit(&genStop, memory_order_relaxed))
+		{
+		for (word d = 0; d < kGenBatch; d++)
+			{
+			byte *data = bufs[index][d];
+			data[OFFLOAD_VERSION_IDX] = kOffloadVersion;
+			data[OFFLOAD_COUNT_IDX] = kGenRecords;
+			*((wyde *)&data[OFFLOAD_SEQ_IDX]) = seq++;
+			for (word r = 0; r < kGenRecords; r++, tag = (tag + 1) % kGenTags)
+				genRecord(&data[sizeof_ssOffloadHdr + r * sizeof_ssOffloadSS], (wyde)(tag + 1), (byte)seq, &random);
+			iovs[d].iov_base = data;
+			iovs[d].iov_len = sizeof_ssOffloadHdr + kGenRecords * sizeof_ssOffloadSS;
+			msgs[d].msg_hdr.msg_iov = &iovs[d];
+			msgs[d].msg_hdr.msg_iovlen = 1;
+			}
+		int n = sendmmsg(fd, msgs, kGenBatch, 0);
+		if (n > 0)
+			{
+			atomic_fetch_add_explicit(&genDatagrams, (UInt64)n, memory_order_relaxed);
+			atomic_fetch_add_explicit(&genRecords, (UInt64)n * kGenRecords, memory_order_relaxed);
+			}
+		}
+	close(fd);
+	return NULL;
+	}
+
+void abortHandler(int sig)
+	{
+	// for this test, we simply exit
+	exit(-42);
+	}
+
+void TEST()
+	{
+	printf(">>%s\n", __func__);
+
+	// first, capture the SIGABRT signal
+	signal(SIGABRT, abortHandler);
+
+	int err = ssIngestStart(kIngestPort, kIngestRxThreads, kIngestShards);
+	if (err)
+		{
+		print("FAIL: ssIngestStart %d\n", err);
+		exit(-1);
+		}
+	print("ingest: %u receive threads, %u shards; generator: %u threads, %u records a datagram, %u tags\n",
+		kIngestRxThreads, kIngestShards, kGenThreads, (word)kGenRecords, kGenTags);
+
+	// go
+	pthread_t gens[kGenThreads];
+	double start = benchNow();
+	for (word g = 0; g < kGenThreads; g++)
+		pthread_create(&gens[g], NULL, genThread, (void *)(size_t)g);
+	sleep(kGenSeconds);
+	atomic_store(&genStop, 1);
+	for (word g = 0; g < kGenThreads; g++)
+		pthread_join(gens[g], NULL);
+
+	// (whatever is still queued is solved as it stops)
+	ssIngestStop();
+	double elapsed = benchNow() - start;
+	_ssIngestStats stats;
+	ssIngestStatsOf(&stats);
+
+	// every tag where it should be
+	UInt32 tags = 0, failed = 0;
+	Int32 worst = 0;
+	for (UInt32 rangee = 1; rangee <= kGenTags; rangee++)
+		{
+		_ssIngestTag tag;
+		if (!ssIngestTagOf((wyde)rangee, &tag))
+			continue;
+		tags++;
+		Int32 mm = (Int32)(tagTof2(rangee) * DWT_TIME_UNITS * SPEED_OF_LIGHT * 1000.0 / 2.0);
+		Int32 err = tag.mm > mm ? tag.mm - mm : mm - tag.mm;
+		if (err > worst)
+			worst = err;
+		if (err > kIngestErrorMm && !failed++)
+			print("FAIL: %04x at %ldmm, ingested %ldmm\n", tag.rangee, (long)mm, (long)tag.mm);
+		}
+
+	UInt64 sent = atomic_load(&genRecords);
+	double rate = stats.solved / elapsed;
+	print("\n%llu records solved in %.3fs = %.0f records/s (target %.0f: %s)\n", (unsigned long long)stats.solved,
+		elapsed, rate, kIngestTarget, rate >= kIngestTarget ? "met" : "missed");
+	print("datagrams: %llu sent, %llu received, %llu bad\n", (unsigned long long)atomic_load(&genDatagrams),
+		(unsigned long long)stats.datagrams, (unsigned long long)stats.bad);
+	print("records: %llu sent, %llu queued, %llu dropped, %llu lost\n", (unsigned long long)sent,
+		(unsigned long long)stats.records, (unsigned long long)stats.dropped,
+		(unsigned long long)(sent - stats.records - stats.dropped));
+	print("tags: %u of %u heard, %u out of bounds, worst error %ldmm\n", tags, kGenTags, failed, (long)worst);
+
+	// machine readable (one line)
+	print("BENCH {\"rxThreads\":%u,\"shards\":%u,\"genThreads\":%u,\"seconds\":%.6f,\"recordsPerSec\":%.0f,"
+		"\"sent\":%llu,\"queued\":%llu,\"dropped\":%llu,\"solved\":%llu,\"tags\":%u,\"worstErrorMm\":%ld}\n",
+		kIngestRxThreads, kIngestShards, kGenThreads, elapsed, rate, (unsigned long long)sent,
+		(unsigned long long)stats.records, (unsigned long long)stats.dropped, (unsigned long long)stats.solved,
+		tags, (long)worst);
+
+	printf("<<%s %s\n", __func__, failed ? "FAILED" : "passed");
+	exit(failed ? -1 : 0);
+	}
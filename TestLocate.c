@@ -0,0 +1,281 @@
+/*
+ * File: TestLocate.c
+ *
+ * Contains: Position solver accuracy and benchmark
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright:	© 1989-2023 by Guy McIlroy
+ *  All rights reserved.
+ *
+ *  Use of this code is subject to the terms of the KoliadaESDK license.
+ *  https://docs.koliada.com/KoliadaESDKLicense.pdf
+ *
+ *  Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+
+#include <math.h>
+#include <time.h>
+
+#include "ssRange.h"
+#include "ssLocate.h"
+
+// This test runs on the host build (no radio needed). For 4 to 16 anchors spread
+// over a 40m x 40m site (at heights from 0.5m to 4m), it places tags at random
+// and solves each from the exact ranges (to the mm), then from ranges with
+// kLocateNoiseMm of gaussian noise, in 2D (height known) and 3D, and reports the
+// errors and solves per second.
+//
+// What a solver can do is set by the geometry - its dilution of precision (DOP,
+// from the directions to the anchors at the tag's true position: the error in
+// position per unit of range error). Anchors a few metres apart in height over
+// a site 40m across say little about a tag's height, so in 3D many tags are
+// poorly placed for it, however it is solved. So every check is made against
+// the tags whose DOP is at most kLocateDop (all of them, in 2D, but for the odd
+// one outside the anchors);
+//
+//		- from exact ranges, each must be within kLocateExactMm of the truth
+//		  (the ranges are whole mm, and Q16 is ~0.5mm here), and
+//		- from noisy ranges, the mean errors across and in height must be within
+//		  kLocateNoisy times what the DOP allows (noise * mean DOP, for each).
+//		  That takes a range or more to spare beyond one more than the unknowns;
+//		  with only one (4 anchors, in 3D) noise alone makes a tag's mirror
+//		  about the anchors fit as well as it does (see ssLocate.c), so those are
+//		  only reported
+//
+// Build with USE_FIXED_LOCATE for the fixed point solver.
+
+#define kLocateTags		2000	// positions per anchor count
+#define kLocatePasses	20		// timed passes over them
+#define kLocateExactMm	5		// worst position error allowed from exact ranges
+#define kLocateNoiseMm	50		// range noise (standard deviation)
+#define kLocateNoisy	1.5		// mean error allowed from noisy ranges, over noise * DOP
+#define kLocateDop		5.0		// well conditioned - at most this DOP
+#define kLocateSiteMm	40000
+
+static byte anchorCounts[] = {4, 6, 8, 12, 16};
+
+static _ssAnchor anchors[16];
+static _ssRangeData ranges[kLocateTags][16];
+static Int32 truth[kLocateTags][3];
+static double hdop[kLocateTags], vdop[kLocateTags];	// 0 if not well conditioned (see tagDop)
+
+// the same sequence every run (xorshift), so each run checks the same layouts
+static UInt32 seed = 0x1D872B41;
+
+static UInt32 random32()
+	{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+	}
+
+static double uniform()
+	{
+	return (random32() >> 8) / (double)(1 << 24);
+	}
+
+static double gaussian()
+	{
+	double u = uniform();
+	return sqrt(-2.0 * log(u > 0.0 ? u : 1e-12)) * cos(2.0 * 3.14159265358979 * uniform());
+	}
+
+static double benchNow()
+	{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+	}
+
+// tags at random (below 2m), with ranges to each anchor (noise in mm)
+static void makeTags(byte count, double noise)
+	{
+	for (UInt32 t = 0; t < kLocateTags; t++)
+		{
+		truth[t][0] = (Int32)(uniform() * kLocateSiteMm);
+		truth[t][1] = (Int32)(uniform() * kLocateSiteMm);
+		truth[t][2] = (Int32)(uniform() * 2000);
+		for (byte i = 0; i < count; i++)
+			{
+			double dx = truth[t][0] - anchors[i].x, dy = truth[t][1] - anchors[i].y, dz = truth[t][2] - anchors[i].z;
+			ssRangeData r = &ranges[t][i];
+			memset(r, 0, sizeof(_ssRangeData));
+			r->rangee = anchors[i].addr;
+			r->mm = (Int32)floor(sqrt(dx * dx + dy * dy + dz * dz) + gaussian() * noise + 0.5);
+			r->range = r->mm / 1000.0;
+			}
+		}
+	}
+
+// the DOP of each tag, across & in height (see NOTE) - returns the # well
+// conditioned (hdop & vdop are 0 for the others)
+static UInt32 tagDop(byte count, byte dims)
+	{
+	UInt32 good = 0;
+	for (UInt32 t = 0; t < kLocateTags; t++)
+		{
+		// H = sum of u u' (u the unit vector from each anchor), whose inverse's
+		// diagonal holds the DOP squared
+		double h[3][3] = {{0}};
+		for (byte i = 0; i < count; i++)
+			{
+			double u[3] = {truth[t][0] - anchors[i].x, truth[t][1] - anchors[i].y, truth[t][2] - anchors[i].z};
+			double len = sqrt(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]);
+			for (byte r = 0; r < dims; r++)
+				for (byte k = 0; k < dims; k++)
+					h[r][k] += u[r] * u[k] / (len * len);
+			}
+		double across, height = 0.0;
+		if (dims == 2)
+			{
+			double det = h[0][0] * h[1][1] - h[0][1] * h[1][0];
+			across = det > 0.0 ? (h[0][0] + h[1][1]) / det : 1e9;
+			}
+		else
+			{
+			double c00 = h[1][1] * h[2][2] - h[1][2] * h[2][1],
+				c11 = h[0][0] * h[2][2] - h[0][2] * h[2][0],
+				c22 = h[0][0] * h[1][1] - h[0][1] * h[1][0],
+				det = h[0][0] * c00 - h[0][1] * (h[1][0] * h[2][2] - h[1][2] * h[2][0])
+					+ h[0][2] * (h[1][0] * h[2][1] - h[1][1] * h[2][0]);
+			across = det > 0.0 ? (c00 + c11) / det : 1e9;
+			height = det > 0.0 ? c22 / det : 1e9;
+			}
+		hdop[t] = sqrt(across);
+		vdop[t] = sqrt(height);
+		if (sqrt(across + height) <= kLocateDop)
+			good++;
+		else
+			hdop[t] = vdop[t] = 0.0;
+		}
+	return good;
+	}
+
+// the errors over the well conditioned tags
+typedef struct
+	{
+	double mean, worst;		// position error
+	double across, height;	// mean errors
+	double hdop, vdop;		// ... and DOPs
+	Int32 residual;			// worst rms residual
+	UInt32 unsolved;
+	} _locateErrors;
+
+// solve them all (the errors are those of the well conditioned tags)
+static void solveTags(byte count, byte dims, _locateErrors *e)
+	{
+	UInt32 good = 0;
+	memset(e, 0, sizeof(_locateErrors));
+	for (UInt32 t = 0; t < kLocateTags; t++)
+		{
+		_ssPosition pos;
+		pos.z = truth[t][2];
+		if (!ssLocate(ranges[t], count, dims, &pos))
+			{
+			e->unsolved += hdop[t] != 0.0;
+			continue;
+			}
+		if (hdop[t] == 0.0)
+			continue;
+		good++;
+		if (pos.error > e->residual)
+			e->residual = pos.error;
+		double dx = pos.x - truth[t][0], dy = pos.y - truth[t][1], dz = pos.z - truth[t][2];
+		double err = sqrt(dx * dx + dy * dy + dz * dz);
+		e->mean += err;
+		e->across += sqrt(dx * dx + dy * dy);
+		e->height += fabs(dz);
+		e->hdop += hdop[t];
+		e->vdop += vdop[t];
+		if (err > e->worst)
+			e->worst = err;
+		}
+	if (good)
+		{
+		e->mean /= good;
+		e->across /= good;
+		e->height /= good;
+		e->hdop /= good;
+		e->vdop /= good;
+		}
+	}
+
+void abortHandler(int sig)
+	{
+	// for this test, we simply exit
+	exit(-42);
+	}
+
+void TEST()
+	{
+	printf(">>%s\n", __func__);
+
+	// first, capture the SIGABRT signal
+	signal(SIGABRT, abortHandler);
+
+	UInt32 failed = 0;
+	for (byte n = 0; n < sizeof(anchorCounts); n++)
+		{
+		byte count = anchorCounts[n];
+		for (byte i = 0; i < count; i++)
+			{
+			anchors[i].addr = 0xA000 + i;
+			anchors[i].x = (Int32)(uniform() * kLocateSiteMm);
+			anchors[i].y = (Int32)(uniform() * kLocateSiteMm);
+			anchors[i].z = 500 + (Int32)(uniform() * 3500);
+			}
+		ssLocateAnchors(anchors, count);
+
+		for (byte dims = 2; dims <= 3; dims++)
+			{
+			// accuracy - exact, then noisy ranges
+			_locateErrors err;
+			makeTags(count, 0.0);
+			UInt32 good = tagDop(count, dims);
+			solveTags(count, dims, &err);
+			print("%2u anchors %uD: %u of %u tags well conditioned (DOP %.1f across, %.1f in height)\n",
+				count, dims, good, kLocateTags, err.hdop, err.vdop);
+			if (err.unsolved || err.worst > kLocateExactMm || (dims == 2 && good < kLocateTags * 9 / 10))
+				{
+				print("FAIL: %u anchors %uD, exact ranges - worst error %.0fmm (%u of %u well conditioned, "
+					"%u unsolved)\n", count, dims, err.worst, good, kLocateTags, err.unsolved);
+				failed++;
+				}
+			print("%2u anchors %uD: exact ranges, mean error %.1fmm (worst %.0fmm, residual %ldmm)\n",
+				count, dims, err.mean, err.worst, (long)err.residual);
+
+			makeTags(count, kLocateNoiseMm);
+			tagDop(count, dims);
+			solveTags(count, dims, &err);
+			double acrossMax = kLocateNoisy * kLocateNoiseMm * err.hdop,
+				heightMax = kLocateNoisy * kLocateNoiseMm * err.vdop;
+			if (count > dims + 1 &&
+					(err.unsolved || err.across > acrossMax || (dims == 3 && err.height > heightMax)))
+				{
+				print("FAIL: %u anchors %uD, %umm noise - mean error %.0fmm across (at most %.0fmm), "
+					"%.0fmm in height (at most %.0fmm)\n", count, dims, kLocateNoiseMm, err.across, acrossMax,
+					err.height, heightMax);
+				failed++;
+				}
+
+			// speed
+			double t0 = benchNow();
+			for (UInt32 p = 0; p < kLocatePasses; p++)
+				solveTags(count, dims, &err);
+			double perSec = (double)kLocatePasses * kLocateTags / (benchNow() - t0);
+
+			print("%2u anchors %uD: mean error %.0fmm (%.0fmm across, %.0fmm in height, %umm noise), %.0f solves/s\n",
+				count, dims, err.mean, err.across, err.height, kLocateNoiseMm, perSec);
+			print("BENCH {\"anchors\":%u,\"dims\":%u,\"meanErrorMm\":%.1f,\"solvesPerSec\":%.0f}\n",
+				count, dims, err.mean, perSec);
+			}
+		}
+	printf("<<%s %s\n", __func__, failed ? "FAILED" : "passed");
+	exit(failed ? -1 : 0);
+	}
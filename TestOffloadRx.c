@@ -0,0 +1,220 @@
+/*
+ * File: TestOffloadRx.c
+ *
+ * Contains: Ranging offload receiver (host)
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright:	© 1989-2023 by Guy McIlroy
+ *  All rights reserved.
+ *
+ *  Use of this code is subject to the terms of the KoliadaESDK license.
+ *  https://docs.koliada.com/KoliadaESDKLicense.pdf
+ *
+ *  Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+#include "interface/udp.h"
+
+#include "ssOffload.h"
+#include "udpRing.h"
+
+// The other end of a ranger built USE_OFFLOAD (see ssRanger.c) - receives its
+// datagrams as TestUdpRx does, and works out the distances for everything that
+// arrived since the last poll in one go (ssOffloadSolve). The node sends to
+// this host (192.168.1.178, port 5000), as TestUdpTx does.
+//
+// First, it checks that the records of a 32 bit (CC8051) ranger are solved
+// right - an SS and a DS exchange straddling the 2^32 wrap, as such a node
+// sends them, must come out as the same exchanges well clear of any wrap.
+
+#if USE_INTERFACES
+	void initDrivers();
+#else
+	// Define a UDP class object
+	DefineUdp(udp);
+#endif
+
+// receipt buffers - each the header (see udpRing.h) and a datagram
+#define kRxBufSize (sizeof_udpHeader + kOffloadMaxLen)
+#define kRxRing 8		// datagrams (power of 2)
+static byte rxBufs[kRxRing][kRxBufSize];
+static _udpDesc rxDesc[kRxRing];
+static _udpRing rxRing;
+
+#if USE_INTERFACES
+static UDP udp;
+#endif
+
+#define kRxPollMs 10	// how often to check for receipts
+#define kRxRecords 256	// records solved at once (at most)
+#define kRxDatagramRecords (kOffloadMaxLen / sizeof_ssOffloadSS)	// ... in a datagram
+
+static _ssOffloadRecord records[kRxRecords];
+static Int32 distances[kRxRecords];
+
+// datagrams seen, and missed (by their #s - one node at a time)
+static UInt32 datagrams, missed;
+static wyde nextSeq;
+
+// a datagram's records, onto the end of records (context is the count so far)
+static void rxDatagram(udpHeader h, word len, word *n)
+	{
+	byte *data = udpData(h);
+	word room = kRxRecords - *n;
+	byte count = ssOffloadParse(data, len, &records[*n], room < 0xFF ? (byte)room : 0xFF);
+	if (!count)
+		return;
+
+	wyde seq = *((wyde *)&data[OFFLOAD_SEQ_IDX]);
+	if (datagrams && seq != nextSeq)
+		missed += (wyde)(seq - nextSeq);
+	nextSeq = seq + 1;
+	datagrams++;
+	*n += count;
+	}
+
+#define kNarrowReply	20000000ULL		// ~313us
+#define kNarrowTof		2000ULL			// ~9.4m
+#define kNarrowCor		1000			// Q26, ~15ppm (SS only)
+
+// an exchange's record (t5 & t6 DS only) - from a 32 bit ranger, its own
+// timestamps (and its peer's, as it read them) are cut to 32 bits
+static word narrowRecord(byte *rec, byte flags, dwTime *t)
+	{
+	dwTime mask = flags & kOffload32 ? 0xFFFFFFFFULL : kDwTimeMask;
+	*((wyde *)&rec[REC_RANGER_IDX]) = 0x0001;
+	*((wyde *)&rec[REC_RANGEE_IDX]) = 0x0002;
+	rec[REC_SEQ_IDX] = 0;
+	rec[REC_FLAGS_IDX] = flags;
+	static const byte at[] = {REC_T1_IDX, REC_T2_IDX, REC_T3_IDX, REC_T4_IDX, REC_T5_IDX, REC_T6_IDX};
+	for (byte i = 0; i < (flags & kOffloadDS ? 6 : 4); i++)
+		{
+		dwTime ti = t[i] & mask;
+		dwTimePut(&rec[at[i]], ti);
+		}
+	Int32 cor = flags & kOffloadDS ? 0 : kNarrowCor;
+	memcpy(&rec[REC_COR_IDX], &cor, sizeof(Int32));
+	return recSize(rec);
+	}
+
+// a 32 bit ranger's SS & DS exchanges across the wrap, against the same clear of it
+static UInt32 checkNarrow()
+	{
+	static byte data[sizeof_ssOffloadHdr + 2 * sizeof_ssOffloadSS + 2 * sizeof_ssOffloadDS];
+	static const byte flags[] = {kOffload32, 0, kOffload32 | kOffloadDS, kOffloadDS};
+	_ssOffloadRecord recs[4];
+	Int32 mm[4];
+	word len = sizeof_ssOffloadHdr;
+	for (byte i = 0; i < 4; i++)
+		{
+		// t4 past 2^32 from t1, and (SS) t3 from t2 - or none of them (DS is only
+		// thrown by one delta wrapping, the others' errors cancel)
+		dwTime t[6];
+		t[0] = flags[i] & kOffload32 ? 0x100000000ULL - kNarrowReply / 2 : 0x1000;
+		t[1] = flags[i] == kOffload32 ? 0x100000000ULL - kNarrowReply / 2 : 0x2000;
+		t[2] = t[1] + kNarrowReply;
+		t[3] = t[0] + kNarrowReply + 2 * kNarrowTof;
+		t[4] = t[3] + kNarrowReply;
+		t[5] = t[2] + kNarrowReply + 2 * kNarrowTof;
+		len += narrowRecord(&data[len], flags[i], t);
+		}
+	data[OFFLOAD_VERSION_IDX] = kOffloadVersion;
+	data[OFFLOAD_COUNT_IDX] = 4;
+	if (ssOffloadParse(data, len, recs, 4) != 4)
+		{
+		print("FAIL: a 32 bit ranger's datagram didn't parse\n");
+		return 1;
+		}
+	ssOffloadSolve(recs, 4, mm);
+	UInt32 failed = 0;
+	for (byte i = 0; i < 4; i += 2)
+		if (mm[i] - mm[i + 1] > 1 || mm[i + 1] - mm[i] > 1)
+			{
+			print("FAIL: a 32 bit ranger's %s record across the wrap gave %ldmm, not %ldmm\n",
+				flags[i] & kOffloadDS ? "DS" : "SS", (long)mm[i], (long)mm[i + 1]);
+			failed++;
+			}
+	print("32 bit ranger: SS %ldmm, DS %ldmm%s\n", (long)mm[0], (long)mm[2], failed ? "" : " - as clear of the wrap");
+	return failed;
+	}
+
+StaticTimer(rxPollTimer);
+static void rxPollHandler()
+	{
+	// running in application context, every kRxPollMs
+	// take everything that has arrived since the last poll, as many datagrams
+	// as there's sure to be room for the records of (the rest stay in the ring)...
+	word n = 0, fit;
+	while ((fit = (kRxRecords - n) / kRxDatagramRecords) != 0)
+		{
+		if (!udpRingCount(&rxRing) && !udpRecvBatch(udp, &rxRing))
+			break;
+		udpRingDrain(&rxRing, (UDPHANDLER) rxDatagram, &n, fit);
+		}
+	if (!n)
+		return;
+
+	// ... and work it all out at once
+	ssOffloadSolve(records, n, distances);
+	for (word i = 0; i < n; i++)
+		print("%04x -> %04x #%u %s: %ldmm\n", records[i].ranger, records[i].rangee, records[i].seq,
+			records[i].flags & kOffloadDS ? "DS" : "SS", (long)distances[i]);
+	print("%lu datagrams, %lu missed\n", (unsigned long)datagrams, (unsigned long)missed);
+	}
+
+void TEST()
+	{
+	printf(">>%s\n", __func__);
+	if (checkNarrow())
+		{
+		printf("<<%s FAILED\n", __func__);
+		exit(-1);
+		}
+	debug("Setting up to RECEIVE ranging records\n\n");
+
+#if USE_INTERFACES
+	initDrivers();
+	udp = IINTERFACE.Find("UDP");
+#else
+	// create a UDP endpoint instance
+	objectCreate(udp);
+#endif
+
+	int maxFrameSize = IUDP.Iocntl(udp, kUdpGetMaxFrameSize);
+	print("Max frame size = %u\n", maxFrameSize);
+	assert(kRxBufSize <= maxFrameSize);
+
+	// establish some inet configuration
+	// mac address is already set by the driver
+	IUDP.Iocntl(udp, kIpSetGatewayAddr, "192.168.1.1");
+	IUDP.Iocntl(udp, kIpSetSubnetMask, "255.255.255.0");
+	IUDP.Iocntl(udp, kIpSetLocalAddr, "192.168.1.178");
+
+	// the receive ring
+	for (byte i = 0; i < kRxRing; i++)
+		{
+		rxDesc[i].buf = rxBufs[i];
+		rxDesc[i].size = kRxBufSize;
+		}
+	udpRingInit(&rxRing, rxDesc, kRxRing);
+
+	// open UDP socket
+	IUDP.Open(udp);
+
+	// establish UDP socket endpoint configuration
+	IUDP.Iocntl(udp, kUdpSetSrcPort, 5000);
+
+	// start polling for receipts
+	objectCreate(rxPollTimer, kIntervalTimer, TICKS(kRxPollMs));
+	OnEvent(rxPollTimer, (HANDLER) rxPollHandler);
+	cmStartTimer(rxPollTimer, 0);
+
+	print("\nWaiting for ranging records\n");
+
+	// wait for system events (including the poll timer defined above)
+	WaitEvent(0, 0);	// never returns!
+	}
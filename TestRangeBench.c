@@ -0,0 +1,233 @@
+/*
+ * File: TestRangeBench.c
+ *
+ * Contains: Ranging throughput and latency benchmark
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright:	© 1989-2023 by Guy McIlroy
+ *  All rights reserved.
+ *
+ *  Use of this code is subject to the terms of the KoliadaESDK license.
+ *  https://docs.koliada.com/KoliadaESDKLicense.pdf
+ *
+ *  Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#define __RADIO_CLASS_H	 // block current class/radio.h
+
+#include "Koliada.h"
+#include "interface/dw3000.h"
+
+#include <math.h>
+#include <time.h>
+
+#include "ssRange.h"
+#ifdef USE_DWSIM
+#include "dwSim.h"
+#endif
+
+#define RF_CHANNEL 5 // test using channel 5
+
+// Here we range back to back, round robin across a set of responders, for
+// kBenchIterations exchanges (no keypresses) and report;
+//
+//    - ranges/second
+//    - p50/p99/p999 completion latency (request to result)
+//    - timeout rate
+//    - distance jitter (standard deviation) per responder
+//
+// first as text, then as a single 'BENCH {...}' json line for tracking results
+// from release to release.
+//
+// Each exchange is ssRangeTo without its debug output (ie. ssRangeStart and
+// ssRangeWait), so the printing doesn't get measured.
+//
+// Build with USE_DWSIM to run against simulated responders on a host (see
+// dwSim.c), or with a radio selected to run against real responders (set their
+// addresses in benchResponders).
+//
+// Define kBenchTimeoutMs (and optionally kBenchRetries) to give every responder
+// its own deadline (see ssRangeConfig) rather than the default kRangeTimeoutMs.
+
+#ifndef kBenchIterations
+#define kBenchIterations 10000
+#endif
+#ifndef kBenchRetries
+#define kBenchRetries 0
+#endif
+
+typedef struct
+	{
+	wyde addr;
+	double x, y, z;		// position (simulated responders only)
+	double ppm;			// crystal error (simulated responders only)
+	byte narrow;		// 32 bit timestamps, as a CC8051 node (simulated responders only)
+	} _benchResponder;
+
+static _benchResponder benchResponders[] =
+	{
+	{0xA001,  3.0,   0.0, 0.0,  12.5, 0},
+	{0xA002,  0.0,   7.5, 0.0,  -8.0, 0},
+	{0xA003, -12.0, -4.0, 2.5,   3.0, 0},
+	{0xA004,  20.0, 15.0, 1.0, -15.0, 1},
+	};
+#define kBenchResponders (sizeof(benchResponders) / sizeof(benchResponders[0]))
+
+#ifdef USE_DWSIM
+	#define SELECTED_RADIO "DWSIM"
+	static _dwSimConfig simConfig = {0.001, 0.02, 500.0, 42};
+#endif
+#ifdef USE_DW1000
+	#define SELECTED_RADIO "DW1000"
+#endif
+#ifdef USE_DW3000
+	#define SELECTED_RADIO "DW3000"
+#endif
+#ifndef SELECTED_RADIO
+	#error You must select a radio for this test!
+#endif
+
+#if USE_INTERFACES
+	void initDrivers();
+#endif
+static RADIO radio;
+
+// per responder statistics
+typedef struct
+	{
+	UInt32 ok, timeouts;
+	double mean, m2;	// running mean & sum of squared deviations (Welford)
+	double truth;		// actual distance (simulated responders only)
+	} _benchStats;
+
+static _benchStats benchStats[kBenchResponders];
+static float latencies[kBenchIterations];	// us
+
+static double benchNow()
+	{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+	}
+
+static int compareLatency(const void *a, const void *b)
+	{
+	float x = *(const float *)a, y = *(const float *)b;
+	return x < y ? -1 : x > y;
+	}
+
+static float percentile(UInt32 count, double p)
+	{
+	if (!count)
+		return 0.0;
+	UInt32 i = (UInt32)(p * (count - 1) + 0.5);
+	return latencies[i];
+	}
+
+void abortHandler(int sig)
+	{
+	// for this test, we simply exit
+	exit(-42);
+	}
+
+void TEST()
+	{
+	printf(">>%s\n", __func__);
+
+	// first, capture the SIGABRT signal
+	signal(SIGABRT, abortHandler);
+
+	byte i;
+#if defined(USE_DWSIM)
+	// this node at the origin, responders placed as listed
+	dwSimInit(&simConfig);
+	radio = dwSimCreate(0, 0.0, 0.0, 0.0, 0.0);
+	for (i = 0; i < kBenchResponders; i++)
+		{
+		_benchResponder *r = &benchResponders[i];
+		RADIO node = dwSimCreate(r->addr, r->ppm, r->x, r->y, r->z);
+		dwSimNarrow(node, r->narrow);
+		benchStats[i].truth = dwSimRange(radio, node);
+		}
+#elif USE_INTERFACES
+	initDrivers();
+	radio = IINTERFACE.Find(SELECTED_RADIO);
+#else
+	// create a radio endpoint instance
+	objectCreate(radio, SELECTED_RADIO);
+#endif
+
+	debug("\nRanging benchmark from %s, %u iterations across %u responders\n\n",
+		typeof(radio)->Name, kBenchIterations, (word)kBenchResponders);
+	ssInit(radio);
+#ifdef kBenchTimeoutMs
+	for (i = 0; i < kBenchResponders; i++)
+		ssRangeConfig(benchResponders[i].addr, kBenchTimeoutMs, kBenchRetries);
+#endif
+	IRADIO.Iocntl(radio, kRadioSetChannel, RF_CHANNEL);
+	IRADIO.Iocntl(radio, kRadioEnableRx);
+
+	// go
+	_ssRangeData result;
+	UInt32 n, count = 0, timeouts = 0;
+	double start = benchNow();
+	for (n = 0; n < kBenchIterations; n++)
+		{
+		_benchStats *s = &benchStats[n % kBenchResponders];
+		double t0 = benchNow();
+		int rseq = ssRangeStart(radio, benchResponders[n % kBenchResponders].addr, &result);
+		byte state = rseq < 0 ? kRangeIdle : ssRangeWait(rseq);
+		double t1 = benchNow();
+
+		if (state != kRangeDone)
+			{
+			timeouts++;
+			s->timeouts++;
+			continue;
+			}
+		latencies[count++] = (float)((t1 - t0) * 1e6);
+
+		// Welford's running variance
+		double delta = result.range - s->mean;
+		s->mean += delta / ++s->ok;
+		s->m2 += delta * (result.range - s->mean);
+		}
+	double elapsed = benchNow() - start;
+
+	qsort(latencies, count, sizeof(float), compareLatency);
+	double rate = count / elapsed;
+	double timeoutRate = (double)timeouts / kBenchIterations;
+	float p50 = percentile(count, 0.50), p99 = percentile(count, 0.99), p999 = percentile(count, 0.999);
+
+	// human readable
+	print("\n%u ranges in %.3fs = %.1f ranges/s, %u timeouts (%.2f%%)\n",
+		count, elapsed, rate, timeouts, timeoutRate * 100.0);
+	print("latency: p50 %.1fus p99 %.1fus p999 %.1fus\n", p50, p99, p999);
+	for (i = 0; i < kBenchResponders; i++)
+		{
+		_benchStats *s = &benchStats[i];
+		print("  %04X: %u ok, %u timeouts, mean %.3fm, jitter %.1fmm",
+			benchResponders[i].addr, s->ok, s->timeouts, s->mean, s->ok > 1 ? sqrt(s->m2 / (s->ok - 1)) * 1000.0 : 0.0);
+		if (s->truth > 0.0)
+			print(", bias %.1fmm", (s->mean - s->truth) * 1000.0);
+		print("\n");
+		}
+
+	// machine readable (one line)
+	print("BENCH {\"iterations\":%u,\"ranges\":%u,\"seconds\":%.6f,\"rangesPerSec\":%.1f,"
+		"\"timeoutRate\":%.6f,\"p50us\":%.1f,\"p99us\":%.1f,\"p999us\":%.1f,\"responders\":[",
+		kBenchIterations, count, elapsed, rate, timeoutRate, p50, p99, p999);
+	for (i = 0; i < kBenchResponders; i++)
+		{
+		_benchStats *s = &benchStats[i];
+		print("%s{\"addr\":\"%04X\",\"ok\":%u,\"timeouts\":%u,\"mean\":%.4f,\"jitterMm\":%.2f}",
+			i ? "," : "", benchResponders[i].addr, s->ok, s->timeouts, s->mean,
+			s->ok > 1 ? sqrt(s->m2 / (s->ok - 1)) * 1000.0 : 0.0);
+		}
+	print("]}\n");
+
+	printf("<<%s\n", __func__);
+	}
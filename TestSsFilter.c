@@ -0,0 +1,208 @@
+/*
+ * File: TestSsFilter.c
+ *
+ * Contains: Test the per-rangee Kalman and median range filters
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright:	© 1989-2023 by Guy McIlroy
+ *  All rights reserved.
+ *
+ *  Use of this code is subject to the terms of the KoliadaESDK license.
+ *  https://docs.koliada.com/KoliadaESDKLicense.pdf
+ *
+ *  Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+#include "interface/dw3000.h"
+
+#include "ssRange.h"
+#include "ssFilter.h"
+
+// This test runs on the host build (no radio needed). One rangee's filter is
+// switched Kalman -> median -> Kalman, while a second keeps a median running
+// alongside. The Kalman is fed a rangee walking away at a steady speed (with
+// noise) and must settle on its distance and speed; the median's every output
+// must be the median of the last kFilterMedianLen ranges (as a plain sort
+// gives it); and a filter must start afresh each time its mode changes or it is
+// reset - whatever state the other mode left behind (the poll times here all
+// end in 0xC8, which a median would once have taken for its place in the ring),
+// and without touching the other rangee's.
+
+#define kFilterTicks	6389760000ULL	// 100ms in device time units
+#define kFilterT1		0x10000000C8ULL	// first poll
+#define kFilterSpeed	500				// mm/s, the walking rangee
+#define kFilterSettled	20				// results before the Kalman is checked
+#define kFilterTrackMm	60				// allowed Kalman error, once settled (the noise is +/-50mm)
+#define kFilterTrackV	200				// ... and speed error (mm/s)
+
+#define kRangeeA	0x1001		// switched between filters
+#define kRangeeB	0x1002		// median throughout
+
+static UInt32 seed = 0x2545F491;
+static UInt32 failed;
+
+// +/-50mm, the same each run
+static Int32 noise()
+	{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return (Int32)(seed % 101) - 50;
+	}
+
+// the last kFilterMedianLen ranges a median has seen, and their median
+typedef struct
+	{
+	Int32 last[kFilterMedianLen];
+	word count;
+	} _medianRef;
+
+static Int32 medianOf(_medianRef *ref, Int32 mm)
+	{
+	Int32 sorted[kFilterMedianLen];
+	byte n = ref->count < kFilterMedianLen ? (byte)ref->count + 1 : kFilterMedianLen, i, j;
+	ref->last[ref->count++ % kFilterMedianLen] = mm;
+	memcpy(sorted, ref->last, n * sizeof(Int32));
+	for (i = 1; i < n; i++)
+		for (j = i; j && sorted[j - 1] > sorted[j]; j--)
+			{
+			Int32 t = sorted[j];
+			sorted[j] = sorted[j - 1];
+			sorted[j - 1] = t;
+			}
+	return sorted[(n - 1) / 2];
+	}
+
+static Int32 filter(wyde rangee, dwTime t1, Int32 mm)
+	{
+	_ssRangeData result;
+	memset(&result, 0, sizeof(result));
+	result.rangee = rangee;
+	result.t1 = t1 & kDwTimeMask;
+	result.mm = mm;
+	result.range = mm / 1000.0;
+	if (!ssFilter(&result))
+		{
+		if (!failed++)
+			print("FAIL: %04X has no filter\n", rangee);
+		return mm;
+		}
+	return result.mm;
+	}
+
+// feeds rangee a median's worth of ranges and more, checking each against ref
+static void checkMedian(const char *what, wyde rangee, _medianRef *ref, dwTime *t1, word count)
+	{
+	UInt32 bad = 0;
+	for (word i = 0; i < count; i++, *t1 += kFilterTicks)
+		{
+		// 2m, with now and then a reflection 3m long
+		Int32 mm = 2000 + noise() + (i % 4 == 3 ? 3000 : 0);
+		Int32 want = medianOf(ref, mm), got = filter(rangee, *t1, mm);
+		if (got != want && !bad++)
+			print("FAIL: %s - %04X result %u gave %ldmm, not %ldmm\n", what, rangee, i, (long)got, (long)want);
+		}
+	print("%s: %u medians, %u wrong\n", what, count, bad);
+	failed += bad;
+	}
+
+// feeds rangee a walk away from us, checking the Kalman once it's settled
+static void checkKalman(const char *what, wyde rangee, dwTime *t1, word count)
+	{
+	Int32 mm, v, worst = 0, worstV = 0;
+	UInt32 bad = 0;
+	for (word i = 0; i < count; i++, *t1 += kFilterTicks)
+		{
+		Int32 truth = 1000 + kFilterSpeed * i / 10;
+		Int32 got = filter(rangee, *t1, truth + noise());
+		if (i < kFilterSettled)
+			continue;
+		ssFilterState(rangee, &mm, &v);
+		Int32 err = got - truth, errV = v - kFilterSpeed;
+		if (err < 0)
+			err = -err;
+		if (errV < 0)
+			errV = -errV;
+		if (err > worst)
+			worst = err;
+		if (errV > worstV)
+			worstV = errV;
+		if ((err > kFilterTrackMm || errV > kFilterTrackV || mm != got) && !bad++)
+			print("FAIL: %s - %04X result %u gave %ldmm at %ldmm/s, truly %ldmm at %dmm/s\n",
+				what, rangee, i, (long)got, (long)v, (long)truth, kFilterSpeed);
+		}
+	print("%s: worst %ldmm, %ldmm/s off once settled\n", what, (long)worst, (long)worstV);
+	failed += bad;
+	}
+
+// a filter just started must pass its first range straight through
+static void checkFresh(const char *what, wyde rangee, dwTime t1)
+	{
+	Int32 mm, v, got = filter(rangee, t1, 4321);
+	word count = ssFilterState(rangee, &mm, &v);
+	if (got != 4321 || mm != 4321 || v || count != 1)
+		{
+		print("FAIL: %s - %04X started at %ldmm (%ldmm/s, %u results), not 4321mm\n",
+			what, rangee, (long)got, (long)v, count);
+		failed++;
+		}
+	}
+
+void abortHandler(int sig)
+	{
+	// for this test, we simply exit
+	exit(-42);
+	}
+
+void TEST()
+	{
+	printf(">>%s\n", __func__);
+
+	// first, capture the SIGABRT signal
+	signal(SIGABRT, abortHandler);
+
+	_medianRef refA, refB;
+	memset(&refB, 0, sizeof(refB));
+	dwTime t1 = kFilterT1, t1B = kFilterT1;
+	Int32 mm, v;
+
+	// B's median runs throughout
+	ssFilterMode(kRangeeB, kFilterMedian);
+	checkMedian("median B", kRangeeB, &refB, &t1B, 12);
+
+	// A - Kalman, then median on what the Kalman left
+	ssFilterMode(kRangeeA, kFilterKalman);
+	checkKalman("Kalman A", kRangeeA, &t1, 60);
+	ssFilterMode(kRangeeA, kFilterMedian);
+	memset(&refA, 0, sizeof(refA));
+	checkMedian("Kalman -> median A", kRangeeA, &refA, &t1, 12);
+
+	// ... B must carry on where it was
+	checkMedian("median B, after A's switch", kRangeeB, &refB, &t1B, 12);
+
+	// ... and back to Kalman on what the median left
+	ssFilterMode(kRangeeA, kFilterKalman);
+	checkFresh("median -> Kalman A", kRangeeA, t1);
+	ssFilterReset(kRangeeA);
+	checkKalman("median -> Kalman A", kRangeeA, &t1, 60);
+
+	// a reset median starts a new window
+	ssFilterReset(kRangeeB);
+	if (ssFilterState(kRangeeB, &mm, &v))
+		{
+		print("FAIL: median B still has results after a reset\n");
+		failed++;
+		}
+	memset(&refB, 0, sizeof(refB));
+	checkMedian("median B, reset", kRangeeB, &refB, &t1B, 12);
+	ssFilterReset(kRangeeA);
+	ssFilterMode(kRangeeA, kFilterMedian);
+	checkFresh("Kalman -> median A, reset", kRangeeA, t1);
+
+	printf("<<%s %s\n", __func__, failed ? "FAILED" : "passed");
+	exit(failed ? -1 : 0);
+	}
@@ -0,0 +1,251 @@
+/*
+ * File: TestSsNeighbor.c
+ *
+ * Contains: Test the neighbor table against a plain map
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright:	© 1989-2023 by Guy McIlroy
+ *  All rights reserved.
+ *
+ *  Use of this code is subject to the terms of the KoliadaESDK license.
+ *  https://docs.koliada.com/KoliadaESDKLicense.pdf
+ *
+ *  Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+
+#include "ssRange.h"
+#include "ssNeighbor.h"
+
+// This test runs on the host build (no radio needed). It adds and removes
+// neighbors at random, kNeighborOps times, keeping a plain map (by addr) of
+// what the table should hold alongside, and after every operation checks the
+// table against it - each addr of the pool found (or not) as the map says, with
+// the value it was given, and walking the table (ssNeighborNext) visiting each
+// entry once. Half the pool is picked to hash to the last and first few slots,
+// so probe runs are long and wrap past the end of the table, which is where
+// moving entries back into a removed one's gap goes wrong. The table is
+// filled to the brim now and then, when adding must fail (and not disturb it).
+//
+// Then every addr of the pool (more than the table holds) times out, which
+// mustn't add a single entry, and only an addr that has answered counts them.
+//
+// Then two radios (rangers) range one neighbor turn about, each seeing its own
+// steady clock offset (their crystals differ); each must be predicted its own
+// offset, asked to read it only every kCorRefresh exchanges, and see no stray.
+
+#define kNeighborOps	200000
+#define kNeighborPool	(kNeighbors * 3 / 2)	// addrs used
+#define kNeighborHot	3					// slots either side of the wrap the colliding half hash to
+#define kNeighborCorRounds	64				// exchanges by each ranger
+
+static wyde pool[kNeighborPool];
+static byte held[kNeighborPool];	// the map - in the table?
+static Int32 value[kNeighborPool];	// ... with this (in mm)
+static word heldCount;
+
+static UInt32 seed = 0x6B43A9B5;
+static UInt32 failed;
+
+static UInt32 random32()
+	{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+	}
+
+// as ssNeighbor.c
+static byte home(wyde addr)
+	{
+	return (byte)((wyde)(addr * 40503U) >> (16 - kNeighborBits));
+	}
+
+// a pool of distinct addrs, half of them colliding around the wrap
+static void makePool()
+	{
+	for (word i = 0; i < kNeighborPool; )
+		{
+		wyde addr = (wyde)random32();
+		byte h = home(addr);
+		if (!addr || addr == BCAST_ADDR)
+			continue;
+		if (i & 1 && h >= kNeighborHot && h < kNeighbors - kNeighborHot)
+			continue;
+		word j;
+		for (j = 0; j < i && pool[j] != addr; j++)
+			;
+		if (j == i)
+			pool[i++] = addr;
+		}
+	}
+
+// the whole table against the map
+static void checkAll(UInt32 op, const char *what)
+	{
+	for (word i = 0; i < kNeighborPool; i++)
+		{
+		ssNeighbor n = ssNeighborOf(pool[i]);
+		if (!n != !held[i] || (n && (n->addr != pool[i] || n->mm != value[i])))
+			{
+			if (!failed++)
+				print("FAIL: op %u (%s) - %04X %s, the map says %s\n", op, what, pool[i],
+					n ? n->addr != pool[i] ? "found the wrong entry" : "has the wrong value" : "is missing",
+					held[i] ? "it's there" : "it isn't");
+			return;
+			}
+		}
+	word walked = 0;
+	for (ssNeighbor n = ssNeighborNext(NULL); n; n = ssNeighborNext(n))
+		walked++;
+	if (walked != heldCount && !failed++)
+		print("FAIL: op %u (%s) - walked %u neighbors, the map has %u\n", op, what, walked, heldCount);
+	}
+
+static void add(UInt32 op, word i)
+	{
+	ssNeighbor n = ssNeighborAdd(pool[i]);
+	if (!n)
+		{
+		// only when it's full, and it wasn't there already
+		if ((held[i] || heldCount < kNeighbors) && !failed++)
+			print("FAIL: op %u - adding %04X failed with %u of %u held\n", op, pool[i], heldCount, kNeighbors);
+		return;
+		}
+	if (!held[i])
+		{
+		if ((n->ranged || n->mm || n->clock[0].cors) && !failed++)
+			print("FAIL: op %u - %04X added with history\n", op, pool[i]);
+		held[i] = 1;
+		heldCount++;
+		}
+	value[i] = n->mm = (Int32)random32();
+	}
+
+static void drop(word i)
+	{
+	ssNeighborRemove(pool[i]);
+	if (held[i])
+		{
+		held[i] = 0;
+		heldCount--;
+		}
+	}
+
+// two rangers, one neighbor - returns the # of exchanges that read the offset
+static UInt32 checkClocks(wyde addr)
+	{
+	static const Int32 offset[2] = {1000, -3000};	// Q26, ~15ppm and ~-45ppm
+	UInt32 reads = 0;
+	for (word round = 0; round < kNeighborCorRounds; round++)
+		for (byte ranger = 0; ranger < 2; ranger++)
+			{
+			Int32 cor = 0x7FFFFFFF;
+			if (ssNeighborCorDue(ranger, addr))
+				{
+				cor = ssNeighborCorRead(ranger, addr, offset[ranger]);
+				reads++;
+				}
+			else if (!ssNeighborCorPredict(ranger, addr, &cor))
+				cor = 0x7FFFFFFF;
+			ssNeighbor n = ssNeighborOf(addr);
+			if ((cor != offset[ranger] || !n || ssNeighborCorPpb(n, ranger)) && !failed++)
+				print("FAIL: ranger %u, exchange %u - offset %ld (%u ppb astray), not %ld\n",
+					ranger, round, (long)cor, n ? ssNeighborCorPpb(n, ranger) : 0, (long)offset[ranger]);
+			}
+	return reads;
+	}
+
+void abortHandler(int sig)
+	{
+	// for this test, we simply exit
+	exit(-42);
+	}
+
+void TEST()
+	{
+	printf(">>%s\n", __func__);
+
+	// first, capture the SIGABRT signal
+	signal(SIGABRT, abortHandler);
+
+	makePool();
+	if (ssNeighborAdd(0))
+		{
+		print("FAIL: addr 0 (a free entry) was added\n");
+		failed++;
+		}
+
+	UInt32 adds = 0, removes = 0, fulls = 0;
+	for (UInt32 op = 0; op < kNeighborOps && !failed; op++)
+		{
+		word i = (word)(random32() % kNeighborPool);
+
+		// mostly churn about half full, now and then fill it up or (nearly) empty it
+		byte phase = (byte)((op / 5000) % 4);
+		byte addBias = phase == 1 ? 80 : phase == 3 ? 20 : 50;
+		if ((byte)(random32() % 100) < addBias)
+			{
+			add(op, i);
+			adds++;
+			if (heldCount == kNeighbors)
+				fulls++;
+			}
+		else
+			{
+			drop(i);
+			removes++;
+			}
+		checkAll(op, "churn");
+		}
+	print("%u adds, %u removes (full %u times), %u addrs over %u entries\n",
+		adds, removes, fulls, kNeighborPool, kNeighbors);
+
+	// empty it - every entry must go
+	for (word i = 0; i < kNeighborPool; i++)
+		drop(i);
+	checkAll(kNeighborOps, "emptied");
+	if (ssNeighborNext(NULL))
+		{
+		print("FAIL: the table isn't empty\n");
+		failed++;
+		}
+
+	// timeouts alone add nothing (or the table would fill with nodes that
+	// never answer), but are counted once there's an entry
+	for (word i = 0; i < kNeighborPool; i++)
+		ssNeighborTimeout(pool[i]);
+	if (ssNeighborNext(NULL))
+		{
+		print("FAIL: timeouts alone added neighbors\n");
+		failed++;
+		}
+	ssNeighborRanged(pool[1], 7, 1234);
+	ssNeighborTimeout(pool[1]);
+	ssNeighborTimeout(pool[1]);
+	ssNeighbor n = ssNeighborOf(pool[1]);
+	if (!n || n->ranged != 1 || n->timeouts != 2 || n->mm != 1234)
+		{
+		print("FAIL: %04X - ranged %u, %u timeouts, not 1 and 2\n", pool[1], n ? n->ranged : 0, n ? n->timeouts : 0);
+		failed++;
+		}
+	ssNeighborRemove(pool[1]);
+
+	// each radio's clock offset kept apart
+	UInt32 reads = checkClocks(pool[0]);
+	UInt32 most = 2 * (2 + (kNeighborCorRounds - 2 + kCorRefresh - 1) / kCorRefresh);
+	if (reads > most)
+		{
+		print("FAIL: the clock offset was read %u times in %u exchanges (at most %u)\n",
+			reads, 2 * kNeighborCorRounds, most);
+		failed++;
+		}
+	print("clock offsets: read %u times in %u exchanges by 2 rangers\n", reads, 2 * kNeighborCorRounds);
+
+	printf("<<%s %s\n", __func__, failed ? "FAILED" : "passed");
+	exit(failed ? -1 : 0);
+	}
@@ -0,0 +1,185 @@
+/*
+ * File: TestSsRate.c
+ *
+ * Contains: Test the adaptive ranging rate scheduler on simulated radios
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright:	© 1989-2023 by Guy McIlroy
+ *  All rights reserved.
+ *
+ *  Use of this code is subject to the terms of the KoliadaESDK license.
+ *  https://docs.koliada.com/KoliadaESDKLicense.pdf
+ *
+ *  Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+#include "interface/dw3000.h"
+
+#include "ssRange.h"
+#include "ssRate.h"
+#include "dwSim.h"
+
+// This test runs on the host build, against simulated radios (build with
+// USE_DWSIM, see dwSim.c). A tag ranges to three anchors through ssRateStart -
+// two standing still, one walking away at kRateWalkMm a second. With a budget
+// to spare, the walker must settle on about the interval its speed calls for
+// (kRateStepMm at that speed) and the still ones slow towards kRateMaxMs. Then
+// it is started again on a budget too short for them all; every interval must
+// be stretched alike to fit, and the exchanges per second kept within it.
+// Throughout, each result posted must be from one of the targets, and the
+// results counted in ssRateStats must add up to those posted (a result from
+// before the restart is dropped, not posted or counted against the new run).
+
+#define kRateWalkMm		500		// mm/s, the walking anchor
+#define kRateRunMs		4000	// each run
+#define kRateBudget		50		// exchanges per second - plenty
+#define kRateTight		3		// ... and too few for three targets
+
+#ifndef USE_DWSIM
+	#error This test runs on simulated radios - build with USE_DWSIM
+#endif
+
+static _dwSimConfig simConfig = {0.0, 0.05, 500.0, 11, 1};
+
+static wyde targets[] = {0xA001, 0xA002, 0xA003};	// the last walks
+#define kRateTargetCount (sizeof(targets) / sizeof(targets[0]))
+
+static RADIO walker;
+static UInt32 posted, postedOk, foreign, failed;
+
+static void resultHandler(EVENT e, ssRangeData result, word ok)
+	{
+	// running in application context
+	posted++;
+	if (!ok)
+		return;
+	postedOk++;
+	byte i;
+	for (i = 0; i < kRateTargetCount && targets[i] != result->rangee; i++)
+		;
+	if (i == kRateTargetCount && !foreign++)
+		print("FAIL: a result from %04X, not a target\n", result->rangee);
+	}
+
+// runs for ms, walking the walker away - returns the results ssRateStats counted
+static UInt32 run(UInt32 ms, double *x)
+	{
+	double t0 = dwSimTime(), last = t0;
+	while (dwSimTime() - t0 < ms / 1000.0)
+		{
+		EventYield();
+		double now = dwSimTime();
+		if (now - last >= 0.01)
+			{
+			*x += (now - last) * kRateWalkMm / 1000.0;
+			last = now;
+			dwSimMove(walker, *x, 0.0, 0.0);
+			}
+		}
+	UInt32 results = 0;
+	for (byte i = 0; i < kRateTargetCount; i++)
+		{
+		_ssRateStat s;
+		ssRateStats(targets[i], &s);
+		results += s.results;
+		print("  %04X: every %ums (scheduled %ums), %umm/s, %u polls, %u results\n",
+			targets[i], s.intervalMs, s.scheduledMs, s.speed, s.polls, s.results);
+		}
+	return results;
+	}
+
+void abortHandler(int sig)
+	{
+	// for this test, we simply exit
+	exit(-42);
+	}
+
+void TEST()
+	{
+	printf(">>%s\n", __func__);
+
+	// first, capture the SIGABRT signal
+	signal(SIGABRT, abortHandler);
+
+	dwSimInit(&simConfig);
+	RADIO tag = dwSimCreate(0, 0.0, 0.0, 0.0, 0.0);
+	dwSimCreate(targets[0], 3.0, 12.5, 10.0, 0.0);
+	dwSimCreate(targets[1], -8.0, 0.0, 10.0, 0.0);
+	double x = 2.0;
+	walker = dwSimCreate(targets[2], 2.0, x, 0.0, 0.0);
+	ssInit(tag);
+
+	EVENT result;
+	objectCreate(result);
+	OnEvent(result, (HANDLER) resultHandler);
+
+	// plenty of budget - each at the rate its motion calls for
+	print("budget %u/s:\n", kRateBudget);
+	ssRateStart(tag, targets, kRateTargetCount, kRateBudget, result);
+	UInt32 results = run(kRateRunMs, &x);
+	_ssRateStat s;
+	ssRateStats(targets[2], &s);
+	word want = (word)((UInt32)kRateStepMm * 1000 / kRateWalkMm);
+	if (s.speed < kRateWalkMm / 2 || s.speed > kRateWalkMm * 2 || s.intervalMs < want / 2 || s.intervalMs > want * 2)
+		{
+		print("FAIL: the walker is ranged every %ums at %umm/s, not about %ums at %umm/s\n",
+			s.intervalMs, s.speed, want, kRateWalkMm);
+		failed++;
+		}
+	for (byte i = 0; i < 2; i++)
+		{
+		ssRateStats(targets[i], &s);
+		if (s.intervalMs < 4 * want || s.speed > kRateNoiseMm)
+			{
+			print("FAIL: %04X, standing still, is ranged every %ums at %umm/s\n", targets[i], s.intervalMs, s.speed);
+			failed++;
+			}
+		}
+	if (results != postedOk)
+		{
+		print("FAIL: %u results counted, %u posted\n", results, postedOk);
+		failed++;
+		}
+
+	// too little budget - stretched alike, and kept to it (started again with
+	// requests in flight, whose results mustn't count)
+	print("budget %u/s:\n", kRateTight);
+	posted = postedOk = 0;
+	ssRateStart(tag, targets, kRateTargetCount, kRateTight, result);
+	results = run(kRateRunMs, &x);
+	UInt32 polls = 0, stretch = 0;
+	for (byte i = 0; i < kRateTargetCount; i++)
+		{
+		ssRateStats(targets[i], &s);
+		polls += s.polls;
+		UInt32 q = ((UInt32)s.scheduledMs << 8) / s.intervalMs;
+		if (i && (q > stretch + 2 || q + 2 < stretch))
+			{
+			print("FAIL: %04X stretched %u/256, the others %u/256\n", targets[i], q, stretch);
+			failed++;
+			}
+		stretch = q;
+		}
+	// (plus one each, as they all start at once)
+	UInt32 most = (UInt32)kRateTight * kRateRunMs / 1000 + kRateTargetCount;
+	if (polls > most)
+		{
+		print("FAIL: %u polls in %ums on a budget of %u/s\n", polls, kRateRunMs, kRateTight);
+		failed++;
+		}
+	if (results != postedOk)
+		{
+		print("FAIL: %u results counted, %u posted\n", results, postedOk);
+		failed++;
+		}
+	ssRateStop();
+	print("%u polls (at most %u), %u results posted\n", polls, most, postedOk);
+
+	failed += foreign;
+	printf("<<%s %s\n", __func__, failed ? "FAILED" : "passed");
+	exit(failed ? -1 : 0);
+	}
@@ -0,0 +1,229 @@
+/*
+ * File: TestSsTof.c
+ *
+ * Contains: Test fixed point time of flight against the double calculation
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright:	© 1989-2023 by Guy McIlroy
+ *  All rights reserved.
+ *
+ *  Use of this code is subject to the terms of the KoliadaESDK license.
+ *  https://docs.koliada.com/KoliadaESDKLicense.pdf
+ *
+ *  Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+#include "interface/dw3000.h"
+
+#include <math.h>
+#include <time.h>
+
+#include "ssRange.h"
+#include "ssTof.h"
+
+// This test runs on the host build (no radio needed). It feeds ssTofMm and
+// ssTofDistance the same synthetic exchanges, with timestamps drawn from the
+// whole 40-bit range (so both clocks wrap), reply times up to 2^31 time units or
+// (half the time) up to 2^38 - well past the old 32-bit limit - clock offsets up
+// to +/-488ppm and distances up to 600km, and checks every fixed point result is
+// within the bound documented in ssTof.h. It then times both calculations, and
+// does the same for the DS-TWR pair (ssDsTofMm and ssDsTofDistance), whose
+// replies are drawn up to 2^30 or 2^36 each.
+
+#define kTofSamples 1000000
+#define kTofMaxTicks ((UInt32)1 << 27)	// 2 * tof, ~600km
+
+static UInt32 random32()
+	{
+	return (UInt32)randomByte() << 24 | (UInt32)randomByte() << 16 | (UInt32)randomByte() << 8 | randomByte();
+	}
+
+static dwTime random40()
+	{
+	return (dwTime)randomByte() << 32 | random32();
+	}
+
+// a random exchange - returns the two round trip deltas and the clock offset
+static void randomExchange(dwTime *rtdInit, dwTime *rtdResp, Int32 *corQ26)
+	{
+	dwTime t1 = random40(), t2 = random40();
+	dwTime reply = random40() & (randomByte() & 1 ? 0x3FFFFFFFFFULL : 0x7FFFFFFF);
+	Int32 cor = (Int32)(random32() % 0x10001) - 0x8000;
+
+	// short or long range, with a little noise
+	UInt32 tof2 = random32() % (randomByte() & 1 ? kTofMaxTicks : 4096);
+	Int32 noise = (Int32)randomByte() - 128;
+
+	dwTime t3 = (t2 + reply) & kDwTimeMask;
+	dwTime t4 = (t1 + (dwTime)llround(reply * (1 - cor / (double)((teta)1 << 26))) + tof2 + noise) & kDwTimeMask;
+
+	*rtdInit = dwTimeDelta(t4, t1);
+	*rtdResp = dwTimeDelta(t3, t2);
+	*corQ26 = cor;
+	}
+
+// a random DS exchange - returns the four deltas
+static void randomDsExchange(dwTime *round1, dwTime *reply1, dwTime *round2, dwTime *reply2)
+	{
+	dwTime mask = randomByte() & 1 ? 0xFFFFFFFFFULL : 0x3FFFFFFF;
+	dwTime r1 = random40() & mask, r2 = random40() & mask;
+	double ratio = ((Int32)(random32() % 0x10001) - 0x8000) / (double)((teta)1 << 26);
+	UInt32 tof2 = random32() % (randomByte() & 1 ? kTofMaxTicks : 4096);
+
+	// ranger clock is true time, the rangee's runs at 1 + ratio
+	*reply1 = r1;
+	*round1 = (dwTime)llround(tof2 + r1 / (1 + ratio)) + (Int32)randomByte() - 128;
+	*reply2 = r2;
+	*round2 = (dwTime)llround((tof2 + (double)r2) * (1 + ratio)) + (Int32)randomByte() - 128;
+	}
+
+// the accuracy check of each exchange (returns 1 if out of bounds)
+static byte checkDs(dwTime round1, dwTime reply1, dwTime round2, dwTime reply2, double *worst, double *worstAt)
+	{
+	double mm = ssDsTofDistance(round1, reply1, round2, reply2) * 1000.0;
+	double err = fabs(mm - ssDsTofMm(round1, reply1, round2, reply2));
+	if (err > *worst)
+		{
+		*worst = err;
+		*worstAt = mm;
+		}
+	return err > kTofMmErrorBound + fabs(mm) * kTofMmErrorPpm / 1e6;
+	}
+
+void abortHandler(int sig)
+	{
+	// for this test, we simply exit
+	exit(-42);
+	}
+
+void TEST()
+	{
+	printf(">>%s\n", __func__);
+	
+	// first, capture the SIGABRT signal
+	signal(SIGABRT, abortHandler);
+
+	// accuracy
+	dwTime rtdInit, rtdResp;
+	Int32 cor;
+	double worst = 0.0, worstAt = 0.0;
+	UInt32 failed = 0;
+	for (UInt32 i = 0; i < kTofSamples; i++)
+		{
+		randomExchange(&rtdInit, &rtdResp, &cor);
+		double mm = ssTofDistance(rtdInit, rtdResp, cor) * 1000.0;
+		double err = fabs(mm - ssTofMm(rtdInit, rtdResp, cor));
+		if (err > kTofMmErrorBound + fabs(mm) * kTofMmErrorPpm / 1e6)
+			{
+			if (!failed++)
+				print("FAIL: %llu %llu %ld -> %.3fmm, error %.3fmm\n",
+					(unsigned long long)rtdInit, (unsigned long long)rtdResp, (long)cor, mm, err);
+			}
+		if (err > worst)
+			{
+			worst = err;
+			worstAt = mm;
+			}
+		}
+	print("accuracy: %u samples, %u out of bounds, worst error %.3fmm at %.0fmm\n", kTofSamples, failed, worst, worstAt);
+
+	// speed (same inputs for both)
+	#define kTofBatch 1024
+	static dwTime init[kTofBatch], resp[kTofBatch];
+	static Int32 cors[kTofBatch];
+	for (word i = 0; i < kTofBatch; i++)
+		randomExchange(&init[i], &resp[i], &cors[i]);
+
+	volatile double dsink = 0.0;
+	volatile Int32 isink = 0;
+	clock_t start = clock();
+	for (UInt32 n = 0; n < kTofSamples / kTofBatch; n++)
+		for (word i = 0; i < kTofBatch; i++)
+			dsink += ssTofDistance(init[i], resp[i], cors[i]);
+	double dSecs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	start = clock();
+	for (UInt32 n = 0; n < kTofSamples / kTofBatch; n++)
+		for (word i = 0; i < kTofBatch; i++)
+			isink += ssTofMm(init[i], resp[i], cors[i]);
+	double iSecs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	UInt32 count = kTofSamples / kTofBatch * kTofBatch;
+	print("double: %.1f ns/range\n", dSecs * 1e9 / count);
+	print("fixed : %.1f ns/range\n", iSecs * 1e9 / count);
+
+	// DS-TWR accuracy
+	dwTime round1, reply1, round2, reply2;
+	UInt32 dsFailed = 0;
+	worst = 0.0;
+	for (UInt32 i = 0; i < kTofSamples; i++)
+		{
+		randomDsExchange(&round1, &reply1, &round2, &reply2);
+		if (checkDs(round1, reply1, round2, reply2, &worst, &worstAt) && !dsFailed++)
+			print("FAIL: DS %llu %llu %llu %llu\n", (unsigned long long)round1, (unsigned long long)reply1,
+				(unsigned long long)round2, (unsigned long long)reply2);
+		}
+	print("DS accuracy: %u samples, %u out of bounds, worst error %.3fmm at %.0fmm\n", kTofSamples, dsFailed, worst, worstAt);
+	failed += dsFailed;
+
+	// DS clock offset - within a unit of the double calculation (rounded)
+	UInt32 corFailed = 0;
+	double corWorst = 0.0;
+	for (UInt32 i = 0; i < kTofSamples; i++)
+		{
+		randomDsExchange(&round1, &reply1, &round2, &reply2);
+		double ratio = ((double)reply1 + round2 - ((double)round1 + reply2)) / ((double)round1 + reply2);
+		double err = fabs(ratio * ((teta)1 << 26) - ssDsCorQ26(round1, reply1, round2, reply2));
+		if (err > corWorst)
+			corWorst = err;
+		if (err > 1.0 && !corFailed++)
+			print("FAIL: DS cor %llu %llu %llu %llu\n", (unsigned long long)round1, (unsigned long long)reply1,
+				(unsigned long long)round2, (unsigned long long)reply2);
+		}
+	print("DS clock offset: %u samples, %u out of bounds, worst error %.3f (Q26)\n", kTofSamples, corFailed, corWorst);
+	failed += corFailed;
+
+	// a peer's timestamps across the 2^32 wrap - from a 32 bit node (a zero high
+	// byte) and a 40 bit one, and a 40 bit pair across the 2^40 wrap
+	static const dwTime peer[][3] =
+		{
+		{0xFFFFFF00ULL, 0x100ULL, 0x200},
+		{0xFFFFFF00ULL, 0x100000100ULL, 0x200},
+		{0xFFFFFFFF00ULL, 0x100ULL, 0x200},
+		{0x1000ULL, 0x2000ULL, 0x1000},
+		};
+	for (byte i = 0; i < sizeof(peer) / sizeof(peer[0]); i++)
+		if (dwTimePeerDelta(peer[i][1], peer[i][0]) != peer[i][2])
+			{
+			print("FAIL: peer delta %llx - %llx = %llx\n", (unsigned long long)peer[i][1],
+				(unsigned long long)peer[i][0], (unsigned long long)dwTimePeerDelta(peer[i][1], peer[i][0]));
+			failed++;
+			}
+
+	// DS-TWR speed
+	static dwTime dsDeltas[kTofBatch][4];
+	for (word i = 0; i < kTofBatch; i++)
+		randomDsExchange(&dsDeltas[i][0], &dsDeltas[i][1], &dsDeltas[i][2], &dsDeltas[i][3]);
+
+	start = clock();
+	for (UInt32 n = 0; n < kTofSamples / kTofBatch; n++)
+		for (word i = 0; i < kTofBatch; i++)
+			dsink += ssDsTofDistance(dsDeltas[i][0], dsDeltas[i][1], dsDeltas[i][2], dsDeltas[i][3]);
+	dSecs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	start = clock();
+	for (UInt32 n = 0; n < kTofSamples / kTofBatch; n++)
+		for (word i = 0; i < kTofBatch; i++)
+			isink += ssDsTofMm(dsDeltas[i][0], dsDeltas[i][1], dsDeltas[i][2], dsDeltas[i][3]);
+	iSecs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	print("DS double: %.1f ns/range\n", dSecs * 1e9 / count);
+	print("DS fixed : %.1f ns/range\n", iSecs * 1e9 / count);
+
+	printf("<<%s %s\n", __func__, failed ? "FAILED" : "passed");
+	exit(failed ? -1 : 0);
+	}
@@ -0,0 +1,287 @@
+/*
+ * File: TestTdma.c
+ *
+ * Contains: Test scheduled (TDMA) ranging on simulated radios
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright:	© 1989-2023 by Guy McIlroy
+ *  All rights reserved.
+ *
+ *  Use of this code is subject to the terms of the KoliadaESDK license.
+ *  https://docs.koliada.com/KoliadaESDKLicense.pdf
+ *
+ *  Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+#include "interface/dw3000.h"
+
+#include <math.h>
+#include <time.h>
+
+#include "ssRange.h"
+#include "ssTdma.h"
+#include "dwSim.h"
+
+// This test runs on the host build, against simulated radios (build with
+// USE_DWSIM, see dwSim.c). An anchor coordinates 50ms superframes and two tags
+// (consecutive addrs, so different slots) range to it and three more anchors.
+// Each tag's polls are checked, in its own device time, to fall within its slot
+// of the superframe its last beacon laid out, and each range against the true
+// distance. (The tags are two radios of this node, each given its own addr - see
+// ssRangerInit.) Part way
+// through, the application is held up for longer than a superframe, so the
+// coordinator wakes too late to place its next beacon and the tags too late for
+// their slots; the beacons must carry on (late, then on time again), the tags
+// skip what they missed, and every tag must be back to full rounds afterwards
+// (most of them - the sim keeps to the host's clock, so a busy host can hold a
+// tag up past its slot now and then). Then the coordinator is stopped and the
+// tags leave, and they carry on ranging on their own - to the coordinator's
+// radio too, whose delegates stay, and must take no notice (and beacon no more).
+
+#define kTdmaFrameMs	50
+#define kTdmaRounds		40		// superframes in all
+#define kTdmaStallAt	20		// superframe after whose beacon the application stalls
+#define kTdmaStallMs	70
+#define kTdmaRangeM		0.3		// allowed range error (the sim's noise is 0.02m)
+#define kTdmaSkewUs		20		// as ssTdma.c - a frame a hair early for its slot is in it
+#define kTdmaAfterStop	5		// rounds ranged to every anchor once stopped
+
+#ifndef USE_DWSIM
+	#error This test runs on simulated radios - build with USE_DWSIM
+#endif
+
+static _dwSimConfig simConfig = {0.0, 0.02, 500.0, 7, 1};
+
+static wyde anchors[] = {0xA000, 0xA001, 0xA002, 0xA003};
+#define kTdmaAnchors (sizeof(anchors) / sizeof(anchors[0]))
+static RADIO anchorRadios[kTdmaAnchors];
+
+typedef struct
+	{
+	RADIO radio;
+	wyde addr;
+	_ssRangeData results[kTdmaAnchors];
+	EVENT round;
+	DELEGATE rxReady, txDone;
+
+	// the superframe, as its last beacon laid it out
+	dwTime beaconRx;
+	wyde slots, slotUs, firstUs;
+
+	UInt32 rounds, full, empty, ranges, badRanges, polls, badPolls;
+	UInt32 fullAfter;		// full rounds after the stall
+	} _tdmaTestTag;
+
+static _tdmaTestTag tags[2];
+#define kTdmaTags (sizeof(tags) / sizeof(tags[0]))
+
+#define kTicksPerUs		63898.0	// device time units per us
+
+// the superframe, from the coordinator's side
+static wyde superframe;
+static UInt32 beacons;
+static DELEGATE coordinatorTxDone;
+static EVENT stall;
+static byte stopped;		// the tags have left (their polls are no longer in slots)
+
+static double now()
+	{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+	}
+
+static void stallHandler(EVENT e, byte *buf, word len)
+	{
+	// running in application context
+	// hold everything up, as a long running handler would
+	double until = now() + kTdmaStallMs / 1000.0;
+	while (now() < until)
+		;
+	}
+
+static void beaconSent(byte *frame, word len)
+	{
+	// running in the interrupt handler!!
+	if (frame[MSG_FUNC_IDX] != FUNC_TDMA_BEACON)
+		return;
+	superframe = *((wyde *)&frame[BEACON_MSG_ROUND_IDX]);
+	beacons++;
+	if (superframe == kTdmaStallAt)
+		PostEvent(stall, NULL, 0);
+	}
+
+static void beaconHeard(_tdmaTestTag *t, byte *buf, word len)
+	{
+	// running in the interrupt handler!!
+	if (len != sizeof_ssTdmaBeaconMsg || buf[MSG_FUNC_IDX] != FUNC_TDMA_BEACON)
+		return;
+	IRADIO.Iocntl(t->radio, dwGetRxTime, &t->beaconRx);
+	t->slots = *((wyde *)&buf[BEACON_MSG_SLOTS_IDX]);
+	t->slotUs = *((wyde *)&buf[BEACON_MSG_SLOT_US_IDX]);
+	t->firstUs = *((wyde *)&buf[BEACON_MSG_FIRST_US_IDX]);
+	}
+
+static void pollSent(_tdmaTestTag *t, byte *frame)
+	{
+	// running in the interrupt handler!!
+	// a poll must lie in the tag's own slot (of the superframe it follows)
+	if (frame[MSG_FUNC_IDX] != 0xE0 || !t->slots || stopped)
+		return;
+	t->polls++;
+	dwTime tx;
+	IRADIO.Iocntl(t->radio, dwGetTxTime, &tx);
+	double us = dwTimeDelta(tx, t->beaconRx) / kTicksPerUs;
+	double in = us - t->firstUs + kTdmaSkewUs;
+	if (in < 0.0 || (UInt32)(in / t->slotUs) != ssTdmaSlot(t->addr, t->slots))
+		{
+		if (!t->badPolls++)
+			print("FAIL: %04X polled %.1fus into superframe %u (%u slots of %uus, its slot %u)\n",
+				t->addr, us, superframe, t->slots, t->slotUs, ssTdmaSlot(t->addr, t->slots));
+		}
+	}
+
+static void beaconHeard0(byte *buf, word len)	{ beaconHeard(&tags[0], buf, len); }
+static void beaconHeard1(byte *buf, word len)	{ beaconHeard(&tags[1], buf, len); }
+static void pollSent0(byte *frame, word len)	{ pollSent(&tags[0], frame); }
+static void pollSent1(byte *frame, word len)	{ pollSent(&tags[1], frame); }
+
+static void roundHandler(EVENT e, ssRangeData results, word n)
+	{
+	// running in application context
+	_tdmaTestTag *t = tags;
+	byte i;
+	for (i = 0; i < kTdmaTags && t->round != e; i++, t++)
+		;
+	t->rounds++;
+	if (!n)
+		t->empty++;
+	if (n == kTdmaAnchors)
+		{
+		t->full++;
+		if (superframe > kTdmaStallAt + 2)
+			t->fullAfter++;
+		}
+	for (i = 0; i < n; i++)
+		{
+		byte a;
+		for (a = 0; a < kTdmaAnchors && anchors[a] != results[i].rangee; a++)
+			;
+		t->ranges++;
+		double truth = a < kTdmaAnchors ? dwSimRange(t->radio, anchorRadios[a]) : 0.0;
+		if (a == kTdmaAnchors || fabs(results[i].range - truth) > kTdmaRangeM)
+			{
+			if (!t->badRanges++)
+				print("FAIL: %04X to %04X %.3fm, truly %.3fm\n", t->addr, results[i].rangee, results[i].range, truth);
+			}
+		}
+	}
+
+void abortHandler(int sig)
+	{
+	// for this test, we simply exit
+	exit(-42);
+	}
+
+void TEST()
+	{
+	printf(">>%s\n", __func__);
+
+	// first, capture the SIGABRT signal
+	signal(SIGABRT, abortHandler);
+
+	// the coordinator is the first anchor, the tags are between them
+	dwSimInit(&simConfig);
+	anchorRadios[0] = dwSimCreate(anchors[0], -5.0, 0.0, 0.0, 0.0);
+	anchorRadios[1] = dwSimCreate(anchors[1], 12.5, 10.0, 0.0, 0.0);
+	anchorRadios[2] = dwSimCreate(anchors[2], -8.0, 0.0, 10.0, 0.0);
+	anchorRadios[3] = dwSimCreate(anchors[3], 2.0, 10.0, 10.0, 0.0);
+	tags[0].radio = dwSimCreate(0, 3.0, 3.0, 4.0, 0.0);
+	tags[1].radio = dwSimCreate(0, -1.0, 7.0, 2.0, 1.0);
+
+	byte i;
+	for (i = 0; i < kTdmaTags; i++)
+		{
+		_tdmaTestTag *t = &tags[i];
+		ssInit(t->radio);
+		t->addr = ((Dw3000)tags[0].radio)->addr + i;
+		if (i)
+			{
+			IRADIO.Iocntl(t->radio, kRadioSetAddr, t->addr);
+			ssRangerInit(t->radio);
+			}
+		objectCreate(t->round);
+		OnEvent(t->round, (HANDLER) roundHandler);
+		objectCreate(t->rxReady, delegateTask(i ? beaconHeard1 : beaconHeard0));
+		IRADIO.Iocntl(t->radio, kRadioAddRxReady, t->rxReady);
+		objectCreate(t->txDone, delegateTask(i ? pollSent1 : pollSent0));
+		IRADIO.Iocntl(t->radio, kRadioAddTxDone, t->txDone);
+		}
+	objectCreate(coordinatorTxDone, delegateTask(beaconSent));
+	IRADIO.Iocntl(anchorRadios[0], kRadioAddTxDone, coordinatorTxDone);
+	objectCreate(stall);
+	OnEvent(stall, (HANDLER) stallHandler);
+
+	ssTdmaCoordinate(anchorRadios[0], kTdmaFrameMs, kTdmaAnchors);
+	for (i = 0; i < kTdmaTags; i++)
+		ssTdmaJoin(tags[i].radio, anchors, kTdmaAnchors, tags[i].results, tags[i].round);
+
+	// run for kTdmaRounds superframes (or give up after twice as long)
+	double end = now() + 2.0 * kTdmaRounds * kTdmaFrameMs / 1000.0;
+	while (superframe < kTdmaRounds && now() < end)
+		EventYield();
+	ssTdmaStop(anchorRadios[0]);
+	for (i = 0; i < kTdmaTags; i++)
+		ssTdmaLeave(tags[i].radio);
+	UInt32 stoppedAt = beacons;
+	stopped = 1;
+
+	// stopped - ranging on, with the coordinator's delegates still on its radio
+	UInt32 after = 0, afterBad = 0;
+	for (byte k = 0; k < kTdmaAfterStop; k++)
+		for (i = 0; i < kTdmaTags; i++)
+			for (byte a = 0; a < kTdmaAnchors; a++)
+				{
+				_ssRangeData r;
+				int rid = ssRangeStart(tags[i].radio, anchors[a], &r);
+				if (rid >= 0 && ssRangeWait(rid) == kRangeDone &&
+						fabs(r.range - dwSimRange(tags[i].radio, anchorRadios[a])) <= kTdmaRangeM)
+					after++;
+				else if (!afterBad++)
+					print("FAIL: %04X to %04X, once stopped - %s\n", tags[i].addr, anchors[a],
+						rid < 0 ? "not started" : ssRangeStatus(rid) == kRangeDone ? "out of range" : "timed out");
+				}
+	// (a beacon already set up as a delayed tx may still go)
+	for (double until = now() + 2.0 * kTdmaFrameMs / 1000.0; now() < until; )
+		EventYield();
+
+	// every superframe beaconed, and the tags back to full rounds after the stall
+	UInt32 failed = beacons < kTdmaRounds;
+	if (failed)
+		print("FAIL: %u beacons of %u\n", beacons, kTdmaRounds);
+	print("%u beacons, last %u slots of %uus\n", stoppedAt, tags[0].slots, tags[0].slotUs);
+	for (i = 0; i < kTdmaTags; i++)
+		{
+		_tdmaTestTag *t = &tags[i];
+		print("  %04X (slot %u): %u rounds, %u full, %u empty, %u full after the stall; "
+			"%u ranges, %u out; %u polls, %u out of slot\n",
+			t->addr, ssTdmaSlot(t->addr, t->slots), t->rounds, t->full, t->empty, t->fullAfter,
+			t->ranges, t->badRanges, t->polls, t->badPolls);
+		if (t->badRanges || t->badPolls || t->fullAfter < (kTdmaRounds - kTdmaStallAt - 3) * 3 / 4)
+			failed++;
+		}
+	print("once stopped: %u of %u ranged, %u beacons\n", after, kTdmaAfterStop * kTdmaTags * kTdmaAnchors,
+		beacons - stoppedAt);
+	if (afterBad || beacons > stoppedAt + 1)
+		{
+		print("FAIL: %u not ranged once stopped, %u beacons after\n", afterBad, beacons - stoppedAt);
+		failed++;
+		}
+
+	printf("<<%s %s\n", __func__, failed ? "FAILED" : "passed");
+	exit(failed ? -1 : 0);
+	}
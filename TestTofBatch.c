@@ -0,0 +1,164 @@
+/*
+ * File: TestTofBatch.c
+ *
+ * Contains: Batch (SIMD) SS-TWR distance accuracy and benchmark
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright:	© 1989-2023 by Guy McIlroy
+ *  All rights reserved.
+ *
+ *  Use of this code is subject to the terms of the KoliadaESDK license.
+ *  https://docs.koliada.com/KoliadaESDKLicense.pdf
+ *
+ *  Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+#include "interface/dw3000.h"
+
+#include <math.h>
+#include <time.h>
+
+#include "ssRange.h"
+#include "ssTof.h"
+#include "ssTofBatch.h"
+
+// This test runs on the host build (no radio needed). It feeds ssTofBatchDistance
+// (as built - AVX2, SSE2 or scalar) and ssTofBatchScalar the same synthetic
+// exchanges as TestSsTof (timestamps from the whole 40-bit range, replies up to
+// 2^31 or 2^38 time units, clock offsets up to +/-488ppm, distances up to
+// 600km) and checks every result is within kTofBatchErrorM of ssTofDistance's.
+//
+// It then times the three over kTofRecords exchanges, in batches of each of
+// kTofBatchSizes, and reports records/second - first as text, then as a single
+// 'BENCH {...}' json line for tracking results from release to release.
+
+#define kTofRecords 65536
+#define kTofPasses 64	// over the records, per batch size
+#define kTofMaxTicks ((UInt32)1 << 27)	// 2 * tof, ~600km
+
+static const UInt32 kTofBatchSizes[] = {1, 2, 4, 8, 16, 64, 256, 1024, 4096, kTofRecords};
+#define kTofSizes (sizeof(kTofBatchSizes) / sizeof(kTofBatchSizes[0]))
+
+static dwTime t1s[kTofRecords], t2s[kTofRecords], t3s[kTofRecords], t4s[kTofRecords];
+static Int32 cors[kTofRecords];
+static double distances[kTofRecords];
+
+static UInt32 random32()
+	{
+	return (UInt32)randomByte() << 24 | (UInt32)randomByte() << 16 | (UInt32)randomByte() << 8 | randomByte();
+	}
+
+static dwTime random40()
+	{
+	return (dwTime)randomByte() << 32 | random32();
+	}
+
+// a random exchange, as the timestamps themselves
+static void randomExchange(UInt32 i)
+	{
+	dwTime t1 = random40(), t2 = random40();
+	dwTime reply = random40() & (randomByte() & 1 ? 0x3FFFFFFFFFULL : 0x7FFFFFFF);
+	Int32 cor = (Int32)(random32() % 0x10001) - 0x8000;
+
+	// short or long range, with a little noise
+	UInt32 tof2 = random32() % (randomByte() & 1 ? kTofMaxTicks : 4096);
+	Int32 noise = (Int32)randomByte() - 128;
+
+	t1s[i] = t1;
+	t2s[i] = t2;
+	t3s[i] = (t2 + reply) & kDwTimeMask;
+	t4s[i] = (t1 + (dwTime)llround(reply * (1 - cor / (double)((teta)1 << 26))) + tof2 + noise) & kDwTimeMask;
+	cors[i] = cor;
+	}
+
+// worst difference from ssTofDistance (metres)
+static double worstError(UInt32 *failed)
+	{
+	double worst = 0.0;
+	for (UInt32 i = 0; i < kTofRecords; i++)
+		{
+		double err = fabs(distances[i] - ssTofDistance(dwTimeDelta(t4s[i], t1s[i]), dwTimeDelta(t3s[i], t2s[i]), cors[i]));
+		if (err > kTofBatchErrorM && !(*failed)++)
+			print("FAIL: %llu %llu %llu %llu %ld -> error %.3gm\n", (unsigned long long)t1s[i], (unsigned long long)t2s[i],
+				(unsigned long long)t3s[i], (unsigned long long)t4s[i], (long)cors[i], err);
+		if (err > worst)
+			worst = err;
+		}
+	return worst;
+	}
+
+// the reference, as a batch
+static void referenceBatch(ssTofBatch batch, UInt32 n, double *distance)
+	{
+	for (UInt32 i = 0; i < n; i++)
+		distance[i] = ssTofDistance(dwTimeDelta(batch->t4[i], batch->t1[i]), dwTimeDelta(batch->t3[i], batch->t2[i]), batch->cor[i]);
+	}
+
+// records per second through solve, batch at a time
+static double recordsPerSec(void (*solve)(ssTofBatch, UInt32, double *), UInt32 batch)
+	{
+	clock_t start = clock();
+	for (UInt32 pass = 0; pass < kTofPasses; pass++)
+		for (UInt32 i = 0; i < kTofRecords; i += batch)
+			{
+			_ssTofBatch b = {&t1s[i], &t2s[i], &t3s[i], &t4s[i], &cors[i]};
+			solve(&b, batch, &distances[i]);
+			}
+	double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+	return secs > 0.0 ? (double)kTofPasses * kTofRecords / secs : 0.0;
+	}
+
+void abortHandler(int sig)
+	{
+	// for this test, we simply exit
+	exit(-42);
+	}
+
+void TEST()
+	{
+	printf(">>%s\n", __func__);
+
+	// first, capture the SIGABRT signal
+	signal(SIGABRT, abortHandler);
+
+	static const char *paths[] = {"scalar", "SSE2", "AVX2"};
+	print("batch path: %s\n", paths[ssTofBatchPath]);
+
+	// accuracy
+	for (UInt32 i = 0; i < kTofRecords; i++)
+		randomExchange(i);
+	_ssTofBatch all = {t1s, t2s, t3s, t4s, cors};
+	UInt32 failed = 0;
+	ssTofBatchDistance(&all, kTofRecords, distances);
+	double worst = worstError(&failed);
+	ssTofBatchScalar(&all, kTofRecords, distances);
+	double worstScalar = worstError(&failed);
+	print("accuracy: %u records, %u out of bounds, worst error %.3gm (%s), %.3gm (scalar)\n",
+		kTofRecords, failed, worst, paths[ssTofBatchPath], worstScalar);
+
+	// speed
+	static double rates[kTofSizes][3];
+	byte s;
+	print("\n   batch   reference      scalar       batch  (records/s)\n");
+	for (s = 0; s < kTofSizes; s++)
+		{
+		rates[s][0] = recordsPerSec(referenceBatch, kTofBatchSizes[s]);
+		rates[s][1] = recordsPerSec(ssTofBatchScalar, kTofBatchSizes[s]);
+		rates[s][2] = recordsPerSec(ssTofBatchDistance, kTofBatchSizes[s]);
+		print("%8lu %11.3e %11.3e %11.3e\n", (unsigned long)kTofBatchSizes[s], rates[s][0], rates[s][1], rates[s][2]);
+		}
+
+	// machine readable (one line)
+	print("BENCH {\"path\":\"%s\",\"records\":%u,\"worstErrorM\":%.3g,\"sizes\":[", paths[ssTofBatchPath], kTofRecords, worst);
+	for (s = 0; s < kTofSizes; s++)
+		print("%s{\"batch\":%lu,\"reference\":%.0f,\"scalar\":%.0f,\"simd\":%.0f}", s ? "," : "",
+			(unsigned long)kTofBatchSizes[s], rates[s][0], rates[s][1], rates[s][2]);
+	print("]}\n");
+
+	printf("<<%s %s\n", __func__, failed ? "FAILED" : "passed");
+	exit(failed ? -1 : 0);
+	}
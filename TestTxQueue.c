@@ -0,0 +1,325 @@
+/*
+ * File: TestTxQueue.c
+ *
+ * Contains: Test the txDone paced transmit queue against stub devices
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright:	© 1989-2023 by Guy McIlroy
+ *  All rights reserved.
+ *
+ *  Use of this code is subject to the terms of the KoliadaESDK license.
+ *  https://docs.koliada.com/KoliadaESDKLicense.pdf
+ *
+ *  Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+#include "interface/radio.h"
+#include "interface/udp.h"
+
+#include <stdarg.h>
+
+#include "txQueue.h"
+
+// This test runs on the host build (no devices needed) - IRADIO and IUDP Send
+// and Iocntl are replaced by stub devices that take one frame at a time,
+// refuse those marked to be refused, and raise txDone (the delegate the queue
+// added) when the test says a frame has gone. A queue on each is driven at
+// random for kTxRounds rounds - some frames queued (now and then one too long
+// for its slot, or more than there is room for), then some sent - alongside
+// a plain model of what each queue holds. Every frame must reach its device
+// once, in order, whole, and only after the one before it has gone; and the
+// drops (full or too long), errors (refused), sent and high counts must agree
+// with the model, as must the space events a full queue posts. Now and then
+// a frame someone else sent on the device (not one of the queue's) is
+// reported done, which the queue must ignore. A queue may be started again on
+// its own device, but not moved to another (whose txDone it would never hear).
+
+#define kTxRounds		20000
+#define kTxSlots		8		// per queue
+#define kTxMaxLen		40		// frame bytes (at most) - more than some slots hold
+#define kTxFrameIdx		0		// UInt32 - frame #
+#define kTxRefuseIdx	4		// non zero - the device refuses it
+#define kTxMinLen		5
+
+#ifndef USE_INTERFACES
+	#error This test replaces IRADIO & IUDP - build with USE_INTERFACES
+#endif
+
+// a frame's contents, from its # and length
+#define frameByte(k, i)	((byte)((k) * 13 + (i) * 7))
+
+// a stub device - takes a frame at a time
+typedef struct
+	{
+	const char *name;
+	DELEGATE txDone;
+	byte *out;			// the frame on its way out (NULL if none)
+	word outLen;
+	UInt32 overlaps;	// Sends with a frame still out
+	} _stubDev, *stubDev;
+
+static _stubDev radioDev = {"radio"}, udpDev = {"udp"};
+
+// a queue, and what it should hold
+typedef struct
+	{
+	_txQueue q;
+	_txSlot slot[kTxSlots];
+	byte bufs[kTxSlots][kTxMaxLen];
+	stubDev dev;
+
+	// the model - frames # ..., queued and not yet sent (or refused)
+	UInt32 ids[kTxSlots];
+	word lens[kTxSlots];
+	UInt32 head, tail, accepted;	// (accepted - the frames queued, ever)
+	UInt32 next;					// # for the next frame
+	UInt32 drops, errors, sent, spaces, spacesSeen;
+	byte high;
+	} _testQueue, *testQueue;
+
+static _testQueue queues[2];
+static byte foreign[kTxMaxLen];		// a frame someone else sent
+static UInt32 seed = 0x9E3779B9, failed;
+
+static UInt32 random32()
+	{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+	}
+
+static testQueue queueOf(stubDev dev)
+	{
+	return queues[0].dev == dev ? &queues[0] : &queues[1];
+	}
+
+static int stubSend(stubDev dev, byte *frame, word len)
+	{
+	testQueue t = queueOf(dev);
+	if (dev->out && !dev->overlaps++)
+		print("FAIL: %s - a frame sent with another still out\n", dev->name);
+
+	// the oldest the model holds, whole
+	UInt32 k = t->ids[t->tail % kTxSlots];
+	word i;
+	for (i = kTxMinLen; i < len && frame[i] == frameByte(k, i); i++)
+		;
+	if ((t->tail == t->head || *((UInt32 *)&frame[kTxFrameIdx]) != k || len != t->lens[t->tail % kTxSlots] || i != len)
+		&& !failed++)
+		print("FAIL: %s - frame %u (%u bytes, %u good) sent, not frame %u (%u bytes)\n", dev->name,
+			*((UInt32 *)&frame[kTxFrameIdx]), len, i, k, t->lens[t->tail % kTxSlots]);
+	if (frame[kTxRefuseIdx])
+		{
+		t->tail++;
+		t->errors++;
+		return -1;
+		}
+	dev->out = frame;
+	dev->outLen = len;
+	return 0;
+	}
+
+static int stubIocntl(stubDev dev, int op, va_list args)
+	{
+	if (op == kRadioAddTxDone || op == kUdpAddTxDone)
+		dev->txDone = va_arg(args, DELEGATE);
+	return 0;
+	}
+
+static int radioSend(void *radio, byte *frame, word len)	{ return stubSend(&radioDev, frame, len); }
+static int udpSend(void *udp, byte *frame, word len)		{ return stubSend(&udpDev, frame, len); }
+
+static int radioIocntl(void *radio, int op, ...)
+	{
+	va_list args;
+	va_start(args, op);
+	int result = stubIocntl(&radioDev, op, args);
+	va_end(args);
+	return result;
+	}
+
+static int udpIocntl(void *udp, int op, ...)
+	{
+	va_list args;
+	va_start(args, op);
+	int result = stubIocntl(&udpDev, op, args);
+	va_end(args);
+	return result;
+	}
+
+// the frame out has gone (as the device's interrupt handler would say)
+static void stubDone(stubDev dev)
+	{
+	testQueue t = queueOf(dev);
+	byte *frame = dev->out;
+	dev->out = NULL;
+	if ((UInt32)(t->head - t->tail) == kTxSlots)
+		t->spaces++;
+	t->tail++;
+	t->sent++;
+	RunDelegate(dev->txDone, frame, dev->outLen);
+	}
+
+static void spaceHandler(EVENT e, txQueue q, word len)
+	{
+	// running in application context
+	testQueue t = (testQueue)q;
+	t->spacesSeen++;
+	if ((!len || len > kTxSlots) && !failed++)
+		print("FAIL: %s - space posted with %u free\n", t->dev->name, len);
+	}
+
+// queue a frame, as the model says it should go
+static void queueFrame(testQueue t, byte refuse)
+	{
+	UInt32 k = t->next++;
+	word len = kTxMinLen + (word)(random32() % (kTxMaxLen - kTxMinLen + 1));
+	byte frame[kTxMaxLen];
+	*((UInt32 *)&frame[kTxFrameIdx]) = k;
+	frame[kTxRefuseIdx] = refuse;
+	for (word i = kTxMinLen; i < len; i++)
+		frame[i] = frameByte(k, i);
+
+	// (the model first, as Send may go straight to the device)
+	byte fits = t->head - t->tail < kTxSlots && len <= t->slot[t->accepted % kTxSlots].size;
+	if (fits)
+		{
+		t->ids[t->head % kTxSlots] = k;
+		t->lens[t->head % kTxSlots] = len;
+		t->head++;
+		t->accepted++;
+		if (t->head - t->tail > t->high)
+			t->high = (byte)(t->head - t->tail);
+		}
+	else
+		t->drops++;
+	if (txQueueSend(&t->q, frame, len) != fits && !failed++)
+		print("FAIL: %s - frame %u (%u bytes) %s, with %u queued\n", t->dev->name, k, len,
+			fits ? "turned away" : "queued", txQueueCount(&t->q));
+	}
+
+// the queue's counts against the model's
+static void checkCounts(testQueue t, UInt32 round)
+	{
+	txQueue q = &t->q;
+	if ((q->drops != (word)t->drops || q->errors != (word)t->errors || q->sent != t->sent || q->high != t->high
+		|| txQueueCount(q) != (byte)(t->head - t->tail)) && !failed++)
+		print("FAIL: %s, round %u - %u drops, %u errors, %u sent, %u high, %u queued; the model says "
+			"%u, %u, %u, %u, %u\n", t->dev->name, round, q->drops, q->errors, q->sent, q->high, txQueueCount(q),
+			t->drops, t->errors, t->sent, t->high, t->head - t->tail);
+	}
+
+void abortHandler(int sig)
+	{
+	// for this test, we simply exit
+	exit(-42);
+	}
+
+void TEST()
+	{
+	printf(">>%s\n", __func__);
+
+	// first, capture the SIGABRT signal
+	signal(SIGABRT, abortHandler);
+
+	IRADIO.Send = radioSend;
+	IRADIO.Iocntl = radioIocntl;
+	IUDP.Send = udpSend;
+	IUDP.Iocntl = udpIocntl;
+
+	EVENT space;
+	objectCreate(space);
+	OnEvent(space, (HANDLER) spaceHandler);
+
+	// a queue on each device, the slots of different sizes (some too small for the longest frames)
+	for (byte n = 0; n < 2; n++)
+		{
+		testQueue t = &queues[n];
+		t->dev = n ? &udpDev : &radioDev;
+		for (byte i = 0; i < kTxSlots; i++)
+			{
+			t->slot[i].buf = t->bufs[i];
+			t->slot[i].size = kTxMaxLen - 4 * (i & 3);
+			}
+		if (!txQueueInit(&t->q, t->dev, n ? kTxQueueUdp : kTxQueueRadio, t->slot, kTxSlots))
+			{
+			print("FAIL: %s - no queue\n", t->dev->name);
+			failed++;
+			}
+		txQueueOnSpace(&t->q, space);
+		}
+	_txQueue extra;
+	if (txQueueInit(&extra, &radioDev, kTxQueueRadio, queues[0].slot, kTxSlots))
+		{
+		print("FAIL: a queue beyond the %u there are entry points for\n", kTxQueues);
+		failed++;
+		}
+	DELEGATE udpTxDone = udpDev.txDone;
+	if (txQueueInit(&queues[0].q, &udpDev, kTxQueueUdp, queues[0].slot, kTxSlots) || queues[0].q.dev != &radioDev
+		|| udpDev.txDone != udpTxDone)
+		{
+		print("FAIL: the radio's queue moved to the udp device\n");
+		failed++;
+		}
+	if (!txQueueInit(&queues[0].q, &radioDev, kTxQueueRadio, queues[0].slot, kTxSlots))
+		{
+		print("FAIL: the radio's queue can't be started again on the radio\n");
+		failed++;
+		}
+	txQueueOnSpace(&queues[0].q, space);
+
+	for (UInt32 round = 0; round < kTxRounds && !failed; round++)
+		for (byte n = 0; n < 2; n++)
+			{
+			testQueue t = &queues[n];
+
+			// some queued (now and then a burst, more than there's room for), and some refused
+			word count = random32() % 8 ? (word)(random32() % 4) : kTxSlots + 2;
+			for (word i = 0; i < count; i++)
+				queueFrame(t, random32() % 16 == 0);
+			if (t->head != t->tail && !t->dev->out && !failed++)
+				print("FAIL: %s, round %u - %u queued, none on its way out\n", t->dev->name, round, t->head - t->tail);
+
+			// now and then someone else's frame goes (the queue must pay it no heed)
+			if (random32() % 8 == 0)
+				RunDelegate(t->dev->txDone, foreign, sizeof(foreign));
+
+			// and some go
+			for (word i = (word)(random32() % 5); i && t->dev->out; i--)
+				stubDone(t->dev);
+			checkCounts(t, round);
+			for (UInt32 i = t->spaces > t->spacesSeen ? t->spaces - t->spacesSeen : 0; i; i--)
+				EventYield();
+			if (t->spacesSeen > t->spaces && !failed++)
+				print("FAIL: %s, round %u - %u space events, %u expected\n", t->dev->name, round, t->spacesSeen, t->spaces);
+			}
+
+	// everything left goes, and every space event is handled
+	for (byte n = 0; n < 2; n++)
+		while (queues[n].dev->out)
+			stubDone(queues[n].dev);
+	for (word i = 0; i < 1000; i++)
+		EventYield();
+	for (byte n = 0; n < 2; n++)
+		{
+		testQueue t = &queues[n];
+		checkCounts(t, kTxRounds);
+		if (t->spacesSeen != t->spaces || t->head != t->tail)
+			{
+			print("FAIL: %s - %u space events, %u expected; %u left queued\n", t->dev->name, t->spacesSeen,
+				t->spaces, t->head - t->tail);
+			failed++;
+			}
+		print("%s: %u queued, %u sent, %u dropped, %u refused, %u most queued, %u space events\n", t->dev->name,
+			t->accepted, t->q.sent, t->q.drops, t->q.errors, t->q.high, t->spacesSeen);
+		}
+	failed += radioDev.overlaps + udpDev.overlaps;
+
+	printf("<<%s %s\n", __func__, failed ? "FAILED" : "passed");
+	exit(failed ? -1 : 0);
+	}
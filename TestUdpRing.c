@@ -0,0 +1,191 @@
+/*
+ * File: TestUdpRing.c
+ *
+ * Contains: Test the batched UDP receive ring against a stub adapter
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright:	© 1989-2023 by Guy McIlroy
+ *  All rights reserved.
+ *
+ *  Use of this code is subject to the terms of the KoliadaESDK license.
+ *  https://docs.koliada.com/KoliadaESDKLicense.pdf
+ *
+ *  Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+#include "interface/udp.h"
+
+#include "udpRing.h"
+
+// This test runs on the host build (no adapter needed) - IUDP.Recv is replaced
+// by a stub adapter that holds whatever datagrams have 'arrived' and hands them
+// over, header first, as the wiznet does. Each round a random number arrive,
+// udpRecvBatch takes as many as the ring has room for, and a random number are
+// drained (by udpRingDrain, or by hand with udpRingPeek & udpRingRelease) and
+// checked, kRingRounds times - so head and tail wrap many times over. Every
+// datagram must come out once, in order, with its header and data; those
+// longer than their descriptor's buf (the bufs differ in size) cut short to
+// fit, and counted as truncated.
+
+#define kRingRounds		20000
+#define kRingCount		8		// descriptors
+#define kRingMaxData	100		// datagram data bytes (at most) - more than the biggest buf holds
+#define kRingMaxArrive	12		// datagrams arriving in a burst - more than the ring holds
+
+#ifndef USE_INTERFACES
+	#error This test replaces IUDP.Recv - build with USE_INTERFACES
+#endif
+
+static byte bufs[kRingCount][sizeof_udpHeader + 16 * kRingCount];
+static _udpDesc desc[kRingCount];
+static _udpRing ring;
+
+// the stub adapter - datagrams # taken..arrived-1 are waiting
+static struct
+	{
+	UInt32 arrived, taken;
+	} adapter;
+
+static UInt32 drained, truncated, seed = 0x3C6EF372, failed;
+
+static UInt32 random32()
+	{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+	}
+
+// datagram k - where from, how long, and its data
+#define dgIp(k)			((byte)((k) * 7))
+#define dgPort(k)		((wyde)(5000 + (k) % 11))
+#define dgLen(k)		((wyde)(((k) * 2654435761UL >> 13) % (kRingMaxData + 1)))
+#define dgByte(k, i)	((byte)((k) * 31 + (i)))
+
+// ... and the room for its data (it goes to descriptor k, modulo the count)
+#define dgRoom(k)		(desc[(k) % kRingCount].size - sizeof_udpHeader)
+
+static word stubRecv(void *udp, byte *buf, word size)
+	{
+	if (udp != &adapter || adapter.taken == adapter.arrived)
+		return (word)-1;
+	UInt32 k = adapter.taken++;
+
+	// the header (network order), then as much of the data as fits
+	udpHeader h = (udpHeader)buf;
+	h->ip[0] = 192;
+	h->ip[1] = 168;
+	h->ip[2] = 1;
+	h->ip[3] = dgIp(k);
+	h->port = Swap16(dgPort(k));
+	h->len = Swap16(dgLen(k));
+	word len = sizeof_udpHeader;
+	for (word i = 0; i < dgLen(k) && len < size; i++)
+		buf[len++] = dgByte(k, i);
+	return len;
+	}
+
+// the next datagram out, against what went in
+static void checkDatagram(udpHeader h, word len, void *context)
+	{
+	UInt32 k = drained++;
+	const char *what = *((const char **)context);
+	word room = dgRoom(k), want = dgLen(k) < room ? dgLen(k) : room, i;
+	for (i = 0; i < want && udpData(h)[i] == dgByte(k, i); i++)
+		;
+	if ((h->ip[3] != dgIp(k) || udpPort(h) != dgPort(k) || udpLen(h) != dgLen(k) || len != want || i != want) && !failed++)
+		print("FAIL: %s - datagram %u came out from .%u:%u, %u bytes (%u kept, %u good), not from .%u:%u, %u bytes (%u kept)\n",
+			what, k, h->ip[3], udpPort(h), udpLen(h), len, i, dgIp(k), dgPort(k), dgLen(k), want);
+	}
+
+void abortHandler(int sig)
+	{
+	// for this test, we simply exit
+	exit(-42);
+	}
+
+void TEST()
+	{
+	printf(">>%s\n", __func__);
+
+	// first, capture the SIGABRT signal
+	signal(SIGABRT, abortHandler);
+
+	IUDP.Recv = stubRecv;
+	UDP udp = (UDP)&adapter;
+	for (byte i = 0; i < kRingCount; i++)
+		{
+		desc[i].buf = bufs[i];
+		desc[i].size = sizeof_udpHeader + 16 * (i + 1);
+		}
+	udpRingInit(&ring, desc, kRingCount);
+	if (udpRingPeek(&ring) || udpRecvBatch(udp, &ring))
+		{
+		print("FAIL: a new ring isn't empty\n");
+		failed++;
+		}
+
+	UInt32 batches = 0, full = 0;
+	for (UInt32 round = 0; round < kRingRounds && !failed; round++)
+		{
+		// some arrive (now and then a burst), and the ring takes what it has room for
+		adapter.arrived += random32() % 8 ? random32() % 5 : kRingMaxArrive;
+		UInt32 waiting = adapter.arrived - adapter.taken, room = kRingCount - udpRingCount(&ring);
+		word n = udpRecvBatch(udp, &ring);
+		if (n != (waiting < room ? waiting : room) && !failed++)
+			print("FAIL: round %u - took %u of %u waiting, with room for %u\n", round, n, waiting, room);
+		for (UInt32 k = adapter.taken - n; k != adapter.taken; k++)
+			truncated += dgLen(k) > dgRoom(k);
+		batches += n != 0;
+		full += udpRingCount(&ring) == kRingCount;
+
+		// and some are drained (0 for all of them)
+		word max = (word)(random32() % (kRingCount + 1));
+		if (random32() & 1)
+			{
+			const char *what = "drained";
+			word held = udpRingCount(&ring), got = udpRingDrain(&ring, checkDatagram, &what, max);
+			if (got != (max && max < held ? max : held) && !failed++)
+				print("FAIL: round %u - drained %u of %u (at most %u)\n", round, got, held, max);
+			}
+		else
+			{
+			const char *what = "peeked";
+			udpDesc d;
+			for (word i = 0; (!max || i < max) && (d = udpRingPeek(&ring)) != NULL; i++)
+				{
+				checkDatagram((udpHeader)d->buf, d->len - sizeof_udpHeader, &what);
+				udpRingRelease(&ring);
+				}
+			}
+		if (ring.truncated != truncated && !failed++)
+			print("FAIL: round %u - %u truncated, %u were too long\n", round, ring.truncated, truncated);
+		}
+
+	// nothing left over, or lost
+	const char *what = "last";
+	UInt32 from = adapter.taken;
+	adapter.arrived += kRingCount / 2;
+	while (udpRecvBatch(udp, &ring))
+		udpRingDrain(&ring, checkDatagram, &what, 0);
+	if (udpRingPeek(&ring) || drained != adapter.arrived)
+		{
+		print("FAIL: %u of %u datagrams drained\n", drained, adapter.arrived);
+		failed++;
+		}
+	for (UInt32 k = from; k != adapter.taken; k++)
+		truncated += dgLen(k) > dgRoom(k);
+	if (ring.truncated != truncated)
+		{
+		print("FAIL: %u truncated, %u were too long\n", ring.truncated, truncated);
+		failed++;
+		}
+	print("%u datagrams in %u batches (ring full %u times), %u truncated\n", drained, batches, full, ring.truncated);
+
+	printf("<<%s %s\n", __func__, failed ? "FAILED" : "passed");
+	exit(failed ? -1 : 0);
+	}
@@ -20,6 +20,8 @@
 #include "Koliada.h"
 #include "interface/udp.h"
 
+#include "udpRing.h"
+
 // In this test we do basic input/output using the installed Ethernet adapter. There
 // are two build configs, one to build a sender (Tx) and one to build a receiver (Rx).
 // For a more complex example see: https://docs.koliada.com/kes/examples/TestUdp
@@ -37,9 +39,52 @@
 	DefineUdp(udp);
 #endif
 
-// local frame buffer
+// local frame buffers - a ring of them, so a burst is taken whole (see udpRing.c)
 #define kRxBufSize 128
-static byte rxBuf[kRxBufSize];
+#define kRxRing 4		// datagrams (power of 2)
+static byte rxBufs[kRxRing][kRxBufSize];
+static _udpDesc rxDesc[kRxRing];
+static _udpRing rxRing;
+
+#if USE_INTERFACES
+static UDP udp;
+#endif
+
+#define kRxPollMs 10	// how often to check for receipts
+
+// each datagram received, in turn
+static void rxDatagram(udpHeader h, word len, void *context)
+	{
+	// the buffer contains the following (see udpHeader)
+	// in_struct_addr IP;   // senders enpoint (ip) address (4 bytes)
+	// in_struct_port Port;	// senders endpoint port (2 bytes)
+	// UInt16 len;          // length of the user data (2 bytes)
+	//
+	// A total of 8 bytes which maybe enumerated as follows
+	debug("Header data\n");
+	debug("from %u.%u.%u.%u:%u\n", h->ip[0], h->ip[1], h->ip[2], h->ip[3], udpPort(h));
+	dump((byte *)h, sizeof_udpHeader, 1);
+
+	// and the user data may be enumerated as;
+	debug("User data\n");
+	debug("data size=%u\n", udpLen(h));
+	dump(udpData(h), len, 1);
+
+	// and/or, if we received a null terminated string, as;
+	print("%s", udpData(h));
+	}
+
+// only polling - wiznet device has it's own buffer
+// Rather than spin on IUDP.Recv, we check for receipts on a timer and otherwise
+// leave the mcu idle in WaitEvent.
+StaticTimer(rxPollTimer);
+static void rxPollHandler()
+	{
+	// running in application context, every kRxPollMs
+	// take everything that has arrived since the last poll, a ringful at a time
+	while (udpRecvBatch(udp, &rxRing))
+		udpRingDrain(&rxRing, rxDatagram, NULL, 0);
+	}
 
 void TEST()
 	{
@@ -48,7 +93,7 @@ void TEST()
 
 #if USE_INTERFACES
 	initDrivers();
-	UDP udp = IINTERFACE.Find("UDP");
+	udp = IINTERFACE.Find("UDP");
 #else
 	// create a UDP endpoint instance
 	objectCreate(udp);
@@ -60,46 +105,35 @@ void TEST()
 	print("Max frame size = %u\n", maxFrameSize);
 	assert(kRxBufSize <= maxFrameSize);
 
-	// only polling - wiznet device has it's own buffer
-	
 	// establish some inet configuration
 	// mac address is already set by the driver
 	IUDP.Iocntl(udp, kIpSetGatewayAddr, "192.168.1.1");
 	IUDP.Iocntl(udp, kIpSetSubnetMask, "255.255.255.0");
 	IUDP.Iocntl(udp, kIpSetLocalAddr, "192.168.1.42");
 
+	// the receive ring
+	for (byte i = 0; i < kRxRing; i++)
+		{
+		rxDesc[i].buf = rxBufs[i];
+		rxDesc[i].size = kRxBufSize;
+		}
+	udpRingInit(&rxRing, rxDesc, kRxRing);
+
 	// open UDP socket
 	IUDP.Open(udp);
 
 	// establish UDP socket endpoint configuration
 	IUDP.Iocntl(udp, kUdpSetSrcPort, 5001);
 
+	// start polling for receipts
+	objectCreate(rxPollTimer, kIntervalTimer, TICKS(kRxPollMs));
+	OnEvent(rxPollTimer, (HANDLER) rxPollHandler);
+	cmStartTimer(rxPollTimer, 0);
+
 	print("\nWaiting for receipts\n");
-	do
-		{
-		while (IUDP.Recv(udp, rxBuf, sizeof(rxBuf)) == (word)-1)
-			// make sure the event queue keeps running!
-			EventYield();
-
-		// rxBuf will contain the following
-		// in_struct_addr IP;   // senders enpoint (ip) address (4 bytes)
-		// in_struct_port Port;	// senders endpoint port (2 bytes)
-		// UInt16 len;          // length of the user data (2 bytes)
-		//
-		// A total of 8 bytes which maybe enumerated as follows
-		debug("Header data\n");
-		dump(rxBuf, 8, 1);
-
-		// and the user data may be enumerated as;
-		debug("User data\n");
-		word size = Swap16(*((wyde *)&rxBuf[6]));
-		debug("data size=%u\n", size);
-		dump(&rxBuf[8], size, 1);
-
-		// and/or, if we received a null terminated string, as;
-		print("%s", &rxBuf[8]);
-		}
-	while (1);
+
+	// wait for system events (including the poll timer defined above)
+	WaitEvent(0, 0);	// never returns!
 	
 	// When a KoliadaES program exits, control returns to the kernel and any exit
 	// delegates are run.
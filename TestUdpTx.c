@@ -19,6 +19,8 @@
 #include "Koliada.h"
 #include "interface/udp.h"
 
+#include "txQueue.h"
+
 // In this test we do basic input/output using the installed Ethernet adapter (if any).
 // There are two build configs, one to build a sender (Tx) and one to build a receiver
 // (Rx). For a more complex example see: https://docs.koliada.com/kes/examples/TestUdp
@@ -36,14 +38,14 @@
 	DefineUdp(udp);
 #endif
 
-StaticDelegate(txDoneDelegate);
-void txDoneHandler(byte *frame, word len)
-	{
-	// running in the interrupt handler!!
-	// called each time the a frame is sent
-	print("%p[%u]: done!\n", frame, len);
-	dump(frame, len, 1);
-	}
+// Each keypress queues a burst of kTxBurst datagrams, which the queue sends back
+// to back (see txQueue.c) - the txDone interrupt starts each as the last goes out.
+// The burst is queued without waiting, so with more in it than there are slots
+// the rest are dropped (and counted).
+#define kTxBurst 12
+#define kTxSlots 8		// (power of 2)
+
+static _txQueue txq;
 
  void TEST()
 	{
@@ -64,10 +66,15 @@ void txDoneHandler(byte *frame, word len)
 	print("Max frame size = %u\n", maxFrameSize);
 	assert(kTxBufSize <= maxFrameSize);
 
-	// set the txDone handler
-	// set up the txDone delegate (shows we're transmitting)
-	objectCreate(txDoneDelegate, delegateTask(txDoneHandler));
-	IUDP.Iocntl(udp, kUdpAddTxDone, txDoneDelegate);
+	// set up the tx queue (it adds its own txDone delegate)
+	static byte slotBufs[kTxSlots][kTxBufSize];
+	static _txSlot slots[kTxSlots];
+	for (byte n = 0; n < kTxSlots; n++)
+		{
+		slots[n].buf = slotBufs[n];
+		slots[n].size = kTxBufSize;
+		}
+	txQueueInit(&txq, udp, kTxQueueUdp, slots, kTxSlots);
 
 	// establish some inet configuration
 	// mac address is already set by the driver
@@ -107,8 +114,15 @@ void txDoneHandler(byte *frame, word len)
 		print("%s\n", buf);
 #endif
 
-		// raw udp send (no presentation layer protocols)
-		IUDP.Send(udp, (byte *)buf, i);
+		// raw udp sends (no presentation layer protocols), the burst numbered
+		// in the last byte
+		for (byte n = 0; n < kTxBurst; n++)
+			{
+			buf[kTxBufSize - 1] = n;
+			txQueueSend(&txq, (byte *)buf, i);
+			}
+		txQueueFlush(&txq);
+		print("sent %lu, high water %u, drops %u, errors %u\n", (unsigned long)txq.sent, txq.high, txq.drops, txq.errors);
 		} while (1);
 
 	IUDP.Close(udp);
@@ -0,0 +1,600 @@
+/*
+ *	File: dwSim.c
+ *
+ *	Contains: Simulated Decawave radio (host builds)
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#define __RADIO_CLASS_H	 // block current class/radio.h
+
+#include "Koliada.h"
+#include "interface/dw3000.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "ssRange.h"
+#include "dwSim.h"
+
+// A software DW3000 for running the ranging code on a host with no hardware.
+//
+// Each simulated node is a RADIO of class "DWSIM" that implements the DWIFACE
+// operations the ranging code uses (Send, RangeTo and the Iocntl calls), and like
+// the real driver, auto responds to ssRangeRequestMsg frames addressed to it (or
+// broadcast). All the nodes share one medium;
+//
+//    - every node has a position, and frames arrive after the time of flight
+//    - every node has its own crystal error (ppm) and clock phase, so device
+//      timestamps and the carrier integrator (clock offset) behave as they do
+//      between real nodes, including the 40-bit device time wrap
+//    - frames may be lost (per receiver) and rx timestamps carry gaussian noise
+//
+// Time is virtual; frames are delivered by an event, in time order, as fast as
+// the host can go - or, with realTime set, no faster than the host clock (so
+// schedules driven by mcu timers, e.g. ssTdma, see the time they expect). Antenna delays are taken to be perfectly calibrated (the
+// simulated timestamps are at the antenna) and collisions are not modelled.
+//
+// The medium runs in application context, so rxReady and txDone delegates are
+// called from there rather than from an interrupt handler.
+
+#define kSimNodes		16
+#define kSimDelegates	4
+#define kSimQueueSize	64
+#define kSimFrameSize	128
+
+#define kDwTicksPerSec	(499.2e6 * 128.0)	// 1 / DWT_TIME_UNITS
+#define kDwDelayedTxMask 0x1FFULL		// delayed tx resolution (low 9 bits ignored)
+#define kSimPreambleUs	180.0			// 128 symbol preamble + SFD + PHR at 6.8Mbps
+#define kSimByteUs		(8.0 / 6.8)
+
+typedef struct
+	{
+	_Dw3000 dw;				// (must be first - the ranging code uses ((Dw3000)radio)->addr)
+	byte channel;
+	byte rxOn;
+	byte autoRespond;
+	dwTime mask;			// timestamps as the node has them (see dwSimNarrow)
+	double ppm;				// crystal error
+	UInt64 phase;			// device time at virtual time 0
+	double x, y, z;
+	wyde txAntDly, rxAntDly;
+	wyde pan;				// dwSetPanId
+	wyde filterAddr;		// dwSetAddress16
+	byte filter;			// dwEnableFrameFilter (DWT_FF_XXX, 0 if off)
+	UInt64 txFree;			// virtual time the transmitter is next free
+	UInt64 txAt;			// dwSetDelayedTx - virtual time the next frame goes (0 for at once)
+	byte txLate;			// ... for a time already gone - the next frame fails
+	UInt64 txTs, rxTs;		// last tx & rx timestamps (device time)
+	float cor;				// carrier integrator for the last rx (Q26)
+	byte *rxBuf;			// kRadioSetRxBuffer (or buf)
+	word rxBufSize;
+	byte buf[kSimFrameSize];
+	DELEGATE rxReady[kSimDelegates];
+	DELEGATE txDone[kSimDelegates];
+	byte rxReadyCount, txDoneCount;
+	_dwSimStats stats;
+	} _DwSim, *DwSim;
+
+// pending deliveries, kept as a heap ordered by (at, serial)
+enum { kSimTxDone, kSimRx };
+typedef struct
+	{
+	UInt64 at;				// virtual time the item is due
+	UInt64 marker;			// virtual time of the frame's RMARKER (at the antenna)
+	UInt32 serial;			// keeps items due at the same time in order
+	byte what;				// kSimXxx
+	byte node, from;
+	byte len;
+	byte frame[kSimFrameSize];
+	} _simItem, *simItem;
+
+static _DwSim simNodes[kSimNodes];
+static byte simNodeCount;
+
+static _simItem simQueue[kSimQueueSize];
+static word simQueued;
+static UInt32 simSerial;
+
+static byte simPosted;		// simEvent is pending
+static UInt64 simNow;		// virtual time (device time units)
+static _dwSimConfig simConfig;
+static UInt32 simRandom;
+static double simStart;		// host clock at dwSimInit (realTime)
+
+////////////////////////////////////////////////////////////////////////////////
+// helpers
+
+static double simUniform()
+	{
+	// xorshift32 - repeatable for a given seed
+	simRandom ^= simRandom << 13;
+	simRandom ^= simRandom >> 17;
+	simRandom ^= simRandom << 5;
+	return (simRandom >> 8) / (double)(1 << 24);
+	}
+
+static double simGaussian()
+	{
+	double u = simUniform();
+	return sqrt(-2.0 * log(u > 0.0 ? u : 1e-12)) * cos(2.0 * 3.14159265358979 * simUniform());
+	}
+
+static double simHost()
+	{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+	}
+
+// virtual time now (realTime - brought up to the host clock)
+static UInt64 simClock()
+	{
+	if (simConfig.realTime)
+		{
+		UInt64 host = (UInt64)((simHost() - simStart) * kDwTicksPerSec);
+		if (host > simNow)
+			simNow = host;
+		}
+	return simNow;
+	}
+
+// device time (unwrapped) of node at virtual time t
+static UInt64 simLocal(DwSim node, UInt64 t)
+	{
+	return node->phase + t + (Int64)(t * node->ppm * 1e-6);
+	}
+
+// virtual time at which the node's (unwrapped) device time reaches local
+static UInt64 simGlobal(DwSim node, UInt64 local)
+	{
+	return (UInt64)((local - node->phase) / (1.0 + node->ppm * 1e-6));
+	}
+
+static UInt64 simFlight(DwSim a, DwSim b)
+	{
+	double dx = a->x - b->x, dy = a->y - b->y, dz = a->z - b->z;
+	return (UInt64)(sqrt(dx * dx + dy * dy + dz * dz) / SPEED_OF_LIGHT * kDwTicksPerSec + 0.5);
+	}
+
+static UInt64 simAirtime(word len)
+	{
+	return (UInt64)((kSimPreambleUs + len * kSimByteUs) * 1e-6 * kDwTicksPerSec);
+	}
+
+////////////////////////////////////////////////////////////////////////////////
+// the medium
+
+static void simDeliver(simItem item);
+
+StaticEvent(simEvent);
+static void simEventHandler(EVENT e, byte *buf, word len)
+	{
+	// running in application context
+	// deliver everything that is due, in time order (including anything the
+	// deliveries themselves schedule) - but yield now and then so a pair of nodes
+	// endlessly answering each other cannot starve the application
+	simPosted = 0;
+	for (word n = 0; simQueued && n < 256; n++)
+		{
+		// (realTime - not before it's due)
+		if (simConfig.realTime && simQueue[0].at > simClock())
+			break;
+
+		// pop the earliest
+		_simItem item = simQueue[0];
+		simItem last = &simQueue[--simQueued];
+		word i = 0, child;
+		while ((child = 2 * i + 1) < simQueued)
+			{
+			if (child + 1 < simQueued &&
+					(simQueue[child + 1].at < simQueue[child].at ||
+					(simQueue[child + 1].at == simQueue[child].at && simQueue[child + 1].serial < simQueue[child].serial)))
+				child++;
+			if (last->at < simQueue[child].at || (last->at == simQueue[child].at && last->serial < simQueue[child].serial))
+				break;
+			simQueue[i] = simQueue[child];
+			i = child;
+			}
+		simQueue[i] = *last;
+
+		if (item.at > simNow)
+			simNow = item.at;
+		simDeliver(&item);
+		}
+
+	if (simQueued && !simPosted++)
+		PostEvent(simEvent, NULL, 0);
+	}
+
+static simItem simSchedule(UInt64 at)
+	{
+	if (simQueued == kSimQueueSize)
+		{
+		debug("dwSim: queue full - frame dropped\n");
+		return NULL;
+		}
+
+	// push - sift up from the end
+	word i = simQueued++;
+	UInt32 serial = simSerial++;
+	while (i)
+		{
+		word parent = (i - 1) / 2;
+		if (simQueue[parent].at < at || (simQueue[parent].at == at && simQueue[parent].serial < serial))
+			break;
+		simQueue[i] = simQueue[parent];
+		i = parent;
+		}
+	simItem item = &simQueue[i];
+	item->at = at;
+	item->serial = serial;
+
+	if (!simPosted++)
+		PostEvent(simEvent, NULL, 0);
+	return item;
+	}
+
+// put a frame on the air from node with its RMARKER at virtual time marker
+static void simTransmit(DwSim node, UInt64 marker, byte *frame, word len)
+	{
+	if (len > kSimFrameSize)
+		len = kSimFrameSize;
+	UInt64 air = simAirtime(len);
+	byte index = node - simNodes;
+	simItem item;
+
+	node->stats.sent++;
+	node->txFree = marker + air;
+
+	// tx done (the tx timestamp becomes readable)
+	if ((item = simSchedule(marker + air)))
+		{
+		item->what = kSimTxDone;
+		item->marker = marker;
+		item->node = item->from = index;
+		item->len = len;
+		memcpy(item->frame, frame, len);
+		}
+
+	// arrival at every other node on the channel
+	wyde dst = *((wyde *)&frame[MSG_DST_IDX]);
+	for (byte i = 0; i < simNodeCount; i++)
+		{
+		DwSim to = &simNodes[i];
+		if (to == node || to->channel != node->channel)
+			continue;
+		if (simUniform() < simConfig.lossRate)
+			{
+			if (dst == to->dw.addr || dst == BCAST_ADDR)
+				to->stats.lost++;
+			continue;
+			}
+		UInt64 flight = simFlight(node, to);
+		if ((item = simSchedule(marker + flight + air)))
+			{
+			item->what = kSimRx;
+			item->marker = marker + flight;
+			item->node = i;
+			item->from = index;
+			item->len = len;
+			memcpy(item->frame, frame, len);
+			}
+		}
+	}
+
+// as the driver does, answer a ssRangeRequestMsg after the turnaround time
+static void simAutoRespond(DwSim node, byte *poll, word len)
+	{
+	byte resp[sizeof_ssRangeResponsMsg] = {0x41, 0x88, 0, 0xCA, 0xDE, 0, 0, 0, 0, 0xE1};
+	resp[MSG_SEQ_IDX] = poll[MSG_SEQ_IDX];
+	*((wyde *)&resp[MSG_DST_IDX]) = *((wyde *)&poll[MSG_SRC_IDX]);
+	*((wyde *)&resp[MSG_SRC_IDX]) = node->dw.addr;
+
+	// delayed tx - the response carries its own (future) tx timestamp
+	// a collection poll (see ssRangeStartAll) has us reply in our own slot
+	double replyUs = simConfig.replyUs;
+	if (len == sizeof_ssRangeCollectMsg && poll[POLL_MSG_SLOTS_IDX])
+		replyUs = kCollectReplyUs +
+			ssReplySlot(node->dw.addr, poll[POLL_MSG_SLOTS_IDX]) * poll[POLL_MSG_SLOT_WIDTH_IDX] * kCollectSlotUnitUs;
+	UInt64 txLocal = (node->rxTs + (UInt64)(replyUs * 1e-6 * kDwTicksPerSec)) & ~kDwDelayedTxMask;
+	dwTime pollRx = node->rxTs & node->mask, respTx = txLocal & node->mask;
+	dwTimePut(&resp[RESP_MSG_POLL_RX_TS_IDX], pollRx);
+	dwTimePut(&resp[RESP_MSG_RESP_TX_TS_IDX], respTx);
+
+	simTransmit(node, simGlobal(node, txLocal), resp, sizeof(resp));
+	}
+
+// as the radio's frame filter does (data frames only), returns true if the frame is dropped
+static byte simFiltered(DwSim node, byte *frame, word len)
+	{
+	if (len < sizeof_ssRangeRequestMsg)
+		return 1;
+	wyde fc = frame[0] | frame[1] << 8;
+	wyde pan = *((wyde *)&frame[MSG_PAN_IDX]);
+	wyde dst = *((wyde *)&frame[MSG_DST_IDX]);
+	return
+		(fc & 0x0007) != 0x0001 ||			// frame type - data
+		(fc & 0x0C00) != 0x0800 ||			// destination - short addr
+		!(node->filter & DWT_FF_DATA_EN) ||
+		(pan != node->pan && pan != 0xFFFF) ||
+		(dst != node->filterAddr && dst != BCAST_ADDR);
+	}
+
+static void simDeliver(simItem item)
+	{
+	DwSim node = &simNodes[item->node];
+	byte i;
+
+	if (item->what == kSimTxDone)
+		{
+		node->txTs = simLocal(node, item->marker);
+		for (i = 0; i < node->txDoneCount; i++)
+			RunDelegate(node->txDone[i], item->frame, (word)item->len);
+		return;
+		}
+
+	// kSimRx
+	wyde dst = *((wyde *)&item->frame[MSG_DST_IDX]);
+	if (!node->rxOn)
+		{
+		if (dst == node->dw.addr || dst == BCAST_ADDR)
+			node->stats.lost++;
+		return;
+		}
+	if (node->filter && simFiltered(node, item->frame, item->len))
+		{
+		node->stats.filtered++;
+		return;
+		}
+	node->stats.received++;
+
+	// timestamp (with noise) and carrier integrator reading
+	DwSim from = &simNodes[item->from];
+	double noise = simGaussian() * simConfig.noiseM / SPEED_OF_LIGHT * kDwTicksPerSec;
+	node->rxTs = simLocal(node, item->marker) + (Int64)noise;
+	node->cor = (float)floor(((1.0 + from->ppm * 1e-6) / (1.0 + node->ppm * 1e-6) - 1.0) * ((teta)1 << 26) + 0.5);
+
+	// hand the frame to the rxReady delegates
+	byte *buf = node->rxBuf ? node->rxBuf : node->buf;
+	word size = node->rxBuf ? node->rxBufSize : sizeof(node->buf);
+	word len = item->len < size ? item->len : size;
+	memcpy(buf, item->frame, len);
+	for (i = 0; i < node->rxReadyCount; i++)
+		RunDelegate(node->rxReady[i], buf, len);
+
+	if (node->autoRespond && item->frame[MSG_FUNC_IDX] == 0xE0 &&
+			(item->len == sizeof_ssRangeRequestMsg || item->len == sizeof_ssRangeCollectMsg) &&
+			(dst == node->dw.addr || dst == BCAST_ADDR))
+		simAutoRespond(node, item->frame, item->len);
+	}
+
+////////////////////////////////////////////////////////////////////////////////
+// DWIFACE
+
+static int simSend(RADIO radio, byte *frame, word len)
+	{
+	DwSim node = (DwSim)radio;
+	UInt64 now = simClock();
+	UInt64 at = node->txFree > now ? node->txFree : now;
+	if (node->txLate)
+		{
+		node->txLate = 0;
+		return -1;
+		}
+	if (node->txAt > at)
+		at = node->txAt;
+	node->txAt = 0;
+	simTransmit(node, at, frame, len);
+	return len;
+	}
+
+static int simRangeTo(RADIO radio, byte *frame, word len)
+	{
+	// send the poll, with the receiver enabled to catch the response
+	((DwSim)radio)->rxOn = 1;
+	return simSend(radio, frame, len);
+	}
+
+static int simIocntl(RADIO radio, int op, ...)
+	{
+	DwSim node = (DwSim)radio;
+	int result = 0;
+	va_list args;
+	va_start(args, op);
+	switch (op)
+		{
+		case kRadioAddRxReady:
+			if (node->rxReadyCount == kSimDelegates)
+				result = -1;
+			else
+				node->rxReady[node->rxReadyCount++] = va_arg(args, DELEGATE);
+			break;
+		case kRadioAddTxDone:
+			if (node->txDoneCount == kSimDelegates)
+				result = -1;
+			else
+				node->txDone[node->txDoneCount++] = va_arg(args, DELEGATE);
+			break;
+		case kRadioSetAddr:
+			node->dw.addr = (wyde)va_arg(args, int);
+			break;
+		case kRadioSetChannel:
+			node->channel = (byte)va_arg(args, int);
+			break;
+		case kRadioSetRxBuffer:
+			node->rxBuf = va_arg(args, byte *);
+			node->rxBufSize = (word)va_arg(args, int);
+			break;
+		case kRadioEnableRx:
+			node->rxOn = 1;
+			break;
+		case kRadioFrameSize:
+			result = 127;
+			break;
+
+		case dwSetTxRfConfig:
+			break;
+		case dwSetRxAntennaDelay:
+			node->rxAntDly = (wyde)va_arg(args, int);
+			break;
+		case dwSetTxAntennaDelay:
+			node->txAntDly = (wyde)va_arg(args, int);
+			break;
+		case dwSetPanId:
+			node->pan = (wyde)va_arg(args, int);
+			break;
+		case dwSetAddress16:
+			node->filterAddr = (wyde)va_arg(args, int);
+			break;
+		case dwEnableFrameFilter:
+			node->filter = (byte)va_arg(args, int);
+			break;
+		case dwDisableFrameFilter:
+			node->filter = 0;
+			break;
+		case dwGetTxTimestamp:
+			*va_arg(args, UInt32 *) = (UInt32)node->txTs;
+			break;
+		case dwGetRxTimestamp:
+			*va_arg(args, UInt32 *) = (UInt32)node->rxTs;
+			break;
+		case dwGetTxTime:
+			*va_arg(args, dwTime *) = node->txTs & node->mask;
+			break;
+		case dwGetRxTime:
+			*va_arg(args, dwTime *) = node->rxTs & node->mask;
+			break;
+		case dwSetDelayedTx:
+			{
+			// (a time already past fails the send, as the driver's late check does,
+			// rather than wait out the wrap)
+			UInt64 local = simLocal(node, simClock());
+			UInt64 ahead = ((*va_arg(args, dwTime *) & ~kDwDelayedTxMask) - local) & node->mask;
+			node->txLate = ahead >= (node->mask >> 1);
+			node->txAt = node->txLate ? 0 : simGlobal(node, local + ahead);
+			}
+			break;
+		case dwGetSysTime:
+			*va_arg(args, dwTime *) = simLocal(node, simClock()) & node->mask;
+			break;
+		case dwGetClockOffset:
+			*va_arg(args, float *) = node->cor;
+			break;
+		case dwGetRangeInfo:
+			{
+			dwRangeInfo info = va_arg(args, dwRangeInfo);
+			info->rxTs = node->rxTs & node->mask;
+			info->txTs = node->txTs & node->mask;
+			info->cor = (Int32)node->cor;
+			}
+			break;
+
+		default:
+			// not simulated
+			result = -1;
+			break;
+		}
+	va_end(args);
+	return result;
+	}
+
+static DWIFACE dwSimJumps =
+	{
+	.Iocntl = simIocntl,
+	.Send = simSend,
+	.RangeTo = simRangeTo,
+	};
+
+static _Class dwSimClass =
+	{
+	.Name = "DWSIM",
+	.jumps = &dwSimJumps,
+	};
+
+////////////////////////////////////////////////////////////////////////////////
+// api
+
+void dwSimInit(dwSimConfig config)
+	{
+	simConfig = *config;
+	simRandom = config->seed ? config->seed : 1;
+	simNodeCount = 0;
+	simQueued = 0;
+	simPosted = 0;
+	simNow = 0;
+	simStart = simHost();
+
+	objectCreate(simEvent);
+	OnEvent(simEvent, (HANDLER) simEventHandler);
+	}
+
+// create a node, listening (and auto responding) on channel 5
+// the addr may be changed later via kRadioSetAddr (ssInit does this)
+RADIO dwSimCreate(wyde addr, double ppm, double x, double y, double z)
+	{
+	if (simNodeCount == kSimNodes)
+		sys.Fatal("dwSimCreate", __LINE__, "too many simulated nodes!");
+
+	DwSim node = &simNodes[simNodeCount++];
+	memset(node, 0, sizeof(_DwSim));
+	((Object)node)->type = &dwSimClass;
+	node->dw.addr = addr;
+	node->channel = 5;
+	node->rxOn =
+	node->autoRespond = 1;
+	node->mask = kDwTimeMask;
+	node->ppm = ppm;
+	node->phase = (UInt64)(simUniform() * kDwTimeMask);
+	node->x = x;
+	node->y = y;
+	node->z = z;
+	return (RADIO)node;
+	}
+
+void dwSimMove(RADIO radio, double x, double y, double z)
+	{
+	DwSim node = (DwSim)radio;
+	node->x = x;
+	node->y = y;
+	node->z = z;
+	}
+
+void dwSimAutoRespond(RADIO radio, byte enable)
+	{
+	((DwSim)radio)->autoRespond = enable;
+	}
+
+// keep only the low 32 bits of the node's timestamps, as a 32 bit (CC8051) node
+// does - its responses & reports carry a zero high byte (see dwTime.h)
+void dwSimNarrow(RADIO radio, byte enable)
+	{
+	((DwSim)radio)->mask = enable ? 0xFFFFFFFFUL : kDwTimeMask;
+	}
+
+double dwSimRange(RADIO a, RADIO b)
+	{
+	return simFlight((DwSim)a, (DwSim)b) / kDwTicksPerSec * SPEED_OF_LIGHT;
+	}
+
+double dwSimTime()
+	{
+	return simNow / kDwTicksPerSec;
+	}
+
+dwSimStats dwSimGetStats(RADIO radio)
+	{
+	return &((DwSim)radio)->stats;
+	}
@@ -0,0 +1,54 @@
+/*
+ *	File: dwSim.h
+ *
+ *	Contains: Simulated Decawave radio (host builds)
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __DWSIM_H
+#define __DWSIM_H
+
+#include "interface/dw3000.h"
+
+// medium wide settings
+typedef struct
+	{
+	double lossRate;	// probability of any given frame being lost at any given receiver
+	double noiseM;		// rx timestamp noise (standard deviation, in metres of range)
+	double replyUs;		// auto response turnaround (poll rx to response tx)
+	UInt32 seed;		// random seed (a given seed always gives the same run)
+	byte realTime;		// keep virtual time to the host clock (rather than as fast as possible)
+	} _dwSimConfig, *dwSimConfig;
+
+// per node counters
+typedef struct
+	{
+	UInt32 sent;		// frames transmitted
+	UInt32 received;	// frames delivered to the node
+	UInt32 lost;		// frames addressed to the node (or broadcast) that never arrived
+	UInt32 filtered;	// frames the frame filter kept from the host
+	} _dwSimStats, *dwSimStats;
+
+void dwSimInit(dwSimConfig config);
+RADIO dwSimCreate(wyde addr, double ppm, double x, double y, double z);
+void dwSimMove(RADIO radio, double x, double y, double z);
+void dwSimAutoRespond(RADIO radio, byte enable);
+void dwSimNarrow(RADIO radio, byte enable);		// 32 bit timestamps (as a CC8051 node)
+
+double dwSimRange(RADIO a, RADIO b);	// true distance (m)
+double dwSimTime();						// virtual time elapsed (s)
+dwSimStats dwSimGetStats(RADIO radio);
+
+#endif
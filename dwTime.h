@@ -0,0 +1,65 @@
+/*
+ *	File: dwTime.h
+ *
+ *	Contains: DW device time (40 bit timestamp) definitions
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __DWTIME_H
+#define __DWTIME_H
+
+#include "Koliada.h"
+
+// DW timestamps count 15.65ps units in 40 bits, so the device time wraps every
+// ~17.2s. Kept whole, any two timestamps less than that apart give the right
+// delta; cut to 32 bits (as they once were) they wrap every ~67ms, and a reply
+// held any longer than that corrupts the range.
+//
+// Deltas are taken modulo 2^40 (dwTimeDelta), so the wrap itself is harmless.
+//
+// The 8051 has no 64 bit integers, so there a dwTime is still the low 32 bits
+// (and the 67ms limit stands). Frames always carry all 5 bytes - a 32 bit node
+// sends a zero high byte, which is what tells its timestamps apart; a delta
+// between two of them is only good modulo 2^32 (0x100 - 0xFFFFFF00 is 0x200,
+// not ~17s), so deltas between a peer's timestamps are taken with
+// dwTimePeerDelta, which takes them modulo 2^32 when both high bytes are zero.
+// A 40 bit peer's pair only reads that way if both fall in the same 67ms of its
+// 17.2s wrap and they are more than 17.1s apart, far beyond any reply or
+// timeout.
+
+#ifdef CC8051
+typedef UInt32 dwTime;
+#define kDwTimeMask		0xFFFFFFFFUL
+#define dwTimeHi(t)		0
+#else
+typedef UInt64 dwTime;
+#define kDwTimeMask		0xFFFFFFFFFFULL
+#define dwTimeHi(t)		((byte)((t) >> 32))		// bits 32..39
+#endif
+
+#define kDwTimeLen		5	// bytes in a frame (little endian, as the frames are)
+
+// later - earlier, wrap safe
+#define dwTimeDelta(later, earlier)	((dwTime)((later) - (earlier)) & kDwTimeMask)
+
+// later - earlier, both from a peer (ie. out of a frame), which may be a 32 bit node
+#define dwTimePeerDelta(later, earlier)	(dwTimeHi(later) | dwTimeHi(earlier) ? \
+	dwTimeDelta(later, earlier) : (dwTime)(UInt32)((later) - (earlier)))
+
+// to & from frame fields (as the other frame fields, these assume a little endian mcu)
+#define dwTimeGet(t, field)	((t) = 0, memcpy(&(t), (field), sizeof(dwTime) < kDwTimeLen ? sizeof(dwTime) : kDwTimeLen))
+#define dwTimePut(field, t)	(memset((field), 0, kDwTimeLen), memcpy((field), &(t), sizeof(dwTime) < kDwTimeLen ? sizeof(dwTime) : kDwTimeLen))
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ *	File: frameRing.c
+ *
+ *	Contains: Interrupt to application frame ring
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "frameRing.h"
+
+// NOTE
+// head and tail are free running (they wrap at 256) so the ring is empty when
+// they are equal and full when they are kFrameRingSize apart - no slot is lost
+// to telling the two apart.
+//
+// The producer fills a record _before_ publishing it by advancing head, and the
+// consumer is done with a record _before_ handing it back by advancing tail. The
+// barrier stops the compiler moving record accesses across the index update.
+// That is all a single core needs; an interrupt either sees the old index or the
+// new one.
+
+#if defined(__GNUC__)
+	#define ringBarrier() __asm__ __volatile__("" ::: "memory")
+#else
+	#define ringBarrier()
+#endif
+
+#define ringIndex(i) ((i) & (kFrameRingSize - 1))
+
+void frameRingInit(frameRing ring)
+	{
+	ring->head =
+	ring->tail = 0;
+	ring->drops = 0;
+	}
+
+// returns the next free record to fill, or NULL (counting a drop) if the ring is full
+// the record is not visible to the consumer until frameRingCommit
+frameRecord frameRingReserve(frameRing ring)
+	{
+	byte head = ring->head;
+	if ((byte)(head - ring->tail) == kFrameRingSize)
+		{
+		ring->drops++;
+		return NULL;
+		}
+	return &ring->rec[ringIndex(head)];
+	}
+
+// publishes the reserved record
+// returns true if the ring was empty (ie. the consumer may need waking)
+byte frameRingCommit(frameRing ring)
+	{
+	byte head = ring->head;
+	ringBarrier();
+	ring->head = head + 1;
+	return head == ring->tail;
+	}
+
+// returns the oldest record, or NULL if the ring is empty
+frameRecord frameRingPeek(frameRing ring)
+	{
+	byte tail = ring->tail;
+	if (tail == ring->head)
+		return NULL;
+	ringBarrier();
+	return &ring->rec[ringIndex(tail)];
+	}
+
+// hands the record returned by frameRingPeek back to the producer
+void frameRingRelease(frameRing ring)
+	{
+	ringBarrier();
+	ring->tail++;
+	}
+
+// passes up to max records (0 for all) to handler, oldest first
+// returns the # of records drained
+word frameRingDrain(frameRing ring, FRAMEHANDLER handler, void *context, word max)
+	{
+	word n = 0;
+	frameRecord rec;
+	while ((!max || n < max) && (rec = frameRingPeek(ring)))
+		{
+		handler(rec, context);
+		frameRingRelease(ring);
+		n++;
+		}
+	return n;
+	}
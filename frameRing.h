@@ -0,0 +1,73 @@
+/*
+ *	File: frameRing.h
+ *
+ *	Contains: Interrupt to application frame ring
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __FRAMERING_H
+#define __FRAMERING_H
+
+#include "Koliada.h"
+#include "dwTime.h"
+
+// A single producer (the rxReady interrupt handler) / single consumer (the
+// application) ring of fixed size frame records. Neither side ever blocks or
+// masks interrupts; each side only writes its own index.
+
+// sizes are build wide (override in the board config, not per module)
+#ifndef kFrameRingSize
+#define kFrameRingSize 8	// records (power of 2, <= 128)
+#endif
+#ifndef kFrameDataSize
+#define kFrameDataSize 32	// frame bytes kept per record (longer frames are truncated)
+#endif
+
+typedef struct
+	{
+	byte len;		// # of bytes in data
+	byte rssi;		// as reported by the radio (0 if not available)
+	byte corr;
+	dwTime txTs;	// tx timestamp related to the frame (e.g. the poll it answers)
+	dwTime rxTs;	// rx timestamp
+	Int32 cor;		// clock offset ratio in Q26 (ie. as read from the carrier integrator)
+	byte data[kFrameDataSize];
+	} _frameRecord, *frameRecord;
+
+typedef struct
+	{
+	volatile byte head;	// next record to fill - written by the producer only
+	volatile byte tail;	// next record to drain - written by the consumer only
+	volatile word drops;// records lost to a full ring - written by the producer only
+	_frameRecord rec[kFrameRingSize];
+	} _frameRing, *frameRing;
+
+// called for each record drained (see frameRingDrain)
+typedef void (*FRAMEHANDLER)(frameRecord rec, void *context);
+
+void frameRingInit(frameRing ring);
+
+// producer (interrupt handler)
+frameRecord frameRingReserve(frameRing ring);
+byte frameRingCommit(frameRing ring);
+
+// consumer (application)
+frameRecord frameRingPeek(frameRing ring);
+void frameRingRelease(frameRing ring);
+word frameRingDrain(frameRing ring, FRAMEHANDLER handler, void *context, word max);
+
+#define frameRingCount(ring)	((byte)((ring)->head - (ring)->tail))
+
+#endif
@@ -0,0 +1,262 @@
+/*
+ *	File: ssDsRangee.c
+ *
+ *	Contains: Decawave DW3000 double sided ranging responder
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under license from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#define __RADIO_CLASS_H	 // block current class/radio.h
+
+#include "Koliada.h"
+#include "interface/dw3000.h"
+
+#include "ssRange.h"
+#include "frameRing.h"
+#include "ssFrame.h"
+
+// NOTE
+// The driver answers SS polls (E0) itself, at a fixed delay, but knows nothing of
+// the DS frames (see ssInit.c) - they are answered here. Unlike the SS response,
+// nothing here is time critical;
+//
+//		poll (E2)  - the interrupt handler notes its arrival (T2) and queues it,
+//		             and the application sends the response (E3) when it runs
+//		response   - its departure (T3) is captured in txDoneHandler
+//		final (E4) - the interrupt handler notes its arrival (T6) and queues it,
+//		             and the application sends the report (E5) with T2, T3 & T6
+//
+// so a busy rangee may take as long as it likes (up to the ranger's timeout) to
+// answer, and may batch its answers, without costing any accuracy.
+
+#ifndef kMaxDsRangees
+#define kMaxDsRangees 2		// radios answering DS polls (see ssDsRangeeInit)
+#endif
+#if kMaxDsRangees > 2
+#error add rxReady/txDone entry points for the extra rangees (see rangeeTasks)
+#endif
+#define kDsExchanges 4		// exchanges in progress at once, per radio
+
+// an exchange, from poll to report
+typedef struct
+	{
+	wyde ranger;			// 0 if unused
+	byte seq;
+	volatile byte sent;		// the response is away (t3 is valid)
+	dwTime t2;				// poll rx
+	volatile dwTime t3;		// response tx
+	} _dsExchange, *dsExchange;
+
+typedef struct
+	{
+	RADIO radio;			// (NULL if this rangee is free)
+	byte index;				// in rangees[]
+	byte next;				// exchange to reuse when all are busy
+	_dsExchange exchanges[kDsExchanges];
+	_frameRing ring;		// polls & finals, with their rx timestamps
+	EVENT event;
+	DELEGATE rxReady, txDone;
+	_ssFrameTable frames;
+	} _ssDsRangee, *ssDsRangee;
+
+static _ssDsRangee rangees[kMaxDsRangees];
+
+static ssDsRangee rangeeOf(RADIO radio)
+	{
+	ssDsRangee r = rangees;
+	for (byte i = 0; i < kMaxDsRangees; i++, r++)
+		if (r->radio == radio)
+			return r;
+	return NULL;
+	}
+
+static dsExchange exchangeOf(ssDsRangee r, wyde ranger, byte seq)
+	{
+	dsExchange x = r->exchanges;
+	for (byte i = 0; i < kDsExchanges; i++, x++)
+		if (x->ranger == ranger && x->seq == seq)
+			return x;
+	return NULL;
+	}
+
+// a reply to frame (addressed back to its sender)
+static void dsReply(ssDsRangee r, byte *frame, byte func, byte *reply)
+	{
+	memcpy(reply, ssRangeRequestMsg, sizeof_ssRangeRequestMsg);
+	reply[MSG_SEQ_IDX] = frame[MSG_SEQ_IDX];
+	*((wyde *)&reply[MSG_DST_IDX]) = *((wyde *)&frame[MSG_SRC_IDX]);
+	*((wyde *)&reply[MSG_SRC_IDX]) = ((Dw3000)r->radio)->addr;
+	reply[MSG_FUNC_IDX] = func;
+	}
+
+static void dsAnswer(frameRecord rec, ssDsRangee r)
+	{
+	// running in application context
+	byte *buf = rec->data;
+	wyde ranger = *((wyde *)&buf[MSG_SRC_IDX]);
+	byte seq = buf[MSG_SEQ_IDX];
+	DWIFACE IDECA = *((DWIFACE *)typeof(r->radio)->jumps);
+	dsExchange x = exchangeOf(r, ranger, seq);
+
+	if (buf[MSG_FUNC_IDX] == FUNC_DS_POLL)
+		{
+		// a new exchange (or a resent poll restarting one) - the oldest goes if all are busy
+		if (!x && !(x = exchangeOf(r, 0, 0)))
+			x = &r->exchanges[r->next++ % kDsExchanges];
+		x->ranger = ranger;
+		x->seq = seq;
+		x->sent = 0;
+		x->t2 = rec->rxTs;
+
+		// (the ranger's final follows, so listen for it)
+		byte resp[sizeof_ssRangeRequestMsg];
+		dsReply(r, buf, FUNC_DS_RESPONSE, resp);
+		IDECA.RangeTo(r->radio, resp, sizeof_ssRangeRequestMsg);
+		return;
+		}
+
+	// the final - report our timestamps (unless the poll has been forgotten)
+	if (!x || !x->sent)
+		return;
+	byte report[sizeof_ssDsReportMsg];
+	dwTime t3 = x->t3;
+	dsReply(r, buf, FUNC_DS_REPORT, report);
+	dwTimePut(&report[REPORT_MSG_POLL_RX_TS_IDX], x->t2);
+	dwTimePut(&report[REPORT_MSG_RESP_TX_TS_IDX], t3);
+	dwTimePut(&report[REPORT_MSG_FINAL_RX_TS_IDX], rec->rxTs);
+	x->ranger = 0;
+	x->seq = 0;
+	IDECA.Send(r->radio, report, sizeof_ssDsReportMsg);
+	}
+
+static void dsEventHandler(EVENT e, ssDsRangee r, word len)
+	{
+	// running in application context
+	// (posted with the rangee as buf, see dsRx)
+	frameRingDrain(&r->ring, (FRAMEHANDLER) dsAnswer, r, 0);
+	}
+
+// DS poll (E2) or final (E4) from a 'ranger'
+static void dsRx(byte *buf, word len, ssDsRangee r)
+	{
+	// running in the interrupt handler!! (from rxReadyHandler)
+	if (len != sizeof_ssRangeRequestMsg)
+		return;
+
+	frameRecord rec = frameRingReserve(&r->ring);
+	if (!rec)
+		// the application is behind - dropped (counted in ring.drops)
+		return;
+
+	// the arrival time is all we need from the radio
+	DWIFACE IDECA = *((DWIFACE *)typeof(r->radio)->jumps);
+	IDECA.Iocntl(r->radio, dwGetRxTime, &rec->rxTs);
+	rec->txTs = 0;
+	rec->cor = 0;
+	rec->rssi =
+	rec->corr = 0;
+	rec->len = len;
+	memcpy(rec->data, buf, len);
+
+	if (frameRingCommit(&r->ring))
+		PostEvent(r->event, (byte *)r, 0);
+	}
+
+static void rxReadyHandler(ssDsRangee r, byte *buf, word len)
+	{
+	// running in the interrupt handler!!
+	// DS polls & finals addressed to us go to dsRx, anything else is left for
+	// the other rxReady delegates
+	ssFrameDispatch(&r->frames, buf, len);
+	}
+
+static void txDoneHandler(ssDsRangee r, byte *frame, word len)
+	{
+	// running in the interrupt handler!!
+	// capture each response's departure (T3) as it goes
+	if (len != sizeof_ssRangeRequestMsg || frame[MSG_FUNC_IDX] != FUNC_DS_RESPONSE)
+		return;
+	dsExchange x = exchangeOf(r, *((wyde *)&frame[MSG_DST_IDX]), frame[MSG_SEQ_IDX]);
+	if (x)
+		{
+		DWIFACE IDECA = *((DWIFACE *)typeof(r->radio)->jumps);
+		IDECA.Iocntl(r->radio, dwGetTxTime, &x->t3);
+		x->sent = 1;
+		}
+	}
+
+// Delegates are called with just the frame, so each rangee has its own pair of
+// entry points that hand on the frame along with the rangee it belongs to.
+static void rxReady0(byte *buf, word len)	{ rxReadyHandler(&rangees[0], buf, len); }
+static void txDone0(byte *frame, word len)	{ txDoneHandler(&rangees[0], frame, len); }
+#if kMaxDsRangees > 1
+static void rxReady1(byte *buf, word len)	{ rxReadyHandler(&rangees[1], buf, len); }
+static void txDone1(byte *frame, word len)	{ txDoneHandler(&rangees[1], frame, len); }
+#endif
+
+static const struct
+	{
+	void (*rxReady)(byte *buf, word len);
+	void (*txDone)(byte *frame, word len);
+	} rangeeTasks[kMaxDsRangees] =
+	{
+	{rxReady0, txDone0},
+#if kMaxDsRangees > 1
+	{rxReady1, txDone1},
+#endif
+	};
+
+// answer DS polls to radio (ssInit does this if built with USE_DS_RANGEE)
+void ssDsRangeeInit(RADIO radio)
+	{
+	// take a rangee for the radio (or start again with the one it has - its
+	// event and delegates are kept, the delegates being registered already)
+	ssDsRangee r = rangeeOf(radio);
+	byte again = r != NULL;
+	if (!r && !(r = rangeeOf(NULL)))
+		sys.Fatal("ssDsRangeeInit", __LINE__, "%s - too many DS ranging radios!", typeof(radio)->Name);
+	byte index = (byte)(r - rangees);
+	EVENT event = r->event;
+	DELEGATE rxReady = r->rxReady, txDone = r->txDone;
+
+	memset(r, 0, sizeof(_ssDsRangee));
+	r->radio = radio;
+	r->index = index;
+	frameRingInit(&r->ring);
+
+	// accept DS polls & finals addressed to this radio
+	byte hdr[sizeof_ssRangeRequestMsg];
+	memcpy(hdr, ssRangeRequestMsg, sizeof_ssRangeRequestMsg);
+	*((wyde *)&hdr[MSG_DST_IDX]) = ((Dw3000)radio)->addr;
+	ssFrameInit(&r->frames, hdr);
+	if (ssFrameFiltered(radio))
+		ssFrameTrustAddr(&r->frames);
+	ssFrameOn(&r->frames, FUNC_DS_POLL, sizeof_ssRangeRequestMsg, (SSFRAMEHANDLER) dsRx, r);
+	ssFrameOn(&r->frames, FUNC_DS_FINAL, sizeof_ssRangeRequestMsg, (SSFRAMEHANDLER) dsRx, r);
+
+	if (again)
+		{
+		r->event = event;
+		r->rxReady = rxReady;
+		r->txDone = txDone;
+		return;
+		}
+	objectCreate(r->event);
+	OnEvent(r->event, (HANDLER) dsEventHandler);
+
+	objectCreate(r->rxReady, delegateTask(rangeeTasks[index].rxReady));
+	IRADIO.Iocntl(radio, kRadioAddRxReady, r->rxReady);
+	objectCreate(r->txDone, delegateTask(rangeeTasks[index].txDone));
+	IRADIO.Iocntl(radio, kRadioAddTxDone, r->txDone);
+	}
@@ -0,0 +1,239 @@
+/*
+ *	File: ssFilter.c
+ *
+ *	Contains: Per rangee range filters
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+#include "interface/dw3000.h"
+
+#include "ssFilter.h"
+
+// NOTE
+// Filters live in one fixed table, a rangee's entry found by hashing its addr
+// (probing on from there past other rangees), so finding it takes the same
+// time however many rangees there are - and an entry is one small block, its
+// filter state held in place. An entry, once taken, stays its rangee's (a
+// filter turned off just passes results through), so nothing ever has to be
+// moved or re-probed.
+//
+// The Kalman filter tracks distance d and speed v (mm, mm/s), with covariance
+// P, assuming the speed changes randomly by about kFilterAccelMm/s each second;
+//
+//    predict (dt since the last)   d += v dt, P = F P F' + Q
+//    update (the range z)          s = P00 + R, K = (P00, P01) / s
+//                                  d += K0 (z - d), v += K1 (z - d), P -= K (P00, P01)
+//
+// A range more than kFilterGate standard deviations (of s) from the prediction
+// is dropped - a reflection, most likely - unless kFilterRejects are dropped in
+// a row, when the rangee really has moved and the filter starts over from it.
+//
+// The median keeps the last kFilterMedianLen ranges twice - in arrival order,
+// and sorted - so each one costs a shift of the sorted list, not a sort.
+
+#define kFilterGate		4		// Kalman - standard deviations before a range is dropped
+#define kFilterRejects	3		// ... and drops in a row before starting over
+#define kFilterMaxSpeed	3000	// ... first guess at speed (standard deviation, mm/s)
+
+typedef struct
+	{
+	wyde addr;				// rangee (0 if the entry is unused)
+	byte mode;				// kFilterXxx
+	byte rejects;			// Kalman - ranges dropped in a row
+	word count;				// results filtered
+	union
+		{
+		struct
+			{
+			dwTime t1;		// last result's poll
+			float d, v;		// mm, mm/s
+			float p00, p01, p11;
+			} k;
+		struct
+			{
+			byte next;		// oldest in ring
+			Int32 ring[kFilterMedianLen];
+			Int32 sorted[kFilterMedianLen];
+			} m;
+		} s;
+	} _filterEntry, *filterEntry;
+
+static _filterEntry filters[kFilterPeers];
+
+// Fibonacci hash - the top bits of addr * 2^16 / golden ratio
+#define filterHash(addr)	((byte)((wyde)((addr) * 40503U) >> (16 - kFilterPeerBits)))
+
+// rangee's entry (taking a free one if add) - NULL if none
+static filterEntry filterOf(wyde rangee, byte add)
+	{
+	byte i = filterHash(rangee);
+	for (byte n = 0; n < kFilterPeers; n++, i = (i + 1) & (kFilterPeers - 1))
+		{
+		filterEntry f = &filters[i];
+		if (f->addr == rangee)
+			return f;
+		if (!f->addr)
+			{
+			if (!add)
+				return NULL;
+			memset(f, 0, sizeof(_filterEntry));
+			f->addr = rangee;
+			return f;
+			}
+		}
+	return NULL;
+	}
+
+byte ssFilterMode(wyde rangee, byte mode)
+	{
+	filterEntry f = filterOf(rangee, mode != kFilterOff);
+	if (!f)
+		return mode == kFilterOff;
+	// (the filters share their state, so none may start on what another left -
+	// the median's next, say, where a Kalman t1 was)
+	f->mode = mode;
+	f->count = 0;
+	f->rejects = 0;
+	memset(&f->s, 0, sizeof(f->s));
+	return 1;
+	}
+
+void ssFilterReset(wyde rangee)
+	{
+	filterEntry f = filterOf(rangee, 0);
+	if (f)
+		{
+		f->count = 0;
+		f->rejects = 0;
+		memset(&f->s, 0, sizeof(f->s));
+		}
+	}
+
+// nearest mm
+static Int32 toMm(float mm)
+	{
+	return (Int32)(mm < 0.0f ? mm - 0.5f : mm + 0.5f);
+	}
+
+static Int32 kalman(filterEntry f, ssRangeData result)
+	{
+	const float r = (float)kFilterNoiseMm * kFilterNoiseMm;
+	const float q = (float)kFilterAccelMm * kFilterAccelMm;
+	float z = (float)result->mm;
+	if (!f->count)
+		{
+		// start at the range, standing still (give or take kFilterMaxSpeed)
+		f->s.k.d = z;
+		f->s.k.v = 0.0f;
+		f->s.k.p00 = r;
+		f->s.k.p01 = 0.0f;
+		f->s.k.p11 = (float)kFilterMaxSpeed * kFilterMaxSpeed;
+		f->s.k.t1 = result->t1;
+		f->rejects = 0;
+		return result->mm;
+		}
+
+	// predict
+#ifdef CC8051
+	float dt = kFilterStepMs / 1000.0f;
+#else
+	float dt = (float)(dwTimeDelta(result->t1, f->s.k.t1) * DWT_TIME_UNITS);
+#endif
+	float dt2 = dt * dt;
+	f->s.k.t1 = result->t1;
+	f->s.k.d += f->s.k.v * dt;
+	f->s.k.p00 += dt * (2.0f * f->s.k.p01 + dt * f->s.k.p11) + q * dt2 * dt2 / 4.0f;
+	f->s.k.p01 += dt * f->s.k.p11 + q * dt2 * dt / 2.0f;
+	f->s.k.p11 += q * dt2;
+
+	// update - unless it's too far off
+	float y = z - f->s.k.d, s = f->s.k.p00 + r;
+	if (y * y > (float)kFilterGate * kFilterGate * s)
+		{
+		if (++f->rejects < kFilterRejects)
+			return toMm(f->s.k.d);
+		f->count = 0;
+		return kalman(f, result);
+		}
+	f->rejects = 0;
+	float k0 = f->s.k.p00 / s, k1 = f->s.k.p01 / s;
+	f->s.k.d += k0 * y;
+	f->s.k.v += k1 * y;
+	f->s.k.p11 -= k1 * f->s.k.p01;
+	f->s.k.p01 -= k0 * f->s.k.p01;
+	f->s.k.p00 -= k0 * f->s.k.p00;
+	return toMm(f->s.k.d);
+	}
+
+static Int32 median(filterEntry f, ssRangeData result)
+	{
+	Int32 mm = result->mm;
+	byte n = f->count < kFilterMedianLen ? (byte)f->count : kFilterMedianLen, i;
+
+	// out with the oldest (once there are enough)...
+	if (n == kFilterMedianLen)
+		{
+		for (i = 0; f->s.m.sorted[i] != f->s.m.ring[f->s.m.next]; i++)
+			;
+		for (n--; i < n; i++)
+			f->s.m.sorted[i] = f->s.m.sorted[i + 1];
+		}
+	f->s.m.ring[f->s.m.next] = mm;
+	f->s.m.next = (f->s.m.next + 1) % kFilterMedianLen;
+
+	// ... in with the new
+	for (i = n; i && f->s.m.sorted[i - 1] > mm; i--)
+		f->s.m.sorted[i] = f->s.m.sorted[i - 1];
+	f->s.m.sorted[i] = mm;
+	n++;
+
+	// (the lower middle, until the window fills)
+	return f->s.m.sorted[(n - 1) / 2];
+	}
+
+byte ssFilter(ssRangeData result)
+	{
+	filterEntry f = filterOf(result->rangee, 0);
+	if (!f || f->mode == kFilterOff)
+		return 0;
+
+	Int32 mm = f->mode == kFilterKalman ? kalman(f, result) : median(f, result);
+	if (f->count != 0xFFFF)
+		f->count++;
+	if (result->range != 0.0)
+		result->range = mm / 1000.0;
+	result->mm = mm;
+	return 1;
+	}
+
+word ssFilterState(wyde rangee, Int32 *mm, Int32 *mmPerSec)
+	{
+	filterEntry f = filterOf(rangee, 0);
+	if (!f || f->mode == kFilterOff || !f->count)
+		return 0;
+	if (f->mode == kFilterKalman)
+		{
+		*mm = toMm(f->s.k.d);
+		*mmPerSec = toMm(f->s.k.v);
+		}
+	else
+		{
+		byte n = f->count < kFilterMedianLen ? (byte)f->count : kFilterMedianLen;
+		*mm = f->s.m.sorted[(n - 1) / 2];
+		*mmPerSec = 0;
+		}
+	return f->count;
+	}
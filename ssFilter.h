@@ -0,0 +1,72 @@
+/*
+ *	File: ssFilter.h
+ *
+ *	Contains: Per rangee range filters
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __SSFILTER_H
+#define __SSFILTER_H
+
+#include "ssRange.h"
+
+// Each rangee given a filter (ssFilterMode) has every result from it smoothed
+// as it lands - the mm (and range) of the result are replaced by the filtered
+// distance, the timestamps are left as measured. Built USE_RANGE_FILTER, the
+// ranger does this itself (see rangeResult), otherwise call ssFilter on each
+// result.
+//
+// The Kalman filter follows distance and speed, and takes the time between
+// results from their poll timestamps (t1). On the 8051 (32 bit device time, see
+// dwTime.h) those wrap every 67ms, so there every result counts as
+// kFilterStepMs after the last.
+
+#ifndef kFilterPeers
+#define kFilterPeerBits	4
+#define kFilterPeers	(1 << kFilterPeerBits)	// rangees with a filter (power of 2)
+#endif
+#ifndef kFilterMedianLen
+#define kFilterMedianLen	5		// results the median is taken over (odd)
+#endif
+#ifndef kFilterNoiseMm
+#define kFilterNoiseMm		100		// Kalman - range noise (standard deviation)
+#endif
+#ifndef kFilterAccelMm
+#define kFilterAccelMm		2000	// ... and how hard a rangee may speed up or slow down (mm/s^2)
+#endif
+#define kFilterStepMs		100		// ... time between results, where it can't be measured
+
+// filters (see ssFilterMode)
+enum
+	{
+	kFilterOff,		// results as measured
+	kFilterKalman,	// constant velocity Kalman
+	kFilterMedian	// median of the last kFilterMedianLen
+	};
+
+// filter results from rangee (kFilterOff to stop) - returns 0 if the table is full
+byte ssFilterMode(wyde rangee, byte mode);
+
+// restart rangee's filter (it moved while we weren't ranging it, say)
+void ssFilterReset(wyde rangee);
+
+// filter result in place - returns 0 if its rangee has no filter
+byte ssFilter(ssRangeData result);
+
+// the latest filtered distance (mm) and speed (mm/s, Kalman only - away from us
+// is positive) - returns the # of results filtered (0 if none)
+word ssFilterState(wyde rangee, Int32 *mm, Int32 *mmPerSec);
+
+#endif
@@ -0,0 +1,142 @@
+/*
+ *	File: ssFrame.c
+ *
+ *	Contains: Ranging frame classification and dispatch
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "ssFrame.h"
+#include "ssRange.h"
+
+// NOTE
+// A radio in promiscuous mode hands every frame on the channel to every rxReady
+// delegate, and most of them are nothing to do with ranging. The order of the
+// tests is chosen so those are turned away as early as possible;
+//
+//		1) length        - most of the traffic (acks, beacons, data) fails here
+//		2) frame control - MAC commands & long addressing
+//		3) function code - data frames that aren't ranging
+//		4) PAN id        - ranging on another PAN
+//		5) destination   - ranging between other nodes
+//
+// The length goes first - each handler says the length of frame it takes (see
+// ssFrameOn), and most of what is on the channel is some other length, so it
+// is the one test that turns away the bulk of the traffic for a single bit
+// test. The rest of the header - from the seq # to the function code, which
+// covers the PAN id & destination - is then compared 8 bytes at a time, along
+// with the frame control, against a template taken in ssFrameInit and masked
+// to the bits that are checked (never the seq # or the source, and only the
+// top nibble of the function code); so a frame that isn't for us costs two
+// branches, whichever field it fails on. Each is read with memcpy, so the
+// frame may be anywhere. On the 8051, where a word is no wider than a byte,
+// the fields are compared a byte at a time. Only then is the handler found, by
+// indexing rather than by testing codes in turn.
+//
+// This is no quicker than the test rxReadyHandler had when it only ever took
+// responses (see TestFrameBench) - the length is looked up, not compared with
+// a constant - but it takes any number of codes & lengths, and checks the PAN.
+
+#define kFrameMatchIdx	MSG_SEQ_IDX		// the compare starts here ...
+#define kFrameMatch		8				// ... and covers this many bytes (to the function code)
+
+// hdr is a template frame header addressed to us (e.g. expectedResponse)
+void ssFrameInit(ssFrameTable table, byte *hdr)
+	{
+	memset(table, 0, sizeof(_ssFrameTable));
+	table->fc[0] = hdr[0];
+	table->fc[1] = hdr[1];
+	memcpy(table->hdr, &hdr[kFrameMatchIdx], kFrameMatch);
+	table->hdr[MSG_FUNC_IDX - kFrameMatchIdx] = kFrameFuncBase;
+	memset(&table->mask[MSG_PAN_IDX - kFrameMatchIdx], 0xFF, MSG_SRC_IDX - MSG_PAN_IDX);
+	table->mask[MSG_FUNC_IDX - kFrameMatchIdx] = 0xF0;
+	}
+
+// the radio has already checked the PAN & destination (see USE_FRAME_FILTER),
+// so only check the frame control & function code
+void ssFrameTrustAddr(ssFrameTable table)
+	{
+	memset(&table->mask[MSG_PAN_IDX - kFrameMatchIdx], 0, MSG_SRC_IDX - MSG_PAN_IDX);
+	}
+
+// accept frames to any destination on our PAN (for nodes that watch the channel,
+// see ssTdma.c) - only the frame control, PAN id & function code are checked
+void ssFrameAnyDst(ssFrameTable table)
+	{
+	table->mask[MSG_DST_IDX - kFrameMatchIdx] = table->mask[MSG_DST_IDX - kFrameMatchIdx + 1] = 0;
+	}
+
+// set the handler for frames with function code func (NULL to ignore them), of
+// len bytes (kFrameAnyLen for any - the handler checks the length)
+// NOTE: lengths are only ever added, so a handler must still check its own
+void ssFrameOn(ssFrameTable table, byte func, byte len, SSFRAMEHANDLER handler, void *context)
+	{
+	assert((func & 0xF0) == kFrameFuncBase);
+	assert(len == kFrameAnyLen || (len >= kFrameHdrSize && len <= kFrameMaxLen));
+	if (len == kFrameAnyLen)
+		{
+		// (never one too short to hold a header)
+		memset(table->lens, 0xFF, sizeof(table->lens));
+		table->lens[0] = 0;
+		table->lens[1] = (byte)(0xFF << (kFrameHdrSize - 8));
+		}
+	else
+		table->lens[len >> 3] |= 1 << (len & 7);
+	table->context[func & 0x0F] = context;
+	table->handler[func & 0x0F] = handler;
+	}
+
+// running in the interrupt handler!!
+// returns 1 if a handler took the frame, else 0 (leave it for other delegates)
+byte ssFrameDispatch(ssFrameTable table, byte *buf, word len)
+	{
+#ifdef CC8051
+	if (!(table->lens[(len >> 3) & (sizeof(table->lens) - 1)] & (1 << (len & 7))) || buf[0] != table->fc[0] || buf[1] != table->fc[1])
+		return 0;
+	byte k, diff = 0;
+	for (k = MSG_PAN_IDX - kFrameMatchIdx; k < kFrameMatch; k++)
+		if ((buf[kFrameMatchIdx + k] ^ table->hdr[k]) & table->mask[k])
+			diff |= k == MSG_DST_IDX - kFrameMatchIdx || k == MSG_DST_IDX - kFrameMatchIdx + 1 ? 2 : 1;
+	if (diff == 2 && (buf[MSG_DST_IDX] & buf[MSG_DST_IDX + 1]) == 0xFF)
+		// (broadcast)
+		diff = 0;
+	if (diff)
+		return 0;
+#else
+	if (!(table->lens[(len >> 3) & (sizeof(table->lens) - 1)] & (1 << (len & 7))))
+		return 0;
+	wyde fc, fcOurs;
+	UInt64 h, ours, mask;
+	memcpy(&fc, buf, sizeof(wyde));
+	memcpy(&fcOurs, table->fc, sizeof(wyde));
+	memcpy(&h, &buf[kFrameMatchIdx], sizeof(UInt64));
+	memcpy(&ours, table->hdr, sizeof(UInt64));
+	memcpy(&mask, table->mask, sizeof(UInt64));
+	if (((h ^ ours) & mask) | (wyde)(fc ^ fcOurs))
+		{
+		// a broadcast to our PAN will do
+		static const byte bcast[kFrameMatch] = {0, 0, 0, 0xFF, 0xFF, 0, 0, 0};
+		UInt64 dst;
+		memcpy(&dst, bcast, sizeof(UInt64));
+		if (fc != fcOurs || ((h ^ ours) & mask & ~dst) || (h & dst) != dst)
+			return 0;
+		}
+#endif
+
+	byte i = buf[MSG_FUNC_IDX] & 0x0F;
+	if (!table->handler[i])
+		return 0;
+	table->handler[i](buf, len, table->context[i]);
+	return 1;
+	}
@@ -0,0 +1,55 @@
+/*
+ *	File: ssFrame.h
+ *
+ *	Contains: Ranging frame classification and dispatch definitions
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __SSFRAME_H
+#define __SSFRAME_H
+
+#include "Koliada.h"
+
+// Ranging frames share a 10 byte 802.15.4 header (see ssInit.c) and differ only
+// in the function code that follows it. Frames are classified once, in the rx
+// interrupt handler, by comparing the header against values taken from a
+// template frame, then handed to whichever handler is registered for the code.
+
+#define kFrameHdrSize	10		// frame control .. function code
+#define kFrameFuncBase	0xE0	// ranging function codes are 0xE0..0xEF
+#define kFrameFuncs		16
+#define kFrameAnyLen	0		// (see ssFrameOn)
+#define kFrameMaxLen	127		// the longest frame there can be (aMaxPhyPacketSize)
+
+// called (in the interrupt handler) for each qualified frame
+typedef void (*SSFRAMEHANDLER)(byte *buf, word len, void *context);
+
+typedef struct
+	{
+	byte lens[(kFrameMaxLen + 1) / 8];	// bit n set - a handler takes frames of n bytes
+	byte fc[2];		// frame control, as it is in a frame for us
+	byte hdr[8];	// the rest of a header for us (from the seq #) - PAN id, our addr & function code
+	byte mask[8];	// ... the bits of each byte checked (see ssFrameTrustAddr & ssFrameAnyDst)
+	SSFRAMEHANDLER handler[kFrameFuncs];
+	void *context[kFrameFuncs];
+	} _ssFrameTable, *ssFrameTable;
+
+void ssFrameInit(ssFrameTable table, byte *hdr);
+void ssFrameTrustAddr(ssFrameTable table);
+void ssFrameAnyDst(ssFrameTable table);
+void ssFrameOn(ssFrameTable table, byte func, byte len, SSFRAMEHANDLER handler, void *context);
+byte ssFrameDispatch(ssFrameTable table, byte *buf, word len);
+
+#endif
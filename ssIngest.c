@@ -0,0 +1,443 @@
+/*
+ *	File: ssIngest.c
+ *
+ *	Contains: Ranging record ingest server - Linux host
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#define _GNU_SOURCE		// recvmmsg, CPU_SET
+
+#include "Koliada.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "ssIngest.h"
+#include "ssTof.h"
+#include "ssTofBatch.h"
+
+// NOTE
+// TestOffloadRx serves one node well enough, but a site of thousands of tags
+// is another matter, so here;
+//
+// Receive - each receive thread has its own socket on the port (SO_REUSEPORT,
+// so the kernel spreads the senders across them) and takes up to kIngestBatch
+// datagrams a call (recvmmsg). The records are looked at where they landed
+// (recRangee & co, see ssOffload.h) - nothing is unpacked - and each is copied,
+// once, to the queue of the shard its rangee hashes to.
+//
+// Queues - one from every receive thread to every shard, each with a single
+// writer and a single reader, so a ring with a head and tail (each on its own
+// cache line) is all it takes; no locks, and no atomic read-modify-writes.
+// Should a shard fall behind its queue fills, and records are dropped (and
+// counted) rather than holding up the receive thread.
+//
+// Shards - each takes whatever its queues hold, solves the SS records
+// together (ssTofBatchDistance, the DS ones singly) and writes the results to
+// the tag table. Every rangee belongs to one shard, so each tag has a single
+// writer; readers (ssIngestTagOf) take a copy under the entry's version #
+// (odd while it's being written), retrying if it changed underneath them.
+//
+// The tag table is indexed by the rangee addr itself - 64K small entries is
+// nothing on a host, and it needs no hashing or probing at all.
+//
+// Threads are pinned to cores round robin (receive threads first), so each
+// queue stays between the same two caches.
+
+#ifndef __linux__
+#error Linux host only (recvmmsg, SO_REUSEPORT)
+#endif
+
+#define kIngestRxTimeoutMs	100		// receive threads check for stopping this often
+#define kIngestSolveBatch	64		// records solved at once (per queue, at most)
+#define kIngestIdleUs		50		// shards sleep this long when their queues are empty
+#define kIngestRcvBuf		(4 << 20)	// socket receive buffer (bytes)
+
+#define kCacheLine			64
+
+typedef struct
+	{
+	byte rec[sizeof_ssOffloadDS];
+	} _ingestSlot;
+
+// single producer (a receive thread), single consumer (a shard)
+typedef struct
+	{
+	_Alignas(kCacheLine) _Atomic UInt32 head;	// next to write
+	_Alignas(kCacheLine) _Atomic UInt32 tail;	// next to read
+	_Alignas(kCacheLine) _ingestSlot slots[kIngestQueueLen];
+	} _ingestQueue, *ingestQueue;
+
+typedef struct
+	{
+	byte index;
+	int fd;
+	pthread_t thread;
+	_Atomic UInt64 datagrams, bad, records, dropped;
+	struct mmsghdr msgs[kIngestBatch];
+	struct iovec iovs[kIngestBatch];
+	byte bufs[kIngestBatch][kIngestMaxDatagram];
+	} _ingestRx, *ingestRx;
+
+typedef struct
+	{
+	byte index;
+	pthread_t thread;
+	_Atomic UInt64 solved;
+	} _ingestShard, *ingestShard;
+
+typedef struct
+	{
+	_Atomic UInt32 version;		// odd while it's being written
+	_ssIngestTag tag;
+	} _ingestEntry, *ingestEntry;
+
+static struct
+	{
+	byte rxThreads, shards;
+	atomic_bool stop;			// receive threads
+	atomic_bool drain;			// ... shards (once the receive threads are done)
+	ingestRx rx[kIngestMaxThreads];
+	_ingestShard shard[kIngestMaxThreads];
+	ingestQueue queues;			// [rx][shard] (NULL if stopped)
+	_ssIngestStats total;		// as they were when it stopped
+	} ingest;
+
+static _ingestEntry tags[0x10000];
+
+#define queueOf(rx, shard)	(&ingest.queues[(rx) * ingest.shards + (shard)])
+
+// the shard a rangee belongs to - the top bits of a Fibonacci hash, scaled
+#define shardOf(rangee)		((byte)(((UInt32)(wyde)((rangee) * 40503U) * ingest.shards) >> 16))
+
+static void ingestPin(pthread_t thread, int n)
+	{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus <= 1)
+		return;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(n % cpus, &set);
+	pthread_setaffinity_np(thread, sizeof(set), &set);
+	}
+
+// the records of a datagram, onto their shards' queues
+static void ingestDatagram(ingestRx rx, byte *data, word len)
+	{
+	if (len < sizeof_ssOffloadHdr || data[OFFLOAD_VERSION_IDX] != kOffloadVersion)
+		{
+		atomic_fetch_add_explicit(&rx->bad, 1, memory_order_relaxed);
+		return;
+		}
+	UInt32 records = 0, dropped = 0;
+	byte count = data[OFFLOAD_COUNT_IDX], n;
+	word at = sizeof_ssOffloadHdr;
+	for (n = 0; n < count; n++)
+		{
+		byte *rec = &data[at];
+		if (at + sizeof_ssOffloadSS > len || at + recSize(rec) > len)
+			break;
+		word size = recSize(rec);
+		at += size;
+
+		ingestQueue q = queueOf(rx->index, shardOf(recRangee(rec)));
+		UInt32 head = atomic_load_explicit(&q->head, memory_order_relaxed);
+		if (head - atomic_load_explicit(&q->tail, memory_order_acquire) == kIngestQueueLen)
+			{
+			dropped++;
+			continue;
+			}
+		memcpy(q->slots[head & (kIngestQueueLen - 1)].rec, rec, size);
+		atomic_store_explicit(&q->head, head + 1, memory_order_release);
+		records++;
+		}
+	if (n < count)
+		// (cut short)
+		atomic_fetch_add_explicit(&rx->bad, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&rx->records, records, memory_order_relaxed);
+	atomic_fetch_add_explicit(&rx->dropped, dropped, memory_order_relaxed);
+	}
+
+static void *ingestRxThread(void *arg)
+	{
+	ingestRx rx = arg;
+	for (word i = 0; i < kIngestBatch; i++)
+		{
+		rx->iovs[i].iov_base = rx->bufs[i];
+		rx->iovs[i].iov_len = kIngestMaxDatagram;
+		rx->msgs[i].msg_hdr.msg_iov = &rx->iovs[i];
+		rx->msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+	while (!atomic_load_explicit(&ingest.stop, memory_order_relaxed))
+		{
+		// wait for one (or the timeout), then take whatever else is there
+		int n = recvmmsg(rx->fd, rx->msgs, kIngestBatch, MSG_WAITFORONE, NULL);
+		if (n <= 0)
+			continue;
+		atomic_fetch_add_explicit(&rx->datagrams, (UInt64)n, memory_order_relaxed);
+		for (int i = 0; i < n; i++)
+			ingestDatagram(rx, rx->bufs[i], (word)rx->msgs[i].msg_len);
+		}
+	return NULL;
+	}
+
+static void ingestTagSet(byte *rec, Int32 mm)
+	{
+	ingestEntry e = &tags[recRangee(rec)];
+	UInt32 version = atomic_load_explicit(&e->version, memory_order_relaxed);
+	atomic_store_explicit(&e->version, version + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	e->tag.rangee = recRangee(rec);
+	e->tag.ranger = recRanger(rec);
+	e->tag.seq = rec[REC_SEQ_IDX];
+	e->tag.flags = rec[REC_FLAGS_IDX];
+	e->tag.mm = mm;
+	e->tag.results++;
+	atomic_store_explicit(&e->version, version + 2, memory_order_release);
+	}
+
+// solve (and record) whatever is on queue q - returns the count
+static UInt32 ingestSolve(ingestQueue q)
+	{
+	UInt32 tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	UInt32 n = atomic_load_explicit(&q->head, memory_order_acquire) - tail;
+	if (n > kIngestSolveBatch)
+		n = kIngestSolveBatch;
+	if (!n)
+		return 0;
+
+	// the SS records together, the DS ones as they come
+	dwTime t1[kIngestSolveBatch], t2[kIngestSolveBatch], t3[kIngestSolveBatch], t4[kIngestSolveBatch];
+	Int32 cor[kIngestSolveBatch];
+	byte *ss[kIngestSolveBatch];
+	UInt32 count = 0;
+	for (UInt32 i = 0; i < n; i++)
+		{
+		byte *rec = q->slots[(tail + i) & (kIngestQueueLen - 1)].rec, flags = rec[REC_FLAGS_IDX];
+		if (flags & kOffloadDS)
+			{
+			dwTime d[6];
+			dwTimeGet(d[0], &rec[REC_T1_IDX]);
+			dwTimeGet(d[1], &rec[REC_T2_IDX]);
+			dwTimeGet(d[2], &rec[REC_T3_IDX]);
+			dwTimeGet(d[3], &rec[REC_T4_IDX]);
+			dwTimeGet(d[4], &rec[REC_T5_IDX]);
+			dwTimeGet(d[5], &rec[REC_T6_IDX]);
+			double distance = ssDsTofDistance(recOwnDelta(flags, d[3], d[0]), dwTimePeerDelta(d[2], d[1]),
+				dwTimePeerDelta(d[5], d[2]), recOwnDelta(flags, d[4], d[3]));
+			ingestTagSet(rec, (Int32)(distance * 1000.0));
+			continue;
+			}
+		// (t4 & t3 placed so the batch's own deltas come out as the ranger's)
+		dwTime t;
+		dwTimeGet(t1[count], &rec[REC_T1_IDX]);
+		dwTimeGet(t2[count], &rec[REC_T2_IDX]);
+		dwTimeGet(t, &rec[REC_T3_IDX]);
+		t3[count] = t2[count] + dwTimePeerDelta(t, t2[count]);
+		dwTimeGet(t, &rec[REC_T4_IDX]);
+		t4[count] = t1[count] + recOwnDelta(flags, t, t1[count]);
+		memcpy(&cor[count], &rec[REC_COR_IDX], sizeof(Int32));
+		ss[count++] = rec;
+		}
+	if (count)
+		{
+		_ssTofBatch batch = {t1, t2, t3, t4, cor};
+		double distance[kIngestSolveBatch];
+		ssTofBatchDistance(&batch, count, distance);
+		for (UInt32 i = 0; i < count; i++)
+			ingestTagSet(ss[i], (Int32)(distance[i] * 1000.0));
+		}
+
+	// (the slots are free once they're solved)
+	atomic_store_explicit(&q->tail, tail + n, memory_order_release);
+	return n;
+	}
+
+static void *ingestShardThread(void *arg)
+	{
+	ingestShard s = arg;
+	const struct timespec idle = {0, kIngestIdleUs * 1000L};
+	for (;;)
+		{
+		// (a last pass once the receive threads have stopped, so nothing queued is left)
+		byte last = atomic_load_explicit(&ingest.drain, memory_order_acquire);
+		UInt32 solved = 0, n;
+		for (byte r = 0; r < ingest.rxThreads; r++)
+			while ((n = ingestSolve(queueOf(r, s->index))) != 0)
+				solved += n;
+		if (solved)
+			atomic_fetch_add_explicit(&s->solved, solved, memory_order_relaxed);
+		else if (last)
+			break;
+		else
+			nanosleep(&idle, NULL);
+		}
+	return NULL;
+	}
+
+static int ingestSocket(wyde port)
+	{
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -errno;
+	int on = 1, size = kIngestRcvBuf;
+	struct timeval timeout = {0, kIngestRxTimeoutMs * 1000L};
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0 ||
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0 ||
+			bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		{
+		int err = -errno;
+		close(fd);
+		return err;
+		}
+	// (as big as the system allows, if not this big)
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	return fd;
+	}
+
+int ssIngestStart(wyde port, byte rxThreads, byte shards)
+	{
+	assert(rxThreads && rxThreads <= kIngestMaxThreads && shards && shards <= kIngestMaxThreads);
+	ssIngestStop();
+	memset(tags, 0, sizeof(tags));
+	memset(&ingest.total, 0, sizeof(ingest.total));
+	ingest.rxThreads = rxThreads;
+	ingest.shards = shards;
+	atomic_store(&ingest.stop, 0);
+	atomic_store(&ingest.drain, 0);
+	ingest.queues = aligned_alloc(kCacheLine, sizeof(_ingestQueue) * rxThreads * shards);
+	if (!ingest.queues)
+		return -ENOMEM;
+	for (UInt32 i = 0; i < (UInt32)rxThreads * shards; i++)
+		{
+		atomic_init(&ingest.queues[i].head, 0);
+		atomic_init(&ingest.queues[i].tail, 0);
+		}
+
+	// the sockets first, so a port in use fails before any threads start
+	byte r, s;
+	int err = 0;
+	for (r = 0; r < rxThreads; r++)
+		{
+		ingestRx rx = ingest.rx[r] = calloc(1, sizeof(_ingestRx));
+		if (!rx)
+			{
+			err = -ENOMEM;
+			break;
+			}
+		rx->index = r;
+		rx->fd = -1;
+		if ((rx->fd = ingestSocket(port)) < 0)
+			{
+			err = rx->fd;
+			break;
+			}
+		}
+	if (err)
+		{
+		ingest.rxThreads = r + 1;
+		ssIngestStop();
+		return err;
+		}
+
+	for (s = 0; s < shards; s++)
+		{
+		ingest.shard[s].index = s;
+		atomic_init(&ingest.shard[s].solved, 0);
+		pthread_create(&ingest.shard[s].thread, NULL, ingestShardThread, &ingest.shard[s]);
+		ingestPin(ingest.shard[s].thread, rxThreads + s);
+		}
+	for (r = 0; r < rxThreads; r++)
+		{
+		pthread_create(&ingest.rx[r]->thread, NULL, ingestRxThread, ingest.rx[r]);
+		ingestPin(ingest.rx[r]->thread, r);
+		}
+	return 0;
+	}
+
+void ssIngestStop()
+	{
+	if (!ingest.queues)
+		return;
+
+	// the receive threads, then the shards (once they've solved what's queued)
+	byte r, s;
+	atomic_store(&ingest.stop, 1);
+	for (r = 0; r < ingest.rxThreads; r++)
+		if (ingest.rx[r] && ingest.rx[r]->thread)
+			pthread_join(ingest.rx[r]->thread, NULL);
+	atomic_store_explicit(&ingest.drain, 1, memory_order_release);
+	for (s = 0; s < ingest.shards; s++)
+		if (ingest.shard[s].thread)
+			pthread_join(ingest.shard[s].thread, NULL);
+
+	ssIngestStatsOf(&ingest.total);
+	for (r = 0; r < ingest.rxThreads; r++)
+		if (ingest.rx[r])
+			{
+			if (ingest.rx[r]->fd >= 0)
+				close(ingest.rx[r]->fd);
+			free(ingest.rx[r]);
+			ingest.rx[r] = NULL;
+			}
+	memset(ingest.shard, 0, sizeof(ingest.shard));
+	free(ingest.queues);
+	ingest.queues = NULL;
+	}
+
+byte ssIngestTagOf(wyde rangee, ssIngestTag tag)
+	{
+	ingestEntry e = &tags[rangee];
+	UInt32 before, after;
+	do
+		{
+		before = atomic_load_explicit(&e->version, memory_order_acquire);
+		*tag = e->tag;
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&e->version, memory_order_relaxed);
+		} while ((before & 1) || before != after);
+	return tag->rangee != 0;
+	}
+
+void ssIngestStatsOf(ssIngestStats stats)
+	{
+	if (!ingest.queues)
+		{
+		*stats = ingest.total;
+		return;
+		}
+	memset(stats, 0, sizeof(_ssIngestStats));
+	for (byte r = 0; r < ingest.rxThreads; r++)
+		if (ingest.rx[r])
+			{
+			stats->datagrams += atomic_load_explicit(&ingest.rx[r]->datagrams, memory_order_relaxed);
+			stats->bad += atomic_load_explicit(&ingest.rx[r]->bad, memory_order_relaxed);
+			stats->records += atomic_load_explicit(&ingest.rx[r]->records, memory_order_relaxed);
+			stats->dropped += atomic_load_explicit(&ingest.rx[r]->dropped, memory_order_relaxed);
+			}
+	for (byte s = 0; s < ingest.shards; s++)
+		stats->solved += atomic_load_explicit(&ingest.shard[s].solved, memory_order_relaxed);
+	}
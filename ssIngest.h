@@ -0,0 +1,70 @@
+/*
+ *	File: ssIngest.h
+ *
+ *	Contains: Ranging record ingest server definitions - Linux host
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __SSINGEST_H
+#define __SSINGEST_H
+
+#include "Koliada.h"
+#include "ssOffload.h"
+
+// Receives the datagrams of any number of offloading rangers (see ssOffload.h)
+// on several threads at once, works out their distances, and keeps the latest
+// result for every tag (rangee) - see ssIngest.c.
+
+#ifndef kIngestMaxThreads
+#define kIngestMaxThreads	16		// receive threads, and shards, at most (each)
+#endif
+#define kIngestBatch		64		// datagrams per receive call
+#define kIngestMaxDatagram	1472	// bytes (an Ethernet MTU's worth)
+#ifndef kIngestQueueLen
+#define kIngestQueueLen		4096	// records queued from each receive thread to each shard (power of 2)
+#endif
+
+// a tag's latest result
+typedef struct
+	{
+	wyde rangee;		// 0 if nothing has been heard from it
+	wyde ranger;
+	byte seq;
+	byte flags;			// kOffloadXxx
+	Int32 mm;			// distance
+	UInt32 results;		// in all
+	} _ssIngestTag, *ssIngestTag;
+
+typedef struct
+	{
+	UInt64 datagrams;	// received
+	UInt64 bad;			// ... of them not offload datagrams (or cut short)
+	UInt64 records;		// queued
+	UInt64 dropped;		// ... and not, the queue being full
+	UInt64 solved;		// worked out (and in the tag table)
+	} _ssIngestStats, *ssIngestStats;
+
+// receive on port (any address) with rxThreads threads, solving on shards more
+// - returns 0, or -errno if it couldn't start
+int ssIngestStart(wyde port, byte rxThreads, byte shards);
+void ssIngestStop(void);
+
+// rangee's latest result - returns 0 if there isn't one
+byte ssIngestTagOf(wyde rangee, ssIngestTag tag);
+
+// totals since ssIngestStart (to ssIngestStop, once stopped)
+void ssIngestStatsOf(ssIngestStats stats);
+
+#endif
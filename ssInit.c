@@ -22,6 +22,49 @@
 
 #include "ssRange.h"
 
+// NOTE
+// Without USE_FRAME_FILTER the radio is promiscuous, so every frame on the channel
+// interrupts the host and is qualified in software by each rxReady delegate. In
+// a busy deployment most of those interrupts are for other nodes. With it, the
+// radio is given our PAN id & addr and only passes on data frames for us (or
+// broadcast); the ranger then skips the address checks it would otherwise make.
+//
+// Anything else using the radio (e.g. TestDecaRange's ':' frames) will no longer
+// see frames that are not addressed to it.
+//
+// Whether a radio filters is kept for each one (a node may have one radio that
+// does and one that doesn't), and asked for with ssFrameFiltered.
+static RADIO filtering[kMaxRangers];	// the radios filtering frames for us
+
+// returns non zero if ssInit has the radio filtering frames for us
+byte ssFrameFiltered(RADIO radio)
+	{
+	for (byte i = 0; i < kMaxRangers; i++)
+		if (radio && filtering[i] == radio)
+			return 1;
+	return 0;
+	}
+
+#ifdef USE_FRAME_FILTER
+// records (or forgets) that the radio is filtering - returns filter, or 0 if
+// there is no room to record it
+static byte setFiltered(RADIO radio, byte filter)
+	{
+	byte i;
+	for (i = 0; i < kMaxRangers; i++)
+		if (filtering[i] == radio)
+			filtering[i] = NULL;
+	if (!filter)
+		return 0;
+	for (i = 0; i < kMaxRangers && filtering[i]; i++)
+		;
+	if (i == kMaxRangers)
+		return 0;
+	filtering[i] = radio;
+	return 1;
+	}
+#endif
+
 #if 0
 /////////////////////////////////////////////////////////
 // These should be set in the respective board configs!!!
@@ -79,7 +122,7 @@ dwt_txconfig_t txconfig_options =
 //    The first 10 bytes of those frame are common and are composed of the following fields:
 //     - byte 0/1: frame control (0x8841 to indicate a data frame using 16-bit addressing).
 //     - byte 2: sequence number, incremented for each new frame.
-//     - byte 3/4: PAN ID (0xDECA).
+//     - byte 3/4: PAN ID (0xDECA - the frame filter takes it from ssRangeRequestMsg).
 //     - byte 5/6: destination address.
 //     - byte 7/8: source address.
 //     - byte 9: function code (specific values to indicate which message it is in the ranging process).
@@ -87,12 +130,39 @@ dwt_txconfig_t txconfig_options =
 //    The remaining bytes are specific to each message as follows:
 //       ssRangeRequestMsg - no more data
 //       ssRangeResponsMsg:
-//          - byte 10 -> 13: request message time of arrival timestamp.
-//          - byte 14 -> 17: response message time of transmission timestamp.
+//          - byte 10 -> 14: request message time of arrival timestamp.
+//          - byte 15 -> 19: response message time of transmission timestamp.
+//
+//    Timestamps are the whole 40 bit device time, little endian (see dwTime.h).
+//
+// Double sided (DS-TWR) exchanges use four more function codes (see ssRangeMode);
+//
+//     E2 poll     - ranger to rangee, no more data (T1 sent, T2 received)
+//     E3 response - rangee to ranger, no more data (T3 sent, T4 received)
+//     E4 final    - ranger to rangee, no more data (T5 sent, T6 received)
+//     E5 report   - rangee to ranger:
+//          - byte 10 -> 14: poll time of arrival (T2).
+//          - byte 15 -> 19: response time of transmission (T3).
+//          - byte 20 -> 24: final time of arrival (T6).
+//
+//    The ranger already has T1, T4 & T5, so nothing it sends carries a timestamp,
+//    and the rangee reports T3 after the fact rather than embedding it in the
+//    response - so the response needn't be a delayed tx at a precomputed time, and
+//    may go out whenever the rangee gets round to it. The drift between the two
+//    clocks cancels out of the result, so there is no clock offset to read.
+//
+// Scheduled ranging (see ssTdma.c) adds a superframe beacon, broadcast by the
+// coordinator at the start of each superframe;
+//
+//     E6 beacon:
+//          - byte 10/11: # of slots.
+//          - byte 12/13: slot length (us).
+//          - byte 14/15: beacon to the first slot (us).
+//          - byte 16/17: superframe #.
 //
 byte ssRangeRequestMsg[] = {0x41, 0x88, 0, 0xCA, 0xDE, 'W', 'A', 'V', 'E', 0xE0};
 #ifdef USE_RANGEE
-byte ssRangeResponsMsg[] = {0x41, 0x88, 0, 0xCA, 0xDE, 'V', 'E', 'W', 'A', 0xE1, 0, 0, 0, 0, 0, 0, 0, 0, };
+byte ssRangeResponsMsg[] = {0x41, 0x88, 0, 0xCA, 0xDE, 'V', 'E', 'W', 'A', 0xE1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, };
 #endif
 //
 // As they are shown here, these will only work for two devices working alone.
@@ -127,18 +197,28 @@ void ssInit(RADIO radio)
 	IDECA.Iocntl(radio, dwSetRxAntennaDelay, RX_ANT_DLY);
 	IDECA.Iocntl(radio, dwSetTxAntennaDelay, TX_ANT_DLY);
 
-#if 0
-	// Enable frame filtering (only data frames to our address)
-	IDECA.Iocntl(radio, dwSetPanId(0xDECA);
-	IDECA.Iocntl(radio, dwSetAddress16(addr);
-	IDECA.Iocntl(radio, dwEnableFrameFilter(DWT_FF_DATA_EN);
-
-	tx_poll_msg[MSG_SRC_IDX + 0] = (addr >> 0) & 0xff;
-	tx_poll_msg[MSG_SRC_IDX + 1] = (addr >> 8) & 0xff;
+#ifdef USE_FRAME_FILTER
+	// Enable frame filtering - only data frames on our PAN addressed to us (or
+	// broadcast) reach the host, everything else on the channel is dropped by
+	// the radio without an interrupt
+	// (if any of it fails, or there's no room to record it, the radio is left
+	// promiscuous - so it never filters without the ranger knowing)
+	byte filter =
+		IDECA.Iocntl(radio, dwSetPanId, *((wyde *)&ssRangeRequestMsg[MSG_PAN_IDX])) == 0 &&
+		IDECA.Iocntl(radio, dwSetAddress16, addr) == 0 &&
+		IDECA.Iocntl(radio, dwEnableFrameFilter, DWT_FF_DATA_EN) == 0;
+	if (!setFiltered(radio, filter))
+		{
+		IDECA.Iocntl(radio, dwDisableFrameFilter);
+		debug("no frame filter - filtering in software\n");
+		}
 #endif
 
 #ifdef USE_RANGEE
 	ssRangeeInit(radio);
+#endif
+#ifdef USE_DS_RANGEE
+	ssDsRangeeInit(radio);
 #endif
 	ssRangerInit(radio);
 	}
@@ -0,0 +1,453 @@
+/*
+ *	File: ssLocate.c
+ *
+ *	Contains: Position (multilateration) from ranges to known anchors
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+
+#include <math.h>
+
+#include "ssLocate.h"
+
+// NOTE
+// Each range d_i to anchor a_i says |p - a_i|^2 = d_i^2. Taking the first from
+// each of the others leaves equations linear in p;
+//
+//    2 (a_i - a_0) . p = |a_i|^2 - |a_0|^2 - d_i^2 + d_0^2
+//
+// so as each range is added its row goes straight into the normal equations
+// (A'A p = A'b, 3x3 at most) and nothing is kept but the range itself. That
+// linear solve is only a start - it weighs the ranges unevenly and differences
+// their errors - so it is refined by a few Gauss-Newton steps on the ranges
+// themselves (minimising the sum of (|p - a_i| - d_i)^2), which converge in two
+// or three steps from there.
+//
+// Everything is done relative to the anchors' centroid, in units of the anchor
+// span (a power of 2 mm - see ssLocateAnchors), so the numbers stay near 1;
+// that keeps float well conditioned and lets the fixed point build work in Q16
+// (1mm resolution for anchors spread over 64m). In 2D the height is known, and
+// its part of each equation moves to the right hand side.
+//
+// Anchors all at one height (on a ceiling, say) leave 3D height ambiguous - a
+// tag is as well above them as below. The linear solve then fails, and the
+// refinement starts a metre below them. Anchors only a little apart in height
+// are nearly as bad; the linear solve's height is then mostly noise, and lands
+// the refinement on either side. So a solution above the anchors is refined
+// again from its mirror below them, and that is taken only if it fits the ranges
+// no worse, to within the noise - the range noise the residual itself implies
+// (the rms residual scaled up for the ranges the fit used up - twice it, with
+// only one range to spare), or kLocateMirrorMm if that's more. Only then,
+// when the ranges can't tell them apart, does it go below - tags are usually
+// below their anchors. (From exact ranges, that leaves only true ties.) There
+// the steps also go nearly flat in height (or singular, at the anchors' height),
+// so each is damped a little (kLocDamp), which doesn't move where they settle,
+// and kept within the anchor span. (More steps don't help - from exact ranges
+// the first few settle to well under a mm wherever the anchors allow.)
+
+#define kLocateSteps	5		// Gauss-Newton steps at most
+#define kLocateDoneMm	1		// ... stopping once a step is shorter
+#define kLocateMirrorMm	3		// least noise a mirror below may fit within, and be taken (see NOTE)
+
+static ssAnchor anchors;
+static byte anchorCount;
+static Int32 origin[3];		// anchors' centroid (mm)
+static byte spanBits;		// anchor span is 2^spanBits mm
+
+#define kLocSingular	(1L << 20)	// pivots this much smaller than the largest are 0
+#define kLocDamp		16		// Gauss-Newton steps are damped by 2^-16 of each range's weight
+
+#ifdef USE_FIXED_LOCATE
+#define kLocSumBits		27		// normal equations are scaled to under 2^27
+#define locMul(a, b)	((locReal)(((Int64)(a) * (b)) >> 16))
+#define locDiv(a, b)	((locReal)(((Int64)(a) << 16) / (b)))
+#define locMulDiv(a, b, c)	((locReal)((Int64)(a) * (b) / (c)))
+#define locAbs(a)		((a) < 0 ? -(a) : (a))
+
+// Sums of products (the normal equations) are kept whole (Q32), then all scaled
+// by one power of 2 to fit (see locScale) - a 1/8 slope times a few mm of
+// residual would be nothing in Q16, and nor would what's left of the height
+// terms once anchors spread mostly across are eliminated. (Scaling both sides
+// leaves the solution be.)
+#define locSumMul(a, b)	((Int64)(a) * (b))
+#define locSumOne		((locSum)1 << 32)
+
+static UInt32 isqrt64(UInt64 n)
+	{
+	// a digit (bit pair) at a time
+	UInt64 root = 0, bit = (UInt64)1 << 62;
+	while (bit > n)
+		bit >>= 2;
+	while (bit)
+		{
+		if (n >= root + bit)
+			{
+			n -= root + bit;
+			root = (root >> 1) + bit;
+			}
+		else
+			root >>= 1;
+		bit >>= 2;
+		}
+	return (UInt32)root;
+	}
+
+// sqrt(a / 2^16) * 2^16 = sqrt(a * 2^16)
+#define locSqrt(a)		((locReal)isqrt64((UInt64)((a) > 0 ? (a) : 0) << 16))
+
+// |u| - the squares are kept whole (Q32), as small components would vanish in Q16
+#define locLen(u)		((locReal)isqrt64((UInt64)((Int64)(u)[0] * (u)[0] + (Int64)(u)[1] * (u)[1] + (Int64)(u)[2] * (u)[2])))
+
+static locReal locFromMm(Int32 mm)
+	{
+	return (locReal)(((Int64)mm << 16) >> spanBits);
+	}
+
+static Int32 locToMm(locReal v)
+	{
+	return (Int32)((((Int64)v << spanBits) + 0x8000) >> 16);
+	}
+#else
+#define locMul(a, b)	((a) * (b))
+#define locDiv(a, b)	((a) / (b))
+#define locMulDiv(a, b, c)	((a) * (b) / (c))
+#define locAbs(a)		fabsf(a)
+#define locSumMul(a, b)	((a) * (b))
+#define locSumOne		1.0f
+#define locSqrt(a)		sqrtf((a) > 0 ? (a) : 0)
+#define locLen(u)		sqrtf((u)[0] * (u)[0] + (u)[1] * (u)[1] + (u)[2] * (u)[2])
+#define locFromMm(mm)	ldexpf((float)(mm), -spanBits)
+#define locToMm(v)		((Int32)floorf(ldexpf((v), spanBits) + 0.5f))
+#endif
+
+// set the anchor positions (the table is used in place)
+void ssLocateAnchors(ssAnchor table, byte count)
+	{
+	anchors = table;
+	anchorCount = count;
+
+	// centre on the anchors, and find their span
+	Int32 far = 0;
+	for (byte k = 0; k < 3; k++)
+		{
+		Int32 sum = 0;
+		for (byte i = 0; i < count; i++)
+			sum += (&table[i].x)[k];
+		origin[k] = count ? sum / count : 0;
+		}
+	for (byte i = 0; i < count; i++)
+		for (byte k = 0; k < 3; k++)
+			{
+			Int32 d = (&table[i].x)[k] - origin[k];
+			if (d < 0)
+				d = -d;
+			if (d > far)
+				far = d;
+			}
+	for (spanBits = 10; spanBits < 24 && ((Int32)1 << spanBits) < far; spanBits++)
+		;
+	}
+
+ssAnchor ssLocateAnchor(wyde addr)
+	{
+	ssAnchor a = anchors;
+	for (byte i = 0; i < anchorCount; i++, a++)
+		if (a->addr == addr)
+			return a;
+	return NULL;
+	}
+
+// start a solve - dims is 2 (at height zMm) or 3
+void ssLocateBegin(ssLocator loc, byte dims, Int32 zMm)
+	{
+	memset(loc, 0, sizeof(_ssLocator));
+	loc->dims = dims == 2 ? 2 : 3;
+	loc->z = locFromMm(zMm - origin[2]);
+	}
+
+// the linear equation for range i (relative to range 0) - returns the row and rhs
+static locReal locRow(ssLocator loc, byte i, locReal *row)
+	{
+	locReal *a = loc->a[i], *a0 = loc->a[0];
+	locReal b = locMul(loc->d[0], loc->d[0]) - locMul(loc->d[i], loc->d[i]);
+	for (byte k = 0; k < 3; k++)
+		{
+		row[k] = 2 * (a[k] - a0[k]);
+		b += locMul(a[k], a[k]) - locMul(a0[k], a0[k]);
+		}
+	if (loc->dims == 2)
+		b -= locMul(row[2], loc->z);
+	return b;
+	}
+
+// add a range (its rangee must be a known anchor) - returns 0 if it can't be used
+byte ssLocateAdd(ssLocator loc, ssRangeData range)
+	{
+	ssAnchor anchor = ssLocateAnchor(range->rangee);
+	if (!anchor || range->mm <= 0 || loc->count == kLocateRanges)
+		return 0;
+
+	byte i = loc->count++;
+	loc->a[i][0] = locFromMm(anchor->x - origin[0]);
+	loc->a[i][1] = locFromMm(anchor->y - origin[1]);
+	loc->a[i][2] = locFromMm(anchor->z - origin[2]);
+	loc->d[i] = locFromMm(range->mm);
+	if (!i)
+		return 1;
+
+	locReal row[3], b = locRow(loc, i, row);
+	for (byte r = 0; r < 3; r++)
+		{
+		for (byte c = 0; c < 3; c++)
+			loc->ata[r][c] += locSumMul(row[r], row[c]);
+		loc->atb[r] += locSumMul(row[r], b);
+		}
+	return 1;
+	}
+
+// normal equations from their sums
+static void locScale(locSum ms[3][3], locSum *vs, locReal m[3][3], locReal *v)
+	{
+	byte r, c;
+#ifdef USE_FIXED_LOCATE
+	UInt64 big = 0;
+	byte shift = 0;
+	for (r = 0; r < 3; r++)
+		{
+		for (c = 0; c < 3; c++)
+			big |= ms[r][c] < 0 ? -ms[r][c] : ms[r][c];
+		big |= vs[r] < 0 ? -vs[r] : vs[r];
+		}
+	while (big >> shift >= (UInt64)1 << kLocSumBits)
+		shift++;
+#endif
+	for (r = 0; r < 3; r++)
+		{
+#ifdef USE_FIXED_LOCATE
+		for (c = 0; c < 3; c++)
+			m[r][c] = (locReal)(ms[r][c] >> shift);
+		v[r] = (locReal)(vs[r] >> shift);
+#else
+		for (c = 0; c < 3; c++)
+			m[r][c] = ms[r][c];
+		v[r] = vs[r];
+#endif
+		}
+	}
+
+// solve m x = v (n <= 3) by elimination with partial pivoting - m & v are destroyed
+static byte locSolve(locReal m[3][3], locReal *v, byte n, locReal *x)
+	{
+	locReal big = 0;
+	for (byte c = 0; c < n; c++)
+		if (locAbs(m[c][c]) > big)
+			big = locAbs(m[c][c]);
+	for (byte c = 0; c < n; c++)
+		{
+		byte p = c;
+		for (byte r = c + 1; r < n; r++)
+			if (locAbs(m[r][c]) > locAbs(m[p][c]))
+				p = r;
+		if (locAbs(m[p][c]) <= big / kLocSingular)
+			return 0;
+		if (p != c)
+			{
+			for (byte k = 0; k < n; k++)
+				{
+				locReal t = m[c][k];
+				m[c][k] = m[p][k];
+				m[p][k] = t;
+				}
+			locReal t = v[c];
+			v[c] = v[p];
+			v[p] = t;
+			}
+		for (byte r = c + 1; r < n; r++)
+			{
+			// (not by a factor, whose rounding would swamp a small pivot)
+			for (byte k = c + 1; k < n; k++)
+				m[r][k] -= locMulDiv(m[r][c], m[c][k], m[c][c]);
+			v[r] -= locMulDiv(m[r][c], v[c], m[c][c]);
+			m[r][c] = 0;
+			}
+		}
+	for (byte c = n; c-- > 0; )
+		{
+		locReal s = v[c];
+		for (byte k = c + 1; k < n; k++)
+			s -= locMul(m[c][k], x[k]);
+		x[c] = locDiv(s, m[c][c]);
+		}
+	return 1;
+	}
+
+// the linear solve, in 2D (z as given in p[2]) if the 3D one fails
+static byte locLinear(ssLocator loc, locReal *p)
+	{
+	locReal m[3][3], v[3];
+	locScale(loc->ata, loc->atb, m, v);
+	if (locSolve(m, v, loc->dims, p))
+		return 1;
+	if (loc->dims == 2)
+		return 0;
+
+	// anchors (near enough) at one height - rebuild without z
+	locSum ms[3][3], vs[3];
+	memset(ms, 0, sizeof(ms));
+	memset(vs, 0, sizeof(vs));
+	for (byte i = 1; i < loc->count; i++)
+		{
+		locReal row[3], b = locRow(loc, i, row) - locMul(row[2], p[2]);
+		for (byte r = 0; r < 2; r++)
+			{
+			for (byte c = 0; c < 2; c++)
+				ms[r][c] += locSumMul(row[r], row[c]);
+			vs[r] += locSumMul(row[r], b);
+			}
+		}
+	locScale(ms, vs, m, v);
+	return locSolve(m, v, 2, p);
+	}
+
+// Gauss-Newton steps from p (see NOTE)
+static void locRefine(ssLocator loc, locReal *p)
+	{
+	byte n = loc->dims, i, k, step;
+	locReal span = locFromMm((Int32)1 << spanBits);
+	for (step = 0; step < kLocateSteps; step++)
+		{
+		locSum ms[3][3], vs[3];
+		locReal m[3][3], v[3], dp[3];
+		memset(ms, 0, sizeof(ms));
+		memset(vs, 0, sizeof(vs));
+		for (i = 0; i < loc->count; i++)
+			{
+			// residual, and its gradient (the unit vector from the anchor)
+			locReal u[3], len, r;
+			for (k = 0; k < 3; k++)
+				u[k] = p[k] - loc->a[i][k];
+			len = locLen(u);
+			if (locToMm(len) < 1)		// (at the anchor - no direction)
+				continue;
+			r = len - loc->d[i];
+			for (k = 0; k < n; k++)
+				u[k] = locDiv(u[k], len);
+			for (byte row = 0; row < n; row++)
+				{
+				for (byte c = 0; c < n; c++)
+					ms[row][c] += locSumMul(u[row], u[c]);
+				vs[row] += locSumMul(u[row], r);
+				}
+			}
+		for (k = 0; k < n; k++)
+			ms[k][k] += loc->count * (locSumOne / (1 << kLocDamp));
+		locScale(ms, vs, m, v);
+		if (!locSolve(m, v, n, dp))
+			break;
+		locReal moved = 0;
+		for (k = 0; k < n; k++)
+			{
+			// (no further than the anchor span at a step - a nearly flat
+			// direction would otherwise throw p miles off)
+			if (dp[k] > span)
+				dp[k] = span;
+			if (dp[k] < -span)
+				dp[k] = -span;
+			p[k] -= dp[k];
+			if (locAbs(dp[k]) > moved)
+				moved = locAbs(dp[k]);
+			}
+		if (locToMm(moved) < kLocateDoneMm)
+			break;
+		}
+	}
+
+// rms range residual at p, in mm (each counted up to 4m)
+static Int32 locRms(ssLocator loc, locReal *p)
+	{
+	UInt32 sum = 0;
+	for (byte i = 0; i < loc->count; i++)
+		{
+		locReal u[3];
+		for (byte k = 0; k < 3; k++)
+			u[k] = p[k] - loc->a[i][k];
+		Int32 e = locToMm(locLen(u) - loc->d[i]);
+		if (e < 0)
+			e = -e;
+		if (e > 4095)
+			e = 4095;
+		sum += (UInt32)(e * e);
+		}
+#ifdef USE_FIXED_LOCATE
+	return locSqrt((locReal)(sum / loc->count)) >> 8;
+#else
+	return (Int32)(sqrtf((float)sum / loc->count) + 0.5f);
+#endif
+	}
+
+// solve with the ranges added so far - returns the # used (0 if there weren't
+// enough, or the anchors can't fix a position)
+byte ssLocateSolve(ssLocator loc, ssPosition pos)
+	{
+	byte i;
+	locReal p[3], height = 0;
+	if (loc->count <= loc->dims)
+		return 0;
+
+	// a start (see NOTE - z a metre below the anchors if they can't say)
+	for (i = 0; i < loc->count; i++)
+		height += loc->a[i][2];
+	height /= loc->count;
+	p[2] = loc->dims == 2 ? loc->z : height - locFromMm(1000);
+	if (!locLinear(loc, p))
+		return 0;
+	locRefine(loc, p);
+	pos->error = locRms(loc, p);
+
+	// above the anchors, try the mirror below them too (see NOTE)
+	if (loc->dims == 3 && p[2] > height)
+		{
+		locReal q[3] = {p[0], p[1], 2 * height - p[2]};
+		locRefine(loc, q);
+		Int32 error = locRms(loc, q);
+
+		// how much worse it fits, against the noise (squared - count > 3 here)
+		Int32 worse = error - pos->error;
+		UInt32 noise = (UInt32)pos->error * (UInt32)pos->error * loc->count / (loc->count - 3);
+		if (worse <= kLocateMirrorMm || (UInt32)worse * (UInt32)worse <= noise)
+			{
+			memcpy(p, q, sizeof(p));
+			pos->error = error;
+			}
+		}
+
+	pos->x = origin[0] + locToMm(p[0]);
+	pos->y = origin[1] + locToMm(p[1]);
+	pos->z = origin[2] + locToMm(p[2]);
+	pos->ranges = loc->count;
+	return loc->count;
+	}
+
+// position from count ranges (for 2D, pos->z is the tag's height)
+// returns the # of ranges used, 0 if no position
+byte ssLocate(ssRangeData ranges, byte count, byte dims, ssPosition pos)
+	{
+	_ssLocator loc;
+	ssLocateBegin(&loc, dims, pos->z);
+	for (byte i = 0; i < count; i++)
+		ssLocateAdd(&loc, &ranges[i]);
+	return ssLocateSolve(&loc, pos);
+	}
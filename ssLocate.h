@@ -0,0 +1,81 @@
+/*
+ *	File: ssLocate.h
+ *
+ *	Contains: Position (multilateration) from ranges to known anchors
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __SSLOCATE_H
+#define __SSLOCATE_H
+
+#include "ssRange.h"
+
+// Ranges (the mm of each _ssRangeData) to anchors at known positions give the
+// tag's position, in 2D (at a known height) or 3D. Positions are in mm, in
+// whatever frame the anchors are given in.
+//
+// Built with USE_FIXED_LOCATE the solver is Q16 fixed point (needs 64 bit
+// integers, but no fpu), otherwise float.
+
+#ifndef kLocateRanges
+#define kLocateRanges 16	// most ranges in one solve
+#endif
+
+typedef struct
+	{
+	wyde addr;
+	Int32 x, y, z;		// mm
+	} _ssAnchor, *ssAnchor;
+
+typedef struct
+	{
+	Int32 x, y, z;		// mm (for 2D, z is the height given)
+	Int32 error;		// rms range residual (mm)
+	byte ranges;		// # used
+	} _ssPosition, *ssPosition;
+
+#ifdef USE_FIXED_LOCATE
+typedef Int32 locReal;	// Q16, in anchor span units (see ssLocateAnchors)
+typedef Int64 locSum;	// Q32, for sums of products
+#else
+typedef float locReal;
+typedef float locSum;
+#endif
+
+// a solve in progress - ranges are added as they arrive (see ssLocateAdd)
+typedef struct
+	{
+	byte dims;			// 2 or 3
+	byte count;			// ranges added
+	locReal z;			// 2D - the tag's height
+	locReal a[kLocateRanges][3];	// anchors
+	locReal d[kLocateRanges];		// ranges
+	locSum ata[3][3];	// normal equations of the linear system (each range less the first)
+	locSum atb[3];
+	} _ssLocator, *ssLocator;
+
+// the anchors (the table is the caller's, and must stay put)
+void ssLocateAnchors(ssAnchor anchors, byte count);
+ssAnchor ssLocateAnchor(wyde addr);
+
+// incremental
+void ssLocateBegin(ssLocator loc, byte dims, Int32 zMm);
+byte ssLocateAdd(ssLocator loc, ssRangeData range);
+byte ssLocateSolve(ssLocator loc, ssPosition pos);
+
+// all at once (for 2D, pos->z is the tag's height)
+byte ssLocate(ssRangeData ranges, byte count, byte dims, ssPosition pos);
+
+#endif
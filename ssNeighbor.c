@@ -0,0 +1,205 @@
+/*
+ *	File: ssNeighbor.c
+ *
+ *	Contains: Neighbor (peer node) table
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+
+#include "ssNeighbor.h"
+
+// NOTE
+// The table is open addressed - a node's entry is at the slot its addr hashes
+// to, or the first free one after it (linear probing) - so a lookup is a hash
+// and, while the table is no more than about 3/4 full, a probe or two, however
+// many neighbors there are. The entries are kept together (no pointers to
+// chase), and nothing else needs to know where one is.
+//
+// Removing an entry moves any that probed past it back into the gap (rather
+// than leaving a marker), so lookups never slow down as nodes come and go.
+//
+// Everything here runs in application context.
+//
+// Clock offsets
+//
+// An SS result needs the clock offset ratio between the two crystals, which the
+// radio measures on each frame (the carrier integrator) - an extra read in the
+// rx interrupt. But a pair of crystals drift apart slowly (ppb per second, with
+// temperature), so for a node we've ranged lately the last few readings predict
+// the next as well as reading it would - better in fact, as their average is
+// steadier than any one reading, and the distance with it.
+//
+// So a reading is only asked for (ssNeighborCorDue) every kCorRefresh exchanges,
+// and otherwise the average of the last kNeighborCors is used. Each reading is
+// compared with that prediction first, and the average distance between them
+// kept; should it pass kCorStrayPpb (the crystals are warming, say) every
+// exchange reads again until they settle.
+//
+// The offset is between the neighbor's crystal and the radio's, so a node
+// ranging from several radios (see ssRangerInit) keeps a history for each - by
+// ranger, in the neighbor's entry - or each radio's readings would drag the
+// others' predictions off.
+
+static _ssNeighbor neighbors[kNeighbors];
+
+// Fibonacci hash - the top bits of addr * 2^16 / golden ratio
+#define neighborHash(addr)	((byte)((wyde)((addr) * 40503U) >> (16 - kNeighborBits)))
+#define neighborNext(i)		(((i) + 1) & (kNeighbors - 1))
+
+// addr's slot, or the free one it would take (kNeighbors if it has none, and there are none)
+static byte neighborSlot(wyde addr)
+	{
+	byte i = neighborHash(addr);
+	for (byte n = 0; n < kNeighbors; n++, i = neighborNext(i))
+		if (neighbors[i].addr == addr || !neighbors[i].addr)
+			return i;
+	return kNeighbors;
+	}
+
+ssNeighbor ssNeighborOf(wyde addr)
+	{
+	byte i = neighborSlot(addr);
+	return i < kNeighbors && neighbors[i].addr ? &neighbors[i] : NULL;
+	}
+
+ssNeighbor ssNeighborAdd(wyde addr)
+	{
+	if (!addr)
+		return NULL;
+	byte i = neighborSlot(addr);
+	if (i == kNeighbors)
+		return NULL;
+	ssNeighbor n = &neighbors[i];
+	if (!n->addr)
+		{
+		memset(n, 0, sizeof(_ssNeighbor));
+		n->addr = addr;
+		}
+	return n;
+	}
+
+void ssNeighborRemove(wyde addr)
+	{
+	byte gap = neighborSlot(addr);
+	if (gap == kNeighbors || !neighbors[gap].addr)
+		return;
+
+	// close the gap with any later entry whose home slot isn't (cyclically) between it and the entry
+	byte i = neighborNext(gap);
+	for (byte n = 1; n < kNeighbors && neighbors[i].addr; n++, i = neighborNext(i))
+		{
+		byte home = neighborHash(neighbors[i].addr);
+		if (((byte)(i - home) & (kNeighbors - 1)) >= ((byte)(i - gap) & (kNeighbors - 1)))
+			{
+			neighbors[gap] = neighbors[i];
+			gap = i;
+			}
+		}
+	neighbors[gap].addr = 0;
+	}
+
+ssNeighbor ssNeighborNext(ssNeighbor n)
+	{
+	for (n = n ? n + 1 : neighbors; n < &neighbors[kNeighbors]; n++)
+		if (n->addr)
+			return n;
+	return NULL;
+	}
+
+// a result from addr
+void ssNeighborRanged(wyde addr, byte seq, Int32 mm)
+	{
+	ssNeighbor n = ssNeighborAdd(addr);
+	if (!n)
+		return;
+	n->seq = seq;
+	n->mm = mm;
+	if (n->ranged != 0xFFFF)
+		n->ranged++;
+	}
+
+// a request to addr that went unanswered (only counted once addr has an entry -
+// polls to nodes that never answer would otherwise fill the table for good)
+void ssNeighborTimeout(wyde addr)
+	{
+	ssNeighbor n = ssNeighborOf(addr);
+	if (n && n->timeouts != 0xFFFF)
+		n->timeouts++;
+	}
+
+// ppb per Q26 unit (10^9 / 2^26 = 14.9) in Q8
+#define kPpbPerCorQ8	3815L
+
+// average of the readings kept
+static Int32 corAverage(ssNeighborClock c)
+	{
+	byte count = c->cors < kNeighborCors ? c->cors : kNeighborCors;
+	Int32 sum = 0;
+	for (byte i = 0; i < count; i++)
+		sum += c->cor[i];
+	return sum / count;
+	}
+
+word ssNeighborCorPpb(ssNeighbor n, byte ranger)
+	{
+	UInt32 ppb = ((UInt32)n->clock[ranger].corStray * kPpbPerCorQ8) >> 12;
+	return ppb > 0xFFFF ? 0xFFFF : (word)ppb;
+	}
+
+byte ssNeighborCorDue(byte ranger, wyde addr)
+	{
+	ssNeighbor n = ssNeighborOf(addr);
+	if (!n)
+		return 1;
+	ssNeighborClock c = &n->clock[ranger];
+	return c->cors < 2 || c->corAge >= kCorRefresh - 1 || ssNeighborCorPpb(n, ranger) > kCorStrayPpb;
+	}
+
+Int32 ssNeighborCorRead(byte ranger, wyde addr, Int32 corQ26)
+	{
+	ssNeighbor n = ssNeighborAdd(addr);
+	if (!n)
+		return corQ26;
+	ssNeighborClock c = &n->clock[ranger];
+
+	// how far off the prediction was (the first two only start the average)
+	if (c->cors >= 2)
+		{
+		Int32 d = corQ26 - corAverage(c);
+		UInt32 stray = (UInt32)(d < 0 ? -d : d) << 4;
+		if (stray > 0xFFFF)
+			stray = 0xFFFF;
+		c->corStray = (word)(c->corStray + ((Int32)stray - (Int32)c->corStray) / 4);
+		}
+	c->cor[c->corNext] = corQ26;
+	c->corNext = (c->corNext + 1) % kNeighborCors;
+	if (c->cors != 0xFF)
+		c->cors++;
+	c->corAge = 0;
+	return corAverage(c);
+	}
+
+byte ssNeighborCorPredict(byte ranger, wyde addr, Int32 *corQ26)
+	{
+	ssNeighbor n = ssNeighborOf(addr);
+	if (!n || !n->clock[ranger].cors)
+		return 0;
+	ssNeighborClock c = &n->clock[ranger];
+	if (c->corAge != 0xFF)
+		c->corAge++;
+	*corQ26 = corAverage(c);
+	return 1;
+	}
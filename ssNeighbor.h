@@ -0,0 +1,95 @@
+/*
+ *	File: ssNeighbor.h
+ *
+ *	Contains: Neighbor (peer node) table definitions
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __SSNEIGHBOR_H
+#define __SSNEIGHBOR_H
+
+#include "ssRange.h"
+
+// Everything known about each node we range to - how to range to it (see
+// ssRangeConfig & ssRangeMode) and how that has been going - found by addr in
+// constant time (see ssNeighbor.c). The ranger adds every node that answers,
+// and every target given its own settings, while there is room - but not one
+// that has only ever timed out.
+
+#ifndef kNeighbors
+#define kNeighborBits	5
+#define kNeighbors		(1 << kNeighborBits)	// table size (power of 2)
+#endif
+#define kNeighborCors	4		// clock offsets kept
+#ifndef kCorRefresh
+#define kCorRefresh		8		// exchanges between clock offset reads (at most)
+#endif
+#ifndef kCorStrayPpb
+#define kCorStrayPpb	150		// ... or read each time while they stray this far from the prediction
+#endif
+
+// the clock offset history, as one of our radios sees a neighbor (each has its own crystal)
+typedef struct
+	{
+	byte cors;			// clock offsets read (kept up to kNeighborCors)
+	byte corNext;		// ... the oldest (once there are kNeighborCors)
+	Int32 cor[kNeighborCors];	// clock offset ratios (Q26)
+	byte corAge;		// exchanges since the last read
+	word corStray;		// readings' distance from the prediction (average, Q26 * 16)
+	} _ssNeighborClock, *ssNeighborClock;
+
+typedef struct
+	{
+	wyde addr;			// node addr (BCAST_ADDR for collections), 0 if the entry is unused
+
+	// ranging to it (0s for the defaults)
+	word timeoutMs;		// per poll
+	byte retries;
+	byte mode;			// kRangeSS or kRangeDS
+
+	// how it's been going
+	byte seq;			// last result's seq #
+	word ranged;		// results (stops at 0xFFFF)
+	word timeouts;		// requests that timed out (stops at 0xFFFF)
+	Int32 mm;			// last distance
+	_ssNeighborClock clock[kMaxRangers];	// by ranger (see ssRangerInit)
+	} _ssNeighbor, *ssNeighbor;
+
+// NULL if addr isn't in the table
+ssNeighbor ssNeighborOf(wyde addr);
+
+// addr's entry, added (with the defaults) if it has none - NULL if the table is full
+ssNeighbor ssNeighborAdd(wyde addr);
+void ssNeighborRemove(wyde addr);
+
+// every neighbor in turn - NULL for the first, NULL after the last
+ssNeighbor ssNeighborNext(ssNeighbor n);
+
+// the history (from the ranger)
+void ssNeighborRanged(wyde addr, byte seq, Int32 mm);
+void ssNeighborTimeout(wyde addr);
+
+// the clock offset ratio (Q26) of addr relative to one of our radios, given by
+// its ranger's index (0 to kMaxRangers - 1) - see ssNeighbor.c
+//    ssNeighborCorDue - 1 if the next exchange should read it
+//    ssNeighborCorRead - a reading, returns the offset to use (smoothed)
+//    ssNeighborCorPredict - the offset to use, without a reading (0 if there's no history)
+//    ssNeighborCorPpb - how far readings have strayed from their prediction
+byte ssNeighborCorDue(byte ranger, wyde addr);
+Int32 ssNeighborCorRead(byte ranger, wyde addr, Int32 corQ26);
+byte ssNeighborCorPredict(byte ranger, wyde addr, Int32 *corQ26);
+word ssNeighborCorPpb(ssNeighbor n, byte ranger);
+
+#endif
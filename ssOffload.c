@@ -0,0 +1,151 @@
+/*
+ *	File: ssOffload.c
+ *
+ *	Contains: Ranging offload - the node side
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+#include "interface/udp.h"
+
+#include "ssOffload.h"
+
+// NOTE
+// A node with no fpu (or no time) need not work out distances at all - the
+// timestamps and clock offset are everything the calculation needs, and a host
+// can do it for all of the nodes at once (see ssOffloadSolve). So each exchange
+// becomes a record of 30 bytes (40 for DS), copied as it stands - there is no
+// arithmetic here - into the datagram being built.
+//
+// A datagram goes when the next record might not fit, or kOffloadFlushMs after
+// its first record, whichever is sooner; so a busy node sends few, full
+// datagrams, and a quiet one's results are still no more than that late. Each
+// is numbered, so the host can tell how many went missing (UDP doesn't say).
+//
+// Everything here runs in application context (the ranger calls it from
+// rangeComplete). IUDP.Send copies the datagram out to the adapter before it
+// returns, so the one buffer is enough.
+
+static struct
+	{
+	UDP udp;				// (NULL if not offloading)
+	wyde seq;				// next datagram #
+	word len;				// bytes in buf so far (0 if it's empty)
+	word max;				// ... and room for
+	TIMER timer;			// flush
+	byte buf[kOffloadMaxLen];
+	} offload;
+
+void ssOffloadFlush()
+	{
+	if (!offload.len)
+		return;
+	cmStopTimer(offload.timer);
+	*((wyde *)&offload.buf[OFFLOAD_SEQ_IDX]) = offload.seq++;
+	if (offload.udp)
+		IUDP.Send(offload.udp, offload.buf, offload.len);
+	offload.len = 0;
+	}
+
+static void offloadTimerHandler(EVENT e, byte *buf, word len)
+	{
+	// running in application context, kOffloadFlushMs after a datagram's first record
+	// (the flush stops the timer until the next)
+	ssOffloadFlush();
+	}
+
+void ssOffloadInit(UDP udp)
+	{
+	if (!offload.timer)
+		{
+		objectCreate(offload.timer, kIntervalTimer, TICKS(kOffloadFlushMs));
+		OnEvent(offload.timer, (HANDLER) offloadTimerHandler);
+		}
+	ssOffloadFlush();
+	offload.udp = udp;
+	if (!udp)
+		return;
+
+	// no bigger than the adapter takes
+	int max = IUDP.Iocntl(udp, kUdpGetMaxFrameSize);
+	offload.max = max > 0 && max < kOffloadMaxLen ? (word)max : kOffloadMaxLen;
+	assert(offload.max >= sizeof_ssOffloadHdr + sizeof_ssOffloadDS);
+	}
+
+// room for a record of len bytes - NULL if not offloading
+static byte *offloadRecord(word len)
+	{
+	if (!offload.udp)
+		return NULL;
+	if (offload.len + len > offload.max)
+		ssOffloadFlush();
+	if (!offload.len)
+		{
+		offload.buf[OFFLOAD_VERSION_IDX] = kOffloadVersion;
+		offload.buf[OFFLOAD_COUNT_IDX] = 0;
+		offload.len = sizeof_ssOffloadHdr;
+		cmStartTimer(offload.timer, 0);
+		}
+	byte *rec = &offload.buf[offload.len];
+	offload.len += len;
+	offload.buf[OFFLOAD_COUNT_IDX]++;
+	return rec;
+	}
+
+// the addresses and seq # from the frame
+static void offloadHeader(byte *rec, byte *buf, byte flags)
+	{
+	*((wyde *)&rec[REC_RANGER_IDX]) = *((wyde *)&buf[MSG_DST_IDX]);
+	*((wyde *)&rec[REC_RANGEE_IDX]) = *((wyde *)&buf[MSG_SRC_IDX]);
+	rec[REC_SEQ_IDX] = buf[MSG_SEQ_IDX];
+#ifdef CC8051
+	// (our timestamps are only 32 bits, see dwTime.h)
+	flags |= kOffload32;
+#endif
+	rec[REC_FLAGS_IDX] = flags;
+	}
+
+void ssOffloadSS(byte *buf, dwTime t1, dwTime t2, dwTime t3, dwTime t4, Int32 corQ26, byte flags)
+	{
+	byte *rec = offloadRecord(sizeof_ssOffloadSS);
+	if (!rec)
+		return;
+	offloadHeader(rec, buf, flags & ~kOffloadDS);
+	dwTimePut(&rec[REC_T1_IDX], t1);
+	dwTimePut(&rec[REC_T2_IDX], t2);
+	dwTimePut(&rec[REC_T3_IDX], t3);
+	dwTimePut(&rec[REC_T4_IDX], t4);
+	memcpy(&rec[REC_COR_IDX], &corQ26, sizeof(Int32));
+	if (offload.len + sizeof_ssOffloadSS > offload.max)
+		// (it's full)
+		ssOffloadFlush();
+	}
+
+void ssOffloadDS(byte *buf, dwTime t1, dwTime t2, dwTime t3, dwTime t4, dwTime t5, dwTime t6)
+	{
+	byte *rec = offloadRecord(sizeof_ssOffloadDS);
+	if (!rec)
+		return;
+	offloadHeader(rec, buf, kOffloadDS);
+	dwTimePut(&rec[REC_T1_IDX], t1);
+	dwTimePut(&rec[REC_T2_IDX], t2);
+	dwTimePut(&rec[REC_T3_IDX], t3);
+	dwTimePut(&rec[REC_T4_IDX], t4);
+	memset(&rec[REC_COR_IDX], 0, sizeof(Int32));
+	dwTimePut(&rec[REC_T5_IDX], t5);
+	dwTimePut(&rec[REC_T6_IDX], t6);
+	if (offload.len + sizeof_ssOffloadSS > offload.max)
+		ssOffloadFlush();
+	}
@@ -0,0 +1,104 @@
+/*
+ *	File: ssOffload.h
+ *
+ *	Contains: Ranging offload (raw exchange records over UDP) definitions
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __SSOFFLOAD_H
+#define __SSOFFLOAD_H
+
+#include "interface/udp.h"
+#include "ssRange.h"
+
+// Rather than work out each distance itself, a ranger built USE_OFFLOAD (see
+// ssRanger.c) packs every exchange's timestamps into a record and streams them,
+// several to a datagram, to a host that does (see ssOffload.c).
+
+#ifndef kOffloadMaxLen
+#define kOffloadMaxLen		256		// datagram size (at most, see kUdpGetMaxFrameSize)
+#endif
+#ifndef kOffloadFlushMs
+#define kOffloadFlushMs		50		// a part filled datagram goes this long after its first record
+#endif
+
+// datagram layout (little endian) - a header, then count records back to back
+#define OFFLOAD_VERSION_IDX		0	// kOffloadVersion
+#define OFFLOAD_COUNT_IDX		1	// records
+#define OFFLOAD_SEQ_IDX			2	// wyde - datagram # (to count those lost)
+#define sizeof_ssOffloadHdr		4
+
+#define kOffloadVersion			1
+
+// record layout - the SS fields, then (kOffloadDS) the final's
+#define REC_RANGER_IDX			0	// wyde
+#define REC_RANGEE_IDX			2	// wyde
+#define REC_SEQ_IDX				4	// exchange seq #
+#define REC_FLAGS_IDX			5	// kOffloadXxx
+#define REC_T1_IDX				6	// poll tx      (ranger clock, kDwTimeLen bytes)
+#define REC_T2_IDX				11	// poll rx      (rangee clock)
+#define REC_T3_IDX				16	// response tx  (rangee clock)
+#define REC_T4_IDX				21	// response rx  (ranger clock)
+#define REC_COR_IDX				26	// Int32 - clock offset ratio (Q26, SS only)
+#define sizeof_ssOffloadSS		30
+#define REC_T5_IDX				30	// final tx     (ranger clock)
+#define REC_T6_IDX				35	// final rx     (rangee clock)
+#define sizeof_ssOffloadDS		40
+
+// record flags
+#define kOffloadDS				0x01	// double sided (t5 & t6 follow, cor is 0)
+#define kOffloadCorPredicted	0x02	// cor wasn't read with this response (see ssNeighbor.c)
+#define kOffload32				0x04	// from a 32 bit ranger (CC8051) - its own t1, t4 & t5 wrap at 2^32
+
+// a record in place (host) - rec is its first byte (see ssOffloadParse for the
+// checks a datagram needs first)
+#define recRanger(rec)		(*((wyde *)&(rec)[REC_RANGER_IDX]))
+#define recRangee(rec)		(*((wyde *)&(rec)[REC_RANGEE_IDX]))
+#define recSize(rec)		((rec)[REC_FLAGS_IDX] & kOffloadDS ? sizeof_ssOffloadDS : sizeof_ssOffloadSS)
+
+// host - later - earlier, both the ranger's own (t1, t4, t5), as it took it - a
+// 32 bit ranger's are good modulo 2^32 only, so they're masked to 32 bits (its
+// peer's, t2, t3 & t6, it cuts to 32 bits too, which dwTimePeerDelta sees)
+#define recOwnDelta(flags, later, earlier)	((flags) & kOffload32 ? \
+	(dwTime)(UInt32)((later) - (earlier)) : dwTimeDelta(later, earlier))
+
+// a record, unpacked (host)
+typedef struct
+	{
+	wyde ranger;
+	wyde rangee;
+	byte seq;
+	byte flags;			// kOffloadXxx
+	dwTime t[6];		// t1..t6 (t5 & t6 DS only)
+	Int32 cor;			// Q26
+	} _ssOffloadRecord, *ssOffloadRecord;
+
+// node - udp is open, with the host as its destination (NULL stops offloading)
+void ssOffloadInit(UDP udp);
+
+// node (from the ranger) - an exchange; buf is the response (SS) or report (DS) frame
+void ssOffloadSS(byte *buf, dwTime t1, dwTime t2, dwTime t3, dwTime t4, Int32 corQ26, byte flags);
+void ssOffloadDS(byte *buf, dwTime t1, dwTime t2, dwTime t3, dwTime t4, dwTime t5, dwTime t6);
+
+// node - send whatever is waiting now
+void ssOffloadFlush(void);
+
+// host - unpack a datagram into recs (at most max), returns the count (0 if it isn't one)
+byte ssOffloadParse(byte *data, word len, ssOffloadRecord recs, byte max);
+
+// host - distances (mm) for recs[0..n-1], as the ranger would have worked them out
+void ssOffloadSolve(ssOffloadRecord recs, word n, Int32 *mm);
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ *	File: ssOffloadSolve.c
+ *
+ *	Contains: Ranging offload - the host side
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+
+#include "ssOffload.h"
+#include "ssTof.h"
+#include "ssTofBatch.h"
+
+// NOTE
+// The host end of ssOffload.c - unpack each datagram's records, then work out
+// their distances all together, with the same calculations the ranger would
+// have made (ssTofDistance / ssDsTofDistance), so a result is the same wherever
+// it was worked out. The fields are little endian, as the nodes (and the hosts
+// this runs on) are. So too the deltas - a 32 bit ranger's (kOffload32) and
+// a 32 bit peer's are taken modulo 2^32 (recOwnDelta, dwTimePeerDelta).
+//
+// The SS records (most of them) are gathered kSolveBatch at a time into
+// structure-of-arrays form and solved with ssTofBatchDistance, a vector's
+// worth to an instruction - within kTofBatchErrorM of ssTofDistance (so a mm
+// result may, just occasionally, round the other way).
+
+#define kSolveBatch		64
+
+byte ssOffloadParse(byte *data, word len, ssOffloadRecord recs, byte max)
+	{
+	if (len < sizeof_ssOffloadHdr || data[OFFLOAD_VERSION_IDX] != kOffloadVersion)
+		return 0;
+	byte count = data[OFFLOAD_COUNT_IDX], n;
+	word at = sizeof_ssOffloadHdr;
+	for (n = 0; n < count && n < max; n++, recs++)
+		{
+		byte *rec = &data[at];
+		if (at + sizeof_ssOffloadSS > len)
+			// (cut short)
+			break;
+		recs->flags = rec[REC_FLAGS_IDX];
+		word size = recs->flags & kOffloadDS ? sizeof_ssOffloadDS : sizeof_ssOffloadSS;
+		if (at + size > len)
+			break;
+		recs->ranger = *((wyde *)&rec[REC_RANGER_IDX]);
+		recs->rangee = *((wyde *)&rec[REC_RANGEE_IDX]);
+		recs->seq = rec[REC_SEQ_IDX];
+		dwTimeGet(recs->t[0], &rec[REC_T1_IDX]);
+		dwTimeGet(recs->t[1], &rec[REC_T2_IDX]);
+		dwTimeGet(recs->t[2], &rec[REC_T3_IDX]);
+		dwTimeGet(recs->t[3], &rec[REC_T4_IDX]);
+		memcpy(&recs->cor, &rec[REC_COR_IDX], sizeof(Int32));
+		if (recs->flags & kOffloadDS)
+			{
+			dwTimeGet(recs->t[4], &rec[REC_T5_IDX]);
+			dwTimeGet(recs->t[5], &rec[REC_T6_IDX]);
+			}
+		else
+			recs->t[4] = recs->t[5] = 0;
+		at += size;
+		}
+	return n;
+	}
+
+// the SS records gathered so far
+typedef struct
+	{
+	word n;
+	Int32 *mm[kSolveBatch];		// where each goes
+	dwTime t1[kSolveBatch], t2[kSolveBatch], t3[kSolveBatch], t4[kSolveBatch];
+	Int32 cor[kSolveBatch];
+	} _solveBatch, *solveBatch;
+
+static void solveBatchFlush(solveBatch b)
+	{
+	_ssTofBatch batch = {b->t1, b->t2, b->t3, b->t4, b->cor};
+	double distance[kSolveBatch];
+	ssTofBatchDistance(&batch, b->n, distance);
+	for (word i = 0; i < b->n; i++)
+		*b->mm[i] = (Int32)(distance[i] * 1000.0);
+	b->n = 0;
+	}
+
+void ssOffloadSolve(ssOffloadRecord recs, word n, Int32 *mm)
+	{
+	_solveBatch b;
+	b.n = 0;
+	for (; n; n--, recs++, mm++)
+		{
+		dwTime *t = recs->t;
+		if (recs->flags & kOffloadDS)
+			{
+			// round1 = t4 - t1, reply1 = t3 - t2, round2 = t6 - t3, reply2 = t5 - t4
+			double distance = ssDsTofDistance(recOwnDelta(recs->flags, t[3], t[0]), dwTimePeerDelta(t[2], t[1]),
+				dwTimePeerDelta(t[5], t[2]), recOwnDelta(recs->flags, t[4], t[3]));
+			*mm = (Int32)(distance * 1000.0);
+			continue;
+			}
+		// (t4 & t3 placed so the batch's own deltas come out as the ranger's)
+		b.mm[b.n] = mm;
+		b.t1[b.n] = t[0];
+		b.t2[b.n] = t[1];
+		b.t3[b.n] = t[1] + dwTimePeerDelta(t[2], t[1]);
+		b.t4[b.n] = t[0] + recOwnDelta(recs->flags, t[3], t[0]);
+		b.cor[b.n] = recs->cor;
+		if (++b.n == kSolveBatch)
+			solveBatchFlush(&b);
+		}
+	if (b.n)
+		solveBatchFlush(&b);
+	}
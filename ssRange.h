@@ -0,0 +1,198 @@
+/*
+ *	File: ssRange.h
+ *
+ *	Contains: Single Sided Decawave Ranger definitions
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __SSRANGE_H
+#define __SSRANGE_H
+
+#include "interface/dw3000.h"
+#include "dwTime.h"
+
+// ranging frame field indexes (see ssInit.c for the frame layouts)
+#define MSG_SEQ_IDX					2
+#define MSG_PAN_IDX					3
+#define MSG_DST_IDX					5
+#define MSG_SRC_IDX					7
+#define MSG_FUNC_IDX				9
+#define RESP_MSG_POLL_RX_TS_IDX		10
+#define RESP_MSG_RESP_TX_TS_IDX		15
+#define RESP_MSG_TS_LEN				kDwTimeLen
+
+#define sizeof_ssRangeRequestMsg	10
+#define sizeof_ssRangeResponsMsg	20
+
+// broadcast collection poll - a ssRangeRequestMsg with the reply slots appended
+#define POLL_MSG_SLOTS_IDX			10	// # of reply slots
+#define POLL_MSG_SLOT_WIDTH_IDX		11	// reply slot width (kCollectSlotUnitUs units)
+#define sizeof_ssRangeCollectMsg	12
+
+// double sided exchange - poll, response & final are bare headers (see ssInit.c)
+#define FUNC_DS_POLL				0xE2
+#define FUNC_DS_RESPONSE			0xE3
+#define FUNC_DS_FINAL				0xE4
+#define FUNC_DS_REPORT				0xE5
+#define REPORT_MSG_POLL_RX_TS_IDX	10
+#define REPORT_MSG_RESP_TX_TS_IDX	15
+#define REPORT_MSG_FINAL_RX_TS_IDX	20
+#define sizeof_ssDsReportMsg		25
+
+// superframe beacon (see ssTdma.c) - broadcast, with the superframe layout appended
+#define FUNC_TDMA_BEACON			0xE6
+#define BEACON_MSG_SLOTS_IDX		10	// wyde - # of slots
+#define BEACON_MSG_SLOT_US_IDX		12	// wyde - slot length (us)
+#define BEACON_MSG_FIRST_US_IDX		14	// wyde - beacon to the first slot (us)
+#define BEACON_MSG_ROUND_IDX		16	// wyde - superframe #
+#define sizeof_ssTdmaBeaconMsg		18
+
+#define kCollectSlotUnitUs	10
+#define kCollectReplyUs		500		// rangee turnaround before the first reply slot
+
+// the reply slot a rangee uses
+#define ssReplySlot(addr, slots)	((addr) % (slots))
+
+#define BCAST_ADDR	0xFFFF
+
+#ifndef kMaxRangers
+#define kMaxRangers 2	// radios that can range at once (see ssRangerInit)
+#endif
+
+// antenna delays - these should be calibrated per board!
+#ifndef TX_ANT_DLY
+#define TX_ANT_DLY	16385
+#endif
+#ifndef RX_ANT_DLY
+#define RX_ANT_DLY	16385
+#endif
+
+#ifndef SPEED_OF_LIGHT
+#define SPEED_OF_LIGHT	299702547	// m/s in air
+#endif
+
+// Ranging registers in one read
+//
+// Everything the rx interrupt handler needs from a received response, fetched in
+// a single SPI burst (RX_TIME through TX_TIME are contiguous, plus the carrier
+// integrator) rather than an Iocntl - and a transaction - per value. Drivers that
+// predate it return -1 and the ranger falls back to the separate reads.
+#ifndef dwGetRangeInfo
+#define dwGetRangeInfo	0x7F01	// (until the driver interface header defines it)
+#endif
+
+// Whole (40 bit) timestamps, into a dwTime - dwGetRxTimestamp & dwGetTxTimestamp
+// only give the low 32 bits
+#ifndef dwGetRxTime
+#define dwGetRxTime		0x7F02
+#endif
+#ifndef dwGetTxTime
+#define dwGetTxTime		0x7F03
+#endif
+
+// Send (or RangeTo) the next frame at a given device time (a dwTime *, the low 9
+// bits are ignored) rather than at once
+#ifndef dwSetDelayedTx
+#define dwSetDelayedTx	0x7F04
+#endif
+
+// The device time now, into a dwTime (to check a delayed tx isn't already late)
+#ifndef dwGetSysTime
+#define dwGetSysTime	0x7F05
+#endif
+
+#pragma pack(1)
+typedef struct
+	{
+	dwTime rxTs;	// rx timestamp
+	dwTime txTs;	// tx timestamp
+	Int32 cor;		// carrier integrator - clock offset ratio in Q26
+	} _dwRangeInfo, *dwRangeInfo;
+#pragma pack()
+
+// range details returned by ssRangeTo
+typedef struct
+	{
+	wyde ranger;	// requesting node addr
+	wyde rangee;	// responding node addr
+	byte seq;		// frame seq #
+	dwTime t1;		// poll tx       (ranger clock)
+	dwTime t2;		// poll rx       (rangee clock)
+	dwTime t3;		// response tx   (rangee clock)
+	dwTime t4;		// response rx   (ranger clock)
+	Int32 corQ26;	// clock offset ratio (rangee relative to ranger) in Q26
+	float cor;		// ... as a ratio (0 if built without USE_DISTANCE, or USE_FIXED_TOF)
+	byte corAge;	// ... exchanges since it was read (0 - with this response, see ssNeighbor.c)
+	word corPpb;	// ... and how far readings have strayed from its prediction (ppb)
+	double range;	// distance in metres (0 if built USE_FIXED_TOF)
+	Int32 mm;		// distance in millimetres
+	} _ssRangeData, *ssRangeData;
+
+// ranging request status (see ssRangeStatus)
+enum
+	{
+	kRangeIdle,		// no such request (or slot since reused)
+	kRangePending,	// poll sent, awaiting the response
+	kRangeDone,		// result is ready
+	kRangeTimeout	// no (qualified) response before the deadline
+	};
+
+// ranging exchange (see ssRangeMode)
+enum
+	{
+	kRangeSS,		// single sided - poll & response, corrected by the clock offset
+	kRangeDS		// double sided - poll, response, final & report
+	};
+
+// non zero if ssInit has the radio filtering frames by PAN & addr (see USE_FRAME_FILTER)
+byte ssFrameFiltered(RADIO radio);
+
+// ranging frames (see ssInit.c)
+extern byte ssRangeRequestMsg[];
+extern byte expectedResponse[];
+#ifdef USE_RANGEE
+extern byte ssRangeResponsMsg[];
+#endif
+
+void ssInit(RADIO radio);
+void ssRangeeInit(RADIO radio);
+void ssRangerInit(RADIO radio);
+void ssDsRangeeInit(RADIO radio);
+
+// blocking - returns when the range is complete or timed out
+void ssRangeTo(RADIO radio, wyde target, ssRangeData result);
+
+// non-blocking - several requests (on several radios) may be outstanding at once
+// requests are identified by the id returned (the seq #, plus the radio if more than one)
+int ssRangeStart(RADIO radio, wyde target, ssRangeData result);
+byte ssRangeStatus(int rid);
+byte ssRangeWait(int rid);
+
+// per target timeout (ms per poll) and retries (0 timeoutMs restores the defaults)
+byte ssRangeConfig(wyde target, word timeoutMs, byte retries);
+
+// per target exchange (kRangeSS or kRangeDS) - the result is the same either way
+byte ssRangeMode(wyde target, byte mode);
+
+// broadcast - one poll, a result from every rangee that answers
+byte ssRangeAll(RADIO radio, ssRangeData results, byte max);
+int ssRangeStartAll(RADIO radio, ssRangeData results, byte max);
+byte ssRangeCount(int rid);
+
+// event driven - done is posted (with the results and their count) on completion
+int ssRangeAsync(RADIO radio, wyde target, ssRangeData result, EVENT done);
+int ssRangeAllAsync(RADIO radio, ssRangeData results, byte max, EVENT done);
+
+#endif
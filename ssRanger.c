@@ -1,7 +1,7 @@
 /*
  *	File: ssRanger.c
  *
- *	Contains: Decawave DW3000 single sided ranger example
+ *	Contains: Decawave DW3000 single (and double) sided ranger example
  *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
  *
@@ -23,111 +23,388 @@
 #include "interface/dw3000.h"
 
 #include "ssRange.h"
+#include "frameRing.h"
+#include "ssTof.h"
+#include "timerWheel.h"
+#include "ssFrame.h"
+#include "ssFilter.h"
+#include "ssNeighbor.h"
+#include "ssOffload.h"
+
+#define USE_DISTANCE	// comment out if distance calc not required (see rangeComplete)
+//#define USE_OFFLOAD	// stream each exchange's timestamps to a host (see ssOffloadInit), usually without USE_DISTANCE
+//#define USE_RANGE_FILTER	// smooth each result as it lands (see ssFilterMode)
+//#define USE_FIXED_TOF	// integer (mm only) distance calc for mcus with no fpu (see ssTof.c)
 
-#define USE_DISTANCE	// comment out if distance calc not required (see rangeEventHandler)
+#ifdef CC8051
+#define USE_FIXED_TOF	// soft float is far too slow here (and printf has no float support)
+#endif
+
+#define kRangeTimeoutMs 500 // should not take longer than this! (default - see ssRangeConfig)
+#define kRangeTickMs 10	// deadline resolution
+#define kRangeSlots 8	// max requests in flight per radio (power of 2 - slots are indexed by seq)
+#if kMaxRangers > 2
+#error add rxReady/txDone entry points for the extra rangers (see rangerTasks)
+#endif
 
-#define kRangeTimeoutMs 500 // should not take longer than this!
+// broadcast collection (see ssRangeStartAll)
+#define kCollectSlots 16	// reply slots offered to the rangees
+#define kCollectSlotUs 250	// reply slot width (a response is ~200us on air at 6.8Mbps)
+#define kCollectWindowMs ((kCollectReplyUs + kCollectSlots * kCollectSlotUs + 999) / 1000)
 
 byte expectedResponse[] = {0x41, 0x88, 0, 0xCA, 0xDE, 'V', 'E', 'W', 'A', 0xE1};
 
-// Frame sequence number
-static byte seq;
+// NOTE
+// Everything to do with ranging from a given radio lives in its own ranger
+// (below), so a node with several radios (e.g. an anchor with a DW3000 on each
+// of two channels) can range from all of them at once. Each radio gets a ranger
+// from the pool in ssRangerInit, and every entry point finds it from the radio
+// (the API), the event (timer & rx events) or its own delegate (interrupt
+// handlers), rather than from file scope.
+//
+// A request is identified by its ranger and seq # together (see rangeId), so
+// ssRangeStatus/ssRangeWait/ssRangeCount need no radio. With a single radio the
+// request id is simply the seq #.
+
+struct _ssRanger;
+
+// Outstanding requests
+//
+// Each ranging request occupies the slot selected by its seq # until it either
+// completes or times out, so several polls (to several targets) can be in flight
+// at once. A response is matched to its request by seq # alone - there is no
+// searching - and then qualified against the slot target.
+//
+// The interrupt handler only reads slots (and records the poll tx timestamp);
+// every state transition happens in application context.
+typedef struct
+	{
+	volatile byte state;	// kRangeXxx
+	byte seq;				// request seq #
+	wyde target;			// requested rangee (or BCAST_ADDR)
+	byte retries;			// polls left to resend if the deadline passes unanswered
+	byte mode;				// kRangeSS or kRangeDS (see ssRangeMode)
+	byte stage;				// DS - kDsXxx
+	byte readCor;			// SS - read the clock offset with the response (else it's predicted)
+	_wheelTimer deadline;	// response timeout or collection window
+	volatile dwTime poll_tx_ts;
+	dwTime resp_rx_ts;		// DS only
+	volatile dwTime final_tx_ts;
+	ssRangeData result;		// caller's result buffer (may be NULL)
+	byte count, max;		// broadcast collection - results so far and room for (else 0)
+	EVENT done;				// posted on completion (may be NULL)
+	struct _ssRanger *ranger;
+	} _rangeSlot, *rangeSlot;
+
+typedef struct _ssRanger
+	{
+	RADIO radio;			// deca radio interface (NULL if this ranger is free)
+	byte index;				// in rangers[]
+	byte seq;				// next frame sequence number
+	byte pending;			// # of slots awaiting completion
+	byte infoBurst;			// driver supports dwGetRangeInfo (see ssRangerInit)
+	_rangeSlot slots[kRangeSlots];
+
+	// Received responses
+	//
+	// The interrupt handler copies each qualifying response, along with the
+	// timestamps and clock offset that go with it, into the next free record and
+	// the application drains them in batches. A burst of responses no longer
+	// overwrites the one before it in the driver's rx buffer.
+	_frameRing ring;
 
-#ifdef USE_DISTANCE	// calculate locally
-static double tof;
-static double distance;
-static Int32 rtd_init, rtd_resp;
-#endif
+	// Deadlines
+	//
+	// Every request's deadline (and any others the ranging layer needs) lives on
+	// one timer wheel, ticked every kRangeTickMs by timer while anything is
+	// pending. Starting and cancelling a deadline costs the same however many
+	// are running.
+	_timerWheel wheel;
+	TIMER timer;
+
+	EVENT event;			// responses waiting in ring
+	DELEGATE rxReady, txDone;
+	_ssFrameTable frames;	// ranging frames we handle, by function code
+	} _ssRanger, *ssRanger;
+
+static _ssRanger rangers[kMaxRangers];
+
+#define slotOf(r, s) (&(r)->slots[(s) & (kRangeSlots - 1)])
+#define rangeId(r, s) ((int)(r)->index << 8 | (s))
+
+// Per target timeouts
+//
+// A nearby anchor answers in well under a millisecond, so waiting kRangeTimeoutMs
+// for a lost frame wastes most of a second. Targets may have their own timeout
+// (kept in their neighbor entry, see ssNeighbor.h), and may have the poll resent
+// (with the same seq #) that many times before the request times out. (They
+// apply whichever radio ranges to them; collections always wait out their window.)
+
+// DS exchange stages (see dsComplete)
+enum
+	{
+	kDsAwaitResponse,	// poll sent
+	kDsAwaitReport		// final sent
+	};
+
+static ssRanger rangerOf(RADIO radio)
+	{
+	ssRanger r = rangers;
+	for (byte i = 0; i < kMaxRangers; i++, r++)
+		if (r->radio == radio)
+			return r;
+	return NULL;
+	}
 
-static UInt32 poll_tx_ts, resp_rx_ts, poll_rx_ts, resp_tx_ts;
-static float clockOffsetRatio;
+// the slot for request id (NULL if there is no such ranger)
+static rangeSlot slotOfId(int rid)
+	{
+	byte i = (byte)(rid >> 8);
+	if (i >= kMaxRangers || !rangers[i].radio)
+		return NULL;
+	return slotOf(&rangers[i], (byte)rid);
+	}
 
-#ifdef CC8051
-// 8051 printf doesn't include float support
-// here is a simple one, with only basic format options
-char *ftoa(double value, size_t size, char *result, word precision)
-	{
-	// converts a floating point number to an ascii string
-	if (value < 0.0)
-		// in this case, negative value is illegal!
-		sys.Fatal("ftoa", __LINE__, "negative range!\n");
-	word integral = (word) value;
-	word fraction = (word) ((value - integral) * (precision));
-	strnbuf(size, result, 0, "%d.%u", integral, fraction);
-	return result;
+static void rangeDone(rangeSlot slot, byte state)
+	{
+	// running in application context
+	ssRanger r = slot->ranger;
+	timerWheelCancel(&r->wheel, &slot->deadline);
+	slot->state = state;
+	if (!--r->pending)
+		cmStopTimer(r->timer);
+
+	// tell whoever asked (see ssRangeAsync)
+	if (slot->done)
+		PostEvent(slot->done, (byte *)slot->result, slot->max ? slot->count : state == kRangeDone);
 	}
+
+static void rangeResult(ssRanger r, ssRangeData result, byte *buf, dwTime t1, dwTime t2, dwTime t3, dwTime t4,
+		Int32 corQ26, double distance, Int32 mm)
+	{
+	// if result was provided in ssRangeStart, it is filled with the range details
+	result->ranger = *((wyde*)&buf[MSG_DST_IDX]);// or NodeAddr
+	result->rangee = *((wyde*)&buf[MSG_SRC_IDX]);
+	result->seq = buf[MSG_SEQ_IDX];
+	
+	// Here we return all the details used to calculate the range plus the
+	// calculated distance. This allows any client using these details to also,
+	// optionally, verify distance
+	
+	result->t1 = t1;
+	result->t2 = t2;
+	result->t3 = t3;
+	result->t4 = t4;
+	result->corQ26 = corQ26;
+#if defined(USE_DISTANCE) && !defined(USE_FIXED_TOF)
+	result->cor = corQ26 / (float)((teta)1 << 26);
+#else
+	// (no float arithmetic at all - the host works it out, see ssOffload.c, or
+	// there is no fpu to do it with)
+	result->cor = 0.0f;
+#endif
+	result->range = distance;
+	result->mm = mm;
+
+	// how much to trust the clock offset (see ssNeighbor.c)
+	ssNeighbor n = ssNeighborOf(result->rangee);
+	result->corAge = n ? n->clock[r->index].corAge : 0;
+	result->corPpb = n ? ssNeighborCorPpb(n, r->index) : 0;
+
+#if defined(USE_RANGE_FILTER) && defined(USE_DISTANCE)
+	// distance as filtered, for rangees with a filter (the timestamps are as measured)
+	ssFilter(result);
 #endif
+	}
 
-static ssRangeData rangeResult;
-static byte rangeReady = 1;
+static void rangeFinal(rangeSlot slot);
 
-static byte timeout;
-StaticTimer(rangeTimer);
-static void rangeTimerHandler()
+// NOTE
+// A DS exchange takes two frames each way. The response (E3) only gives us T4,
+// which goes in the slot before the final (E4) goes out; the report (E5) then
+// brings the rangee's three timestamps, and with T1 & T5 (captured by
+// txDoneHandler) that is everything;
+//
+//		round1 = T4 - T1	reply1 = T3 - T2
+//		round2 = T6 - T3	reply2 = T5 - T4
+//
+// The result has the first four timestamps, as an SS result would, and the
+// clock offset worked out from the same two spans measured on each clock (the
+// poll to the final on ours, the same two frames arriving on theirs).
+static void dsComplete(frameRecord rec, rangeSlot slot)
 	{
-	timeout = 1;
-	if (rangeResult)
+	// running in application context
+	byte *buf = rec->data;
+	dwTime poll_rx_ts, resp_tx_ts, final_rx_ts;
+	double distance;
+	Int32 mm;
+
+	if (buf[MSG_FUNC_IDX] == FUNC_DS_RESPONSE)
 		{
-		// if result was provided in ssRangeTo, it is filled with (error) range details
-		memset(rangeResult, 0, sizeof(_ssRangeData));
+		if (slot->stage != kDsAwaitResponse)
+			// duplicate
+			return;
+		slot->resp_rx_ts = rec->rxTs;
+		slot->stage = kDsAwaitReport;
+		rangeFinal(slot);
+		return;
 		}
-	rangeReady = 1;
+	if (slot->stage != kDsAwaitReport)
+		return;
+
+	dwTimeGet(poll_rx_ts, &buf[REPORT_MSG_POLL_RX_TS_IDX]);
+	dwTimeGet(resp_tx_ts, &buf[REPORT_MSG_RESP_TX_TS_IDX]);
+	dwTimeGet(final_rx_ts, &buf[REPORT_MSG_FINAL_RX_TS_IDX]);
+
+#ifdef USE_DISTANCE
+	dwTime round1 = dwTimeDelta(slot->resp_rx_ts, slot->poll_tx_ts);
+	dwTime reply1 = dwTimePeerDelta(resp_tx_ts, poll_rx_ts);
+	dwTime round2 = dwTimePeerDelta(final_rx_ts, resp_tx_ts);
+	dwTime reply2 = dwTimeDelta(slot->final_tx_ts, slot->resp_rx_ts);
+
+#ifdef USE_FIXED_TOF
+	mm = ssDsTofMm(round1, reply1, round2, reply2);
+	distance = 0.0;
+#else
+	distance = ssDsTofDistance(round1, reply1, round2, reply2);
+	mm = (Int32)(distance * 1000.0);
+#endif
+#else
+	distance = 0.0;
+	mm = 0;
+#endif
+
+	wyde rangee = *((wyde *)&buf[MSG_SRC_IDX]);
+	Int32 cor = 0;
+#ifdef USE_DISTANCE
+	// (the offset measured this way is as good as a reading, so it keeps the prediction up too)
+	cor = ssDsCorQ26(round1, reply1, round2, reply2);
+	ssNeighborCorRead(slot->ranger->index, rangee, cor);
+#endif
+#ifdef USE_OFFLOAD
+	ssOffloadDS(buf, slot->poll_tx_ts, poll_rx_ts, resp_tx_ts, slot->resp_rx_ts, slot->final_tx_ts, final_rx_ts);
+#endif
+	if (slot->result)
+		rangeResult(slot->ranger, slot->result, buf, slot->poll_tx_ts, poll_rx_ts, resp_tx_ts, slot->resp_rx_ts,
+			cor, distance, mm);
+	ssNeighborRanged(rangee, buf[MSG_SEQ_IDX], mm);
+	rangeDone(slot, kRangeDone);
 	}
 
-StaticEvent(rangeEvent);
-static void rangeEventHandler(EVENT e, byte *buf, word len)
+static void rangeComplete(frameRecord rec, ssRanger r)
 	{
 	// running in application context
+	byte *buf = rec->data;
+	dwTime poll_rx_ts, resp_tx_ts;
+	double distance;
+	Int32 mm;
+
+	// match the response to its request
+	rangeSlot slot = slotOf(r, buf[MSG_SEQ_IDX]);
+	if (slot->state != kRangePending || slot->seq != buf[MSG_SEQ_IDX] ||
+			(slot->target != BCAST_ADDR && slot->target != *((wyde *)&buf[MSG_SRC_IDX])))
+		// late, duplicate or foreign response
+		// having some kind of error event for that might be useful here.
+		return;
+
+	// a response from the other kind of exchange (the mode changed mid request)
+	if ((buf[MSG_FUNC_IDX] == 0xE1) != (slot->mode == kRangeSS))
+		return;
+	if (slot->mode == kRangeDS)
+		{
+		dsComplete(rec, slot);
+		return;
+		}
+
+	// a collection fills the next result (the slot stays pending until its window closes),
+	// once per rangee - a response heard twice, or an answer to a retried poll (the
+	// same seq), is a duplicate
+	if (slot->max)
+		{
+		wyde src = *((wyde *)&buf[MSG_SRC_IDX]);
+		for (byte i = 0; i < slot->count; i++)
+			if (slot->result[i].rangee == src)
+				return;
+		}
+	ssRangeData result = slot->max ? &slot->result[slot->count++] : slot->result;
 
 	// get timestamps embedded in response message
-	memcpy(&poll_rx_ts, &buf[RESP_MSG_POLL_RX_TS_IDX], RESP_MSG_TS_LEN);
-	memcpy(&resp_tx_ts, &buf[RESP_MSG_RESP_TX_TS_IDX], RESP_MSG_TS_LEN);
+	dwTimeGet(poll_rx_ts, &buf[RESP_MSG_POLL_RX_TS_IDX]);
+	dwTimeGet(resp_tx_ts, &buf[RESP_MSG_RESP_TX_TS_IDX]);
+
+	// the clock offset - as read (smoothed), or as predicted
+	wyde rangee = *((wyde *)&buf[MSG_SRC_IDX]);
+	Int32 cor = 0;
+	if (slot->readCor)
+		cor = ssNeighborCorRead(r->index, rangee, rec->cor);
+	else
+		ssNeighborCorPredict(r->index, rangee, &cor);
 
 #ifdef USE_DISTANCE
 	// compute time of flight & distance
 
-	// clock deltas
-	rtd_init = resp_rx_ts - poll_tx_ts;
-	rtd_resp = resp_tx_ts - poll_rx_ts;
+	// clock deltas (wrap safe)
+	dwTime rtd_init = dwTimeDelta(rec->rxTs, rec->txTs);
+	dwTime rtd_resp = dwTimePeerDelta(resp_tx_ts, poll_rx_ts);
 
 	// clock offset ratio corrects for differing local and remote clock rates
-	tof = ((rtd_init - rtd_resp * (1 - clockOffsetRatio)) / 2.0) * DWT_TIME_UNITS;
-	distance = tof * SPEED_OF_LIGHT;
+#ifdef USE_FIXED_TOF
+	mm = ssTofMm(rtd_init, rtd_resp, cor);
+	distance = 0.0;
+#else
+	distance = ssTofDistance(rtd_init, rtd_resp, cor);
+	mm = (Int32)(distance * 1000.0);
+#endif
 
 #else
 	
 	// NOTE
 	// If we don't actually use the range locally, we can simply send the results
 	// of the range request to a server and have the server do the calulations
-	// (local processing may be a teeny-tiny mcu with no/slow fpu)
+	// (local processing may be a teeny-tiny mcu with no/slow fpu) - see USE_OFFLOAD
 	distance = 0.0;
+	mm = 0;
+
+#endif
 
+#ifdef USE_OFFLOAD
+	// the raw exchange, for the host to work out (see ssOffload.c)
+	ssOffloadSS(buf, rec->txTs, poll_rx_ts, resp_tx_ts, rec->rxTs, cor, slot->readCor ? 0 : kOffloadCorPredicted);
 #endif
 
 	// post results ready
-	if (rangeResult)
-		{
-		// if result was provided in ssRangeTo, it is filled with the range details
-		ssRangeData result = rangeResult;
-
-		result->ranger = *((word*)&buf[MSG_DST_IDX]);// or NodeAddr
-		result->rangee = *((word*)&buf[MSG_SRC_IDX]);
-		result->seq = buf[MSG_SEQ_IDX];
-		
-		// Here we return all the details used to calculate the range plus the
-		// calculated distance. This allows any client using these details to also,
-		// optionally, verify distance
-		
-		result->t1 = poll_tx_ts;
-		result->t2 = poll_rx_ts;
-		result->t3 = resp_tx_ts;
-		result->t4 = resp_rx_ts;
-		result->cor = clockOffsetRatio;
-		result->range = distance;
-		}
+	if (result)
+		rangeResult(r, result, buf, rec->txTs, poll_rx_ts, resp_tx_ts, rec->rxTs, cor, distance, mm);
+	ssNeighborRanged(rangee, buf[MSG_SEQ_IDX], mm);
+
+	// range completed (or collection full)
+	if (slot->count == slot->max)
+		rangeDone(slot, kRangeDone);
+	}
+
+static void rangeTimerHandler(EVENT e, byte *buf, word len)
+	{
+	// running in application context, every kRangeTickMs while ranging
+	ssRanger r = rangers;
+	for (byte i = 0; i < kMaxRangers; i++, r++)
+		if ((EVENT)r->timer == e)
+			{
+			// anything already received is not late
+			frameRingDrain(&r->ring, (FRAMEHANDLER) rangeComplete, r, 0);
 
-	// range completed
-	rangeReady = 1;
+			timerWheelTick(&r->wheel);
+			return;
+			}
+	}
+
+static void rangeEventHandler(EVENT e, ssRanger r, word len)
+	{
+	// running in application context
+	// (posted with the ranger as buf, see responseRx)
+
+	// Several responses may have landed before we get to run (only the first
+	// posts the event), so take everything that is waiting.
+	frameRingDrain(&r->ring, (FRAMEHANDLER) rangeComplete, r, 0);
 	}
 
 // NOTE
@@ -135,13 +412,98 @@ static void rangeEventHandler(EVENT e, byte *buf, word len)
 // We could have blended ssRanger and ssRangee, but having them separate makes
 // it simpler to have the choice of which parts to include in any given node.
 
-static RADIO dwRadio;// deca radio interface (should be passed to the handler via delegate)
+// b) Ranging response frame coming from a 'rangee' in response to our range request
+static void responseRx(byte *buf, word len, ssRanger r)
+	{
+	// running in the interrupt handler!! (from rxReadyHandler)
+	if (len != sizeof_ssRangeResponsMsg)
+		return;
 
-StaticDelegate(rxReady);
-static void rxReadyHandler(byte *buf, word len)
+	frameRecord rec = frameRingReserve(&r->ring);
+	if (!rec)
+		// the application is behind - dropped (counted in ring.drops)
+		return;
+
+	// Retrieve response reception timestamp (poll transmission was captured in txDoneHandler).
+	//    The whole 40-bit time-stamp is kept (see dwTime.h), so the poll and response may be up to ~17s apart
+	//    rather than the ~67ms a 32-bit subtraction allows.
+	//
+	// Read carrier integrator value and calculate clock offset ratio.
+	//    The use of the clock offset value to correct the TOF calculation, significantly improves the result of the
+	//    SS-TWR where the remote responder unit's clock is a number of PPM offset from the local initiator unit's clock.
+	//    As stated elsewhere a fixed offset in range will be seen unless the antenna delay is calibrated and set correctly.
+	//    The ratio is kept as read (ie. in Q26) and only scaled in application context - and is only read every
+	//    few exchanges with a given rangee, being predicted from the last few readings in between (see ssNeighbor.c).
+	DWIFACE IDECA = *((DWIFACE *)typeof(r->radio)->jumps);
+	
+	rangeSlot slot = slotOf(r, buf[MSG_SEQ_IDX]);
+	rec->txTs = slot->poll_tx_ts;
+	if (!slot->readCor)
+		{
+		// the clock offset is predicted (see ssNeighbor.c) - just the time
+		IDECA.Iocntl(r->radio, dwGetRxTime, &rec->rxTs);
+		rec->cor = 0;
+		}
+	else if (r->infoBurst)
+		{
+		// both in one SPI transaction
+		_dwRangeInfo info;
+		IDECA.Iocntl(r->radio, dwGetRangeInfo, &info);
+		rec->rxTs = info.rxTs;
+		rec->cor = info.cor;
+		}
+	else
+		{
+		float offset;
+		IDECA.Iocntl(r->radio, dwGetRxTime, &rec->rxTs);
+		IDECA.Iocntl(r->radio, dwGetClockOffset, &offset);
+		rec->cor = (Int32)offset;
+		}
+
+	// copy the frame - the next one will overwrite buf
+	rec->rssi =
+	rec->corr = 0;
+	rec->len = len;
+	memcpy(rec->data, buf, len);
+
+	// post the ranger's event (pass up to the application) if it isn't already pending
+	if (frameRingCommit(&r->ring))
+		PostEvent(r->event, (byte *)r, 0);
+	}
+
+// DS response (E3) or report (E5) coming from a 'rangee'
+static void dsRx(byte *buf, word len, ssRanger r)
+	{
+	// running in the interrupt handler!! (from rxReadyHandler)
+	if (len != (buf[MSG_FUNC_IDX] == FUNC_DS_REPORT ? sizeof_ssDsReportMsg : sizeof_ssRangeRequestMsg))
+		return;
+
+	frameRecord rec = frameRingReserve(&r->ring);
+	if (!rec)
+		return;
+
+	// only the response's arrival time (T4) is needed - no clock offset, and the
+	// report carries its timestamps in the frame
+	if (buf[MSG_FUNC_IDX] == FUNC_DS_RESPONSE)
+		{
+		DWIFACE IDECA = *((DWIFACE *)typeof(r->radio)->jumps);
+		IDECA.Iocntl(r->radio, dwGetRxTime, &rec->rxTs);
+		}
+	rec->txTs = 0;
+	rec->cor = 0;
+	rec->rssi =
+	rec->corr = 0;
+	rec->len = len;
+	memcpy(rec->data, buf, len);
+
+	if (frameRingCommit(&r->ring))
+		PostEvent(r->event, (byte *)r, 0);
+	}
+
+static void rxReadyHandler(ssRanger r, byte *buf, word len)
 	{
 	// running in the interrupt handler!!
-	// called each time the a frame is recieved (while ranging - set up in ssRangTo below)
+	// called each time the a frame is recieved (while ranging - set up in ssRangeStart below)
 
 	// This callback is so the frame can be qualified in relation protocol parsing
 	// and then forwarded (and possibly queued) to the application for further
@@ -163,140 +525,422 @@ static void rxReadyHandler(byte *buf, word len)
 	// here, we are only interested in b) Ranging response frames
 
 	// NOTE
-	// For this example, there is an implicit assumtion that we are ranging between
-	// just two nodes. This allows us to test our expected response message (defined
-	// above) against the incoming message (buf) to see if it is in fact, the response
-	// message destined for us.
+	// Any given incoming message must be/have been;
+	//		1) in fact, a ssRangeResponse frame (E1)
+	//		2) destined for us (destination address matches our NodeAddress, or broadcast)
+	//		3) in response to a request still in flight (the seq # selects the slot)
+	//		4) sent by the node we requested ssRangeStart from (check source address)
 	//
-	// A multi-node system whould need to check that any given incomming message
-	// is/was;
-	//		1) destined for us (destination address matches our NodeAddress)
-	//		2) sent by the node we requested ssRangeTo (check source address)
-	//    3) in fact, a ssRangeResponse rframe (E1)
+	// 1) and 2) are checked by ssFrameDispatch (which hands E1 frames to
+	// responseRx, and DS frames to dsRx) - or by the radio, in the case of 2), if it is filtering frames
+	// (see USE_FRAME_FILTER in ssInit.c) - 3) and 4) by the application in
+	// rangeComplete.
 	//
-	// This could be done in the same way, except that the expected response message
-	// would also be updated with the anticipated rangee address in ssRangeTo() for
-	// each ranging request (see below where expectedResponseMsg seq is set).
-	
-	// qualify the frame type
-	if (memcmp(buf, expectedResponse, sizeof_ssRangeRequestMsg) == 0 ||
-			(len == sizeof_ssRangeResponsMsg &&
-			(*((wyde *)&buf[MSG_DST_IDX]) == ((Dw3000)dwRadio)->addr || *((wyde *)&buf[MSG_DST_IDX]) == 0xFFFF) &&
-			buf[9] == 0xE1))
+	// Anything else is ignored here - some other handler will process
+	ssFrameDispatch(&r->frames, buf, len);
+	}
+
+static void txDoneHandler(ssRanger r, byte *frame, word len)
+	{
+	// running in the interrupt handler!!
+	// called each time a frame is sent
+
+	// With several polls in flight, the radio's tx timestamp only ever holds the
+	// most recent one, so each poll's timestamp is captured as it goes out (and
+	// for DS, each final's).
+	byte func = frame[MSG_FUNC_IDX];
+	if ((len == sizeof_ssRangeRequestMsg || len == sizeof_ssRangeCollectMsg) &&
+			(func == 0xE0 || func == FUNC_DS_POLL || func == FUNC_DS_FINAL))
 		{
-		// b) Ranging response frame coming from a 'rangee' in response to our range request)
-		//
-		// Retrieve poll transmission and response reception timestamps.
-		//    The high order byte of each 40-bit time-stamps is discarded here. This is acceptable as, on each device, those
-		//    time-stamps are not separated by more than 2**32 device time units (which is around 67 ms) which means that the
-		//    calculation of the round-trip delays can be handled by a 32-bit subtraction.
-		DWIFACE IDECA = *((DWIFACE *)typeof(dwRadio)->jumps);
-		
-		IDECA.Iocntl(dwRadio, dwGetTxTimestamp, &poll_tx_ts);
-		IDECA.Iocntl(dwRadio, dwGetRxTimestamp, &resp_rx_ts);
-
-		// Read carrier integrator value and calculate clock offset ratio.
-		//    The use of the clock offset value to correct the TOF calculation, significantly improves the result of the
-		//    SS-TWR where the remote responder unit's clock is a number of PPM offset from the local initiator unit's clock.
-		//    As stated elsewhere a fixed offset in range will be seen unless the antenna delay is calibrated and set correctly.
-		float offset;
-		IDECA.Iocntl(dwRadio, dwGetClockOffset, &offset);
-		clockOffsetRatio = offset / ((teta)1 << 26);
+		rangeSlot slot = slotOf(r, frame[MSG_SEQ_IDX]);
+		if (slot->state == kRangePending && slot->seq == frame[MSG_SEQ_IDX])
+			{
+			DWIFACE IDECA = *((DWIFACE *)typeof(r->radio)->jumps);
+			IDECA.Iocntl(r->radio, dwGetTxTime, func == FUNC_DS_FINAL ? &slot->final_tx_ts : &slot->poll_tx_ts);
+			}
+		}
+	}
 
-		// post the rxEvent (pass up to the application)
- 		PostEvent(rangeEvent, buf, len);
-		return;
+// Delegates are called with just the frame, so each ranger has its own pair of
+// entry points that hand on the frame along with the ranger it belongs to.
+static void rxReady0(byte *buf, word len)	{ rxReadyHandler(&rangers[0], buf, len); }
+static void txDone0(byte *frame, word len)	{ txDoneHandler(&rangers[0], frame, len); }
+#if kMaxRangers > 1
+static void rxReady1(byte *buf, word len)	{ rxReadyHandler(&rangers[1], buf, len); }
+static void txDone1(byte *frame, word len)	{ txDoneHandler(&rangers[1], frame, len); }
+#endif
+
+static const struct
+	{
+	void (*rxReady)(byte *buf, word len);
+	void (*txDone)(byte *frame, word len);
+	} rangerTasks[kMaxRangers] =
+	{
+	{rxReady0, txDone0},
+#if kMaxRangers > 1
+	{rxReady1, txDone1},
+#endif
+	};
+
+// deadline in kRangeTickMs ticks
+static word rangeTicks(rangeSlot slot)
+	{
+	if (slot->max)
+		// the window, plus a tick as we may be part way through the current one
+		return (kCollectWindowMs + kRangeTickMs - 1) / kRangeTickMs + 1;
+
+	ssNeighbor t = ssNeighborOf(slot->target);
+	return ((t && t->timeoutMs ? t->timeoutMs : kRangeTimeoutMs) + kRangeTickMs - 1) / kRangeTickMs;
+	}
+
+// each frame is built from the template (several radios may be sending at once)
+static void rangeFrame(rangeSlot slot, byte *frame, byte func)
+	{
+	memcpy(frame, ssRangeRequestMsg, sizeof_ssRangeRequestMsg);
+
+	// set the target addr, seq # & function - from the radio's own addr (two
+	// radios with one addr would take each other's responses, see ssRangerInit)
+	//debug("target=%04x\n", slot->target);
+	*((wyde *)&frame[MSG_DST_IDX]) = slot->target;
+	*((wyde *)&frame[MSG_SRC_IDX]) = ((Dw3000)slot->ranger->radio)->addr;
+	frame[MSG_SEQ_IDX] = slot->seq;
+	frame[MSG_FUNC_IDX] = func;
+	}
+
+static void rangeSend(rangeSlot slot)
+	{
+	ssRanger r = slot->ranger;
+	DWIFACE IDECA = *((DWIFACE *)typeof(r->radio)->jumps);
+
+	byte poll[sizeof_ssRangeCollectMsg];
+	rangeFrame(slot, poll, slot->mode == kRangeDS ? FUNC_DS_POLL : 0xE0);
+	slot->stage = kDsAwaitResponse;
+
+	// (re)start the deadline
+	timerWheelAdd(&r->wheel, &slot->deadline, rangeTicks(slot));
+
+	// start ranging
+	if (slot->max)
+		{
+		// offer the rangees kCollectSlots reply slots (each picks one from its addr)
+		poll[POLL_MSG_SLOTS_IDX] = kCollectSlots;
+		poll[POLL_MSG_SLOT_WIDTH_IDX] = kCollectSlotUs / kCollectSlotUnitUs;
+		IDECA.RangeTo(r->radio, poll, sizeof_ssRangeCollectMsg);
 		}
-	// note; this ignores frames destined for us but with the wrong seq #
-	// having some kind of error event for that might be useful here.
-	// or we can change the test to capture them and test the seq separatly
-	// or, options abound...
+	else
+		IDECA.RangeTo(r->radio, poll, sizeof_ssRangeRequestMsg);
+	}
 
-	// default is ignored - some other handler will process
+// DS - answer the response with the final (the deadline still covers the whole exchange)
+static void rangeFinal(rangeSlot slot)
+	{
+	ssRanger r = slot->ranger;
+	DWIFACE IDECA = *((DWIFACE *)typeof(r->radio)->jumps);
+
+	byte final[sizeof_ssRangeRequestMsg];
+	rangeFrame(slot, final, FUNC_DS_FINAL);
+	IDECA.RangeTo(r->radio, final, sizeof_ssRangeRequestMsg);
 	}
 
-// send a ranging request to target and put the result in the provided buffer
-void ssRangeTo(RADIO radio, wyde target, ssRangeData result)
+static void rangeDeadline(wheelTimer deadline, rangeSlot slot)
+	{
+	// running in application context (from rangeTimerHandler)
+	if (slot->count)
+		{
+		// collection window closed
+		rangeDone(slot, kRangeDone);
+		return;
+		}
+	if (slot->retries)
+		{
+		// try again - a late answer to the last poll would now be matched against
+		// the new poll's tx timestamp, so retries only suit timeouts well beyond
+		// the rangee's reply time
+		slot->retries--;
+		rangeSend(slot);
+		return;
+		}
+	if (slot->result)
+		{
+		// if result was provided in ssRangeStart, it is filled with (error) range details
+		memset(slot->result, 0, sizeof(_ssRangeData));
+		}
+	if (slot->target != BCAST_ADDR)
+		ssNeighborTimeout(slot->target);
+	rangeDone(slot, kRangeTimeout);
+	}
+
+static int rangeStart(RADIO radio, wyde target, ssRangeData result, byte max, EVENT done)
 	{
 	// trust but verify
-	assert(radio == dwRadio);
-	DWIFACE IDECA = *((DWIFACE *)typeof(radio)->jumps);
+	ssRanger r = rangerOf(radio);
+	assert(r);
 
-	if (!rangeReady)
+	// find the next free slot (skipping seq #s whose slots are still busy)
+	rangeSlot slot;
+	byte i;
+	for (i = 0; i < kRangeSlots; i++, r->seq++)
 		{
-		debug("Ranging already in progress\n");
-		return;
+		slot = slotOf(r, r->seq);
+		if (slot->state != kRangePending)
+			break;
+		}
+	if (i == kRangeSlots)
+		{
+		debug("Too many ranging requests in progress\n");
+		return -1;
 		}
-	
-	// set the target addr
-	//debug("target=%04x\n", target);
-	*((wyde *)&ssRangeRequestMsg[MSG_DST_IDX]) =
-	*((wyde *)&expectedResponse[MSG_SRC_IDX]) = target;
-	
-	// set & increment the seq #
-	expectedResponse[MSG_SEQ_IDX] =
-	ssRangeRequestMsg[MSG_SEQ_IDX] = seq++;
 
 	// reset state details
-	timeout =
-	rangeReady = 0;
-	rangeResult = result;
+	// (the slot must be pending before the poll goes out - the response can beat us back)
+	ssNeighbor t = ssNeighborOf(target);
+	slot->seq = r->seq++;
+	slot->target = target;
+	slot->result = result;
+	slot->count = 0;
+	slot->max = max;
+	slot->done = done;
+	slot->retries = t ? t->retries : 0;
+	slot->mode = t && !max ? t->mode : kRangeSS;	// collections are always SS
+	slot->readCor = max || ssNeighborCorDue(r->index, target);
+	slot->state = kRangePending;
+	if (!r->pending++)
+		cmStartTimer(r->timer, 0);
+
+	rangeSend(slot);
+	return rangeId(r, slot->seq);
+	}
 
-	// start ranging
-	IDECA.RangeTo(radio, ssRangeRequestMsg, sizeof_ssRangeRequestMsg);
-	cmStartTimer(rangeTimer, 0);
+// set the timeout (per poll) and # of retries for requests to target
+// (BCAST_ADDR sets the retries for collections - their timeout is the window)
+// a timeoutMs of 0 restores the defaults (kRangeTimeoutMs, no retries)
+// returns 0 if there is no room for another target
+byte ssRangeConfig(wyde target, word timeoutMs, byte retries)
+	{
+	ssNeighbor t = timeoutMs ? ssNeighborAdd(target) : ssNeighborOf(target);
+	if (!t)
+		return !timeoutMs;
+	t->timeoutMs = timeoutMs;
+	t->retries = timeoutMs ? retries : 0;
+	return 1;
+	}
 
-	// await the response
-	while (!(timeout || rangeReady))
+// NOTE
+// SS-TWR takes two frames, but needs the clock offset read as the response
+// arrives and a rangee that answers at a fixed (and short) delay - the error
+// grows with the reply time times the uncorrected drift. DS-TWR takes four
+// frames (see ssInit.c) and needs neither; the rangee (see ssDsRangee.c) may
+// answer whenever it likes, from application context, and the drift cancels.
+//
+// Either way the request, its deadline & retries and the result are the same.
+// Collections are always SS (the replies are already slotted).
+
+// set the exchange (kRangeSS or kRangeDS) used for requests to target
+// takes effect from the next request - returns 0 if there is no room for another target
+byte ssRangeMode(wyde target, byte mode)
+	{
+	if (target == BCAST_ADDR)
+		return mode == kRangeSS;
+	ssNeighbor t = mode != kRangeSS ? ssNeighborAdd(target) : ssNeighborOf(target);
+	if (!t)
+		return mode == kRangeSS;
+	t->mode = mode;
+	return 1;
+	}
+
+// send a ranging request to target, returning immediately
+// returns the request id (see ssRangeStatus/ssRangeWait) or -1 if too many are in flight
+int ssRangeStart(RADIO radio, wyde target, ssRangeData result)
+	{
+	return rangeStart(radio, target, result, 0, NULL);
+	}
+
+// NOTE
+// A broadcast ssRangeStart completes on the first response and ignores the rest.
+// Here, one poll is sent and every rangee that hears it answers in its own reply
+// slot (derived from its addr, see ssReplySlot), so ranging to N rangees costs
+// one poll and N responses rather than N of each.
+//
+// The responses fill results[0..max-1] as they arrive; the request completes
+// (kRangeDone) when the collection window closes, or early if results fills up,
+// or times out (kRangeTimeout) if no rangee answered at all.
+
+// send a broadcast ranging request, collecting up to max results, returning immediately
+// returns the request id (see ssRangeStatus/ssRangeWait/ssRangeCount) or -1 if too many are in flight
+int ssRangeStartAll(RADIO radio, ssRangeData results, byte max)
+	{
+	assert(results && max);
+	return rangeStart(radio, BCAST_ADDR, results, max, NULL);
+	}
+
+// returns the # of results collected by request id
+byte ssRangeCount(int rid)
+	{
+	rangeSlot slot = slotOfId(rid);
+	if (!slot || slot->seq != (byte)rid)
+		return 0;
+	return slot->max ? slot->count : slot->state == kRangeDone;
+	}
+
+// range to every rangee in earshot, results in the provided buffer
+// returns the # of results
+byte ssRangeAll(RADIO radio, ssRangeData results, byte max)
+	{
+	int rseq = ssRangeStartAll(radio, results, max);
+	if (rseq < 0)
+		return 0;
+	ssRangeWait(rseq);
+	return ssRangeCount(rseq);
+	}
+
+// NOTE
+// ssRangeTo and ssRangeAll (and anything else using ssRangeWait) keep the
+// caller busy in EventYield until the request completes. With the Async forms
+// the caller is free as soon as the poll is away, and the done event is posted
+// when the request completes or times out. The event handler receives;
+//
+//		buf = the result buffer provided,
+//		len = the # of results in it (0 on timeout)
+//
+// so the application can queue more work, or simply WaitEvent and let the mcu
+// sleep, rather than spinning.
+
+// send a ranging request to target, posting done when complete
+// returns the request id or -1 if too many are in flight (done is not posted)
+int ssRangeAsync(RADIO radio, wyde target, ssRangeData result, EVENT done)
+	{
+	return rangeStart(radio, target, result, 0, done);
+	}
+
+// send a broadcast ranging request, collecting up to max results, posting done when complete
+// returns the request id or -1 if too many are in flight (done is not posted)
+int ssRangeAllAsync(RADIO radio, ssRangeData results, byte max, EVENT done)
+	{
+	assert(results && max);
+	return rangeStart(radio, BCAST_ADDR, results, max, done);
+	}
+
+// returns the state (kRangeXxx) of request id
+byte ssRangeStatus(int rid)
+	{
+	rangeSlot slot = slotOfId(rid);
+	return slot && slot->seq == (byte)rid ? slot->state : kRangeIdle;
+	}
+
+// await completion of request id
+// returns kRangeDone or kRangeTimeout (or kRangeIdle if unknown)
+byte ssRangeWait(int rid)
+	{
+	byte state;
+	while ((state = ssRangeStatus(rid)) == kRangePending)
 		EventYield();
+	return state;
+	}
 
-	cmStopTimer(rangeTimer);
-	if (timeout)
+// send a ranging request to target and put the result in the provided buffer
+void ssRangeTo(RADIO radio, wyde target, ssRangeData result)
+	{
+	int rseq = ssRangeStart(radio, target, result);
+	if (rseq < 0)
+		return;
+
+	// await the response
+	if (ssRangeWait(rseq) == kRangeTimeout)
 		{
 		debug("request timeout!\n");
 		return;
 		}
 	
-	if (rangeReady)
+	if (result)
 		{
-		if (result)
-			{
-			// if result was provided, it is filled with the range details
-			// we can handle locally or simply return details to caller, but we might
-			// also/instead post/send result to an event or a host server...
-	
-			// here, we simply show the target NodeAddr, seq# & ranged distance
-		#ifdef CC8051
-			// 8051 printf doesn't include float support
-			char fbuf[8];
-			debug("%04X[%02X]: %sm\n", result->rangee, result->seq, ftoa(result->range, sizeof(fbuf), fbuf, 100));
-		#else
-			debug("%04X[%02X]: %3.2fm\n", result->srcAddr, result->seq, result->range);
-		#endif
-			}
-		else
-			debug("range ready!\n");
+		// if result was provided, it is filled with the range details
+		// we can handle locally or simply return details to caller, but we might
+		// also/instead post/send result to an event or a host server...
+
+		// here, we simply show the target NodeAddr, seq# & ranged distance
+	#ifdef USE_FIXED_TOF
+		// (8051 printf doesn't include float support)
+		debug("%04X[%02X]: %ldmm\n", result->rangee, result->seq, (long)result->mm);
+	#else
+		debug("%04X[%02X]: %3.2fm\n", result->rangee, result->seq, result->range);
+	#endif
 		}
+	else
+		debug("range ready!\n");
 	}
 
 void ssRangerInit(RADIO radio)
 	{
 	// here we set up to capture and intermediate the receive IRQ handler
-	
+
+	// take a ranger for the radio (or start again with the one it has - its
+	// timer, event and delegates are kept, the delegates being registered already)
+	ssRanger r = rangerOf(radio);
+	byte again = r != NULL;
+	if (!r && !(r = rangerOf(NULL)))
+		sys.Fatal("ssRangerInit", __LINE__, "%s - too many ranging radios!", typeof(radio)->Name);
+	byte index = (byte)(r - rangers);
+	TIMER timer = r->timer;
+	EVENT event = r->event;
+	DELEGATE rxReady = r->rxReady, txDone = r->txDone;
+	if (again)
+		// (whatever was in flight is forgotten)
+		cmStopTimer(timer);
+
 	// remember the radio details
-	dwRadio = radio;
+	memset(r, 0, sizeof(_ssRanger));
+	r->radio = radio;
+	r->index = index;
 
-	// set up a timeout timer
-	objectCreate(rangeTimer, kIntervalTimer, TICKS(kRangeTimeoutMs));
-	OnEvent(rangeTimer, (HANDLER) rangeTimerHandler);
+	// the interrupt handler reads the ranging registers in one burst if the driver can
+	_dwRangeInfo info;
+	DWIFACE IDECA = *((DWIFACE *)typeof(radio)->jumps);
+	r->infoBurst = IDECA.Iocntl(radio, dwGetRangeInfo, &info) == 0;
+
+	frameRingInit(&r->ring);
+
+	// accept responses addressed to the radio - ssInit gives each the node's addr,
+	// so radios of one node ranging at once need their own (kRadioSetAddr, and
+	// dwSetAddress16 if the radio filters frames) before ssRangerInit is called again
+	byte hdr[sizeof_ssRangeRequestMsg];
+	memcpy(hdr, expectedResponse, sizeof_ssRangeRequestMsg);
+	*((wyde *)&hdr[MSG_DST_IDX]) = ((Dw3000)radio)->addr;
+	ssFrameInit(&r->frames, hdr);
+	if (ssFrameFiltered(radio))
+		ssFrameTrustAddr(&r->frames);
+	ssFrameOn(&r->frames, 0xE1, sizeof_ssRangeResponsMsg, (SSFRAMEHANDLER) responseRx, r);
+	ssFrameOn(&r->frames, FUNC_DS_RESPONSE, sizeof_ssRangeRequestMsg, (SSFRAMEHANDLER) dsRx, r);
+	ssFrameOn(&r->frames, FUNC_DS_REPORT, sizeof_ssDsReportMsg, (SSFRAMEHANDLER) dsRx, r);
+
+	// set up the deadlines, and the timer that drives them (only runs while requests are in flight)
+	timerWheelInit(&r->wheel);
+	for (byte i = 0; i < kRangeSlots; i++)
+		{
+		r->slots[i].ranger = r;
+		wheelTimerInit(&r->slots[i].deadline, (WHEELHANDLER) rangeDeadline, &r->slots[i]);
+		}
+	if (again)
+		{
+		r->timer = timer;
+		r->event = event;
+		r->rxReady = rxReady;
+		r->txDone = txDone;
+		return;
+		}
+	objectCreate(r->timer, kIntervalTimer, TICKS(kRangeTickMs));
+	OnEvent(r->timer, (HANDLER) rangeTimerHandler);
 
 	// here we set up to capture and intermediate the receive IRQ handler
 	// create the rxEvent
-	objectCreate(rangeEvent);
-	OnEvent(rangeEvent, (HANDLER) rangeEventHandler);
+	objectCreate(r->event);
+	OnEvent(r->event, (HANDLER) rangeEventHandler);
 
 	// set the rxReady handler
 	// create & set the Rx delegate
-	objectCreate(rxReady, delegateTask(rxReadyHandler));
-	IRADIO.Iocntl(radio, kRadioAddRxReady, rxReady);
+	objectCreate(r->rxReady, delegateTask(rangerTasks[index].rxReady));
+	IRADIO.Iocntl(radio, kRadioAddRxReady, r->rxReady);
+
+	// set the txDone handler (captures poll timestamps)
+	objectCreate(r->txDone, delegateTask(rangerTasks[index].txDone));
+	IRADIO.Iocntl(radio, kRadioAddTxDone, r->txDone);
 	}
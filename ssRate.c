@@ -0,0 +1,249 @@
+/*
+ *	File: ssRate.c
+ *
+ *	Contains: Adaptive ranging rate
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+
+#include "ssRate.h"
+#include "ssFilter.h"
+
+// NOTE
+// Ranging a target that hasn't moved tells us nothing new, but costs the same
+// airtime as one that has. So each target is ranged (by ssRangeAsync, SS or DS
+// as set by ssRangeMode) about as often as it takes to move kRateStepMm at the
+// speed it has been moving - between kRateMinMs and kRateMaxMs apart.
+//
+// The speed is the change in range since a reference result over the time
+// between them, or, if the target has a Kalman filter (see ssFilterMode), the
+// filter's. A change within kRateNoiseMm (a still target's ranges still differ a
+// little) says only that the target is moving no faster than that over the
+// time, so the reference is kept and the bound tightens with each result - a
+// target that stops is ranged less and less often, rather than dropped to
+// kRateMaxMs at once. Targets start as fast as kRateMinMs allows.
+//
+// The budget caps the exchanges per second across all the targets. Should the
+// intervals wanted add up to more, they are all stretched alike to fit - the
+// moving targets still get the most of it.
+
+#define kRateTickMs		10		// scheduling resolution
+#define kRateStale		2		// (busy) a request from before a restart - its result is dropped
+
+typedef struct
+	{
+	wyde addr;
+	byte busy;				// a request is in flight (kRateStale from before a restart)
+	byte ranged;			// there's a reference result to measure motion from
+	word intervalMs;		// as its speed calls for
+	UInt32 polled;			// last request (ms)
+	UInt32 next;			// ... and the next due
+	UInt32 last;			// reference result (ms)
+	Int32 mm;				// ... its range
+	word speed;				// mm/s
+	word polls, results;
+	_ssRangeData result;
+	} _rateTarget, *rateTarget;
+
+static struct
+	{
+	RADIO radio;			// (NULL if stopped)
+	byte count;
+	word budget;			// exchanges per second
+	word stretch;			// intervals are scheduled this much longer to fit the budget (Q8)
+	UInt32 now;				// ms
+	EVENT result;
+	TIMER timer;
+	EVENT done;				// exchange complete (see ssRangeAsync)
+	_rateTarget targets[kRateTargets];
+	} scheduler;
+
+#define rateDue(t)	((Int32)(scheduler.now - (t)->next) >= 0)
+
+// the interval a target is scheduled at
+static UInt32 rateScheduled(rateTarget t)
+	{
+	return ((UInt32)t->intervalMs * scheduler.stretch) >> 8;
+	}
+
+// stretch the intervals (if need be) to fit the budget
+static void rateStretch()
+	{
+	// exchanges per second wanted (Q8)
+	UInt32 wanted = 0;
+	for (byte i = 0; i < scheduler.count; i++)
+		wanted += ((UInt32)1000 << 8) / scheduler.targets[i].intervalMs;
+	scheduler.stretch = wanted > ((UInt32)scheduler.budget << 8) ? (word)(wanted / scheduler.budget) : 0x100;
+	}
+
+// a result - how fast is the target moving
+static void rateMotion(rateTarget t)
+	{
+	Int32 mm, mmPerSec;
+	UInt32 ms = scheduler.now - t->last, speed;
+	if (!t->ranged || !ms)
+		{
+		// (nothing to go on yet)
+		t->ranged = 1;
+		t->mm = t->result.mm;
+		t->last = scheduler.now;
+		return;
+		}
+	if (ssFilterState(t->addr, &mm, &mmPerSec) && mmPerSec)
+		{
+		// (the Kalman filter's, if it has one)
+		speed = (UInt32)(mmPerSec < 0 ? -mmPerSec : mmPerSec);
+		t->mm = t->result.mm;
+		t->last = scheduler.now;
+		}
+	else
+		{
+		Int32 moved = t->result.mm - t->mm;
+		if (moved < 0)
+			moved = -moved;
+		if (moved > kRateNoiseMm)
+			{
+			// it has moved - measure again from here
+			speed = (UInt32)moved * 1000 / ms;
+			t->mm = t->result.mm;
+			t->last = scheduler.now;
+			}
+		else
+			{
+			// no faster than the noise over the time, if at all
+			speed = (UInt32)kRateNoiseMm * 1000 / ms;
+			if (speed > t->speed)
+				speed = t->speed;
+			}
+		}
+	t->speed = (word)(speed > 0xFFFF ? 0xFFFF : speed);
+
+	// the next is due that much after the last
+	ms = t->speed ? (UInt32)kRateStepMm * 1000 / t->speed : kRateMaxMs;
+	t->intervalMs = (word)(ms < kRateMinMs ? kRateMinMs : ms > kRateMaxMs ? kRateMaxMs : ms);
+	rateStretch();
+	t->next = t->polled + rateScheduled(t);
+	}
+
+static void rateDoneHandler(EVENT e, ssRangeData result, word n)
+	{
+	// running in application context
+	rateTarget t = scheduler.targets;
+	byte i;
+	for (i = 0; i < kRateTargets && &t->result != result; i++, t++)
+		;
+	if (i == kRateTargets)
+		return;
+	if (t->busy == kRateStale)
+		{
+		t->busy = 0;
+		return;
+		}
+	t->busy = 0;
+	if (n)
+		{
+		if (t->results != 0xFFFF)
+			t->results++;
+		rateMotion(t);
+		}
+	if (scheduler.result)
+		PostEvent(scheduler.result, (byte *)result, n);
+	}
+
+static void rateTimerHandler(EVENT e, byte *buf, word len)
+	{
+	// running in application context, every kRateTickMs
+	scheduler.now += kRateTickMs;
+
+	// start whatever is due (the rest wait a tick if the ranger is full)
+	rateTarget t = scheduler.targets;
+	for (byte i = 0; i < scheduler.count; i++, t++)
+		if (!t->busy && rateDue(t))
+			{
+			if (ssRangeAsync(scheduler.radio, t->addr, &t->result, scheduler.done) < 0)
+				return;
+			t->busy = 1;
+			if (t->polls != 0xFFFF)
+				t->polls++;
+			t->polled = scheduler.now;
+			t->next = t->polled + rateScheduled(t);
+			}
+	}
+
+// range from radio to targets[0..count-1], at most budget exchanges per second
+void ssRateStart(RADIO radio, wyde *targets, byte count, word budget, EVENT result)
+	{
+	assert(targets && count && budget);
+	if (count > kRateTargets)
+		count = kRateTargets;
+
+	if (!scheduler.timer)
+		{
+		objectCreate(scheduler.timer, kIntervalTimer, TICKS(kRateTickMs));
+		OnEvent(scheduler.timer, (HANDLER) rateTimerHandler);
+		objectCreate(scheduler.done);
+		OnEvent(scheduler.done, (HANDLER) rateDoneHandler);
+		}
+	else
+		cmStopTimer(scheduler.timer);
+
+	// everyone at full speed to start with, spread over the first ticks (a slot
+	// with a request still in flight waits for it, so its result isn't taken for
+	// the new target's)
+	for (byte i = 0; i < kRateTargets; i++)
+		{
+		rateTarget t = &scheduler.targets[i];
+		byte busy = t->busy ? kRateStale : 0;
+		memset(t, 0, sizeof(_rateTarget));
+		t->busy = busy;
+		if (i >= count)
+			continue;
+		t->addr = targets[i];
+		t->intervalMs = kRateMinMs;
+		t->speed = (word)((UInt32)kRateStepMm * 1000 / kRateMinMs);
+		t->next = scheduler.now + (UInt32)i * kRateTickMs;
+		}
+	scheduler.radio = radio;
+	scheduler.count = count;
+	scheduler.budget = budget;
+	scheduler.result = result;
+	rateStretch();
+	cmStartTimer(scheduler.timer, 0);
+	}
+
+// stop (requests in flight are still posted, unless it is started again first)
+void ssRateStop()
+	{
+	if (scheduler.timer)
+		cmStopTimer(scheduler.timer);
+	scheduler.radio = NULL;
+	}
+
+byte ssRateStats(wyde target, ssRateStat stats)
+	{
+	rateTarget t = scheduler.targets;
+	for (byte i = 0; i < scheduler.count; i++, t++)
+		if (t->addr == target)
+			{
+			stats->intervalMs = t->intervalMs;
+			stats->scheduledMs = rateScheduled(t) > 0xFFFF ? 0xFFFF : (word)rateScheduled(t);
+			stats->speed = t->speed;
+			stats->polls = t->polls;
+			stats->results = t->results;
+			return 1;
+			}
+	return 0;
+	}
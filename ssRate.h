@@ -0,0 +1,62 @@
+/*
+ *	File: ssRate.h
+ *
+ *	Contains: Adaptive ranging rate definitions
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __SSRATE_H
+#define __SSRATE_H
+
+#include "ssRange.h"
+
+// Ranges to a set of targets, each as often as its motion calls for - see
+// ssRate.c.
+
+#ifndef kRateTargets
+#define kRateTargets	16		// targets at most
+#endif
+#ifndef kRateMinMs
+#define kRateMinMs		100		// fastest a target is ranged
+#endif
+#ifndef kRateMaxMs
+#define kRateMaxMs		5000	// ... and slowest
+#endif
+#ifndef kRateStepMm
+#define kRateStepMm		250		// range a target each time it may have moved this far (> kRateNoiseMm)
+#endif
+#ifndef kRateNoiseMm
+#define kRateNoiseMm	150		// changes in range smaller than this are taken as noise
+#endif
+
+typedef struct
+	{
+	word intervalMs;	// between ranges, as its speed calls for
+	word scheduledMs;	// ... and as scheduled (longer, if the budget is short)
+	word speed;			// rate of change of range (mm/s)
+	word polls;			// requests (stop at 0xFFFF)
+	word results;		// ... answered
+	} _ssRateStat, *ssRateStat;
+
+// range from radio to targets[0..count-1] (copied), at most budget exchanges per
+// second between them - result is posted with each result (and 1), or with a
+// cleared one (and 0) on a timeout (starting again drops any still in flight)
+void ssRateStart(RADIO radio, wyde *targets, byte count, word budget, EVENT result);
+void ssRateStop(void);
+
+// target's rate - returns 0 if it isn't one of the targets
+byte ssRateStats(wyde target, ssRateStat stats);
+
+#endif
@@ -0,0 +1,716 @@
+/*
+ *	File: ssTdma.c
+ *
+ *	Contains: Scheduled (TDMA) ranging - superframe coordinator and tags
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#define __RADIO_CLASS_H	 // block current class/radio.h
+
+#include "Koliada.h"
+#include "interface/dw3000.h"
+
+#include "ssTdma.h"
+#include "frameRing.h"
+#include "ssFrame.h"
+
+// NOTE
+// Tags that simply range whenever they like collide once there are more than a
+// few of them, and each collision costs a timeout. Here time is divided into
+// superframes, each started by a beacon (E6, see ssInit.c) from the coordinator;
+//
+//		| beacon | first |  slot 0  |  slot 1  | ... |  slot n-1  | lead |
+//
+// and each tag ranges (ssRangeAsync, SS or DS as set by ssRangeMode) to its
+// anchors only within its own slot, ssTdmaSlot(addr, slots) - the same addr
+// derived scheme as the collection reply slots. Tags whose addrs share a slot
+// (addr % slots) still collide, so the superframe should offer comfortably more
+// slots than there are tags.
+//
+// Slot timing is in device time, from the beacon's rx timestamp, so it is as
+// good as the radio's clock; the mcu timer only wakes the tag kTdmaLeadMs before
+// its slot, and the first poll goes out at the start of the slot by delayed tx
+// (dwSetDelayedTx). The coordinator places its beacons the same way, a superframe
+// after the last. (Without delayed tx, frames go when the timer fires.) The radio
+// can't receive while a delayed tx waits, hence the lead time kept clear at the
+// end of the superframe. A delayed tx for a time already gone would wait out the
+// 17s wrap (or fail late), so each is checked against the device time first; a
+// tag held up past the start of its slot skips it, and a late beacon goes at once.
+//
+// The beacon timestamps (and the layout that comes with a beacon) are written by
+// the interrupt handler, and a dwTime takes more than one read on a 32 bit mcu,
+// so each write bumps a count and the application copies until it holds still.
+//
+// A tag carries on to its next anchor, as soon as each exchange completes, for
+// as long as its measured exchange time says the next one will fit in the slot,
+// and starts the next slot where this one left off. The coordinator is told how
+// many exchanges a slot should hold; it watches the channel, timing each slot's
+// traffic from its first frame to the end of its last, and sizes the slots of
+// the next superframe to that many of the slowest exchange it saw (with a
+// margin). So the slots track the exchange time actually achieved (SS or DS,
+// however quick the rangees are to answer) - and the # of slots follows.
+
+#define kTdmaTickMs		1		// timer resolution
+#define kTdmaLeadMs		2		// wake this long before a delayed tx
+#define kTdmaFirstUs	1000	// beacon to the first slot
+#define kTdmaGuardUs	100		// clear time at the end of each slot
+#define kTdmaMinSlotUs	500
+#define kTdmaExchangeUs	1000	// exchange time to start with
+#define kTdmaMaxSlotUs	20000
+#define kTdmaTimeoutMs	10		// per anchor (see ssRangeConfig) - a lost frame ends the slot
+#define kTdmaSkewUs		20		// clock & delayed tx error allowed at the start of a slot
+#define kTdmaMarginUs	100		// least time ahead a delayed tx can be set for
+#define kTdmaPhrUs		22		// RMARKER to the end of the PHR, at 6.8Mbps
+#define kTdmaByteNs		1177	// per payload byte, at 6.8Mbps
+#define kTdmaTicksPerUs	63898UL	// device time units per us (499.2MHz * 128)
+
+#ifndef kMaxTdmaTags
+#define kMaxTdmaTags 2		// radios that can join at once (see ssTdmaJoin)
+#endif
+#if kMaxTdmaTags > 2
+#error add rxReady entry points for the extra tags (see tagTasks)
+#endif
+
+#ifndef kTdmaCoordRadios
+#define kTdmaCoordRadios 2	// radios that can coordinate, in turn (see ssTdmaCoordinate)
+#endif
+#if kTdmaCoordRadios > 2
+#error add delegate entry points for the extra radios (see coordinatorTasks)
+#endif
+
+#define tdmaTicks(us)	((dwTime)(us) * kTdmaTicksPerUs)
+
+// is at far enough ahead of the radio's clock for a delayed tx (1 if the radio
+// can't tell us its time)
+static byte tdmaAhead(RADIO radio, dwTime at)
+	{
+	DWIFACE IDECA = *((DWIFACE *)typeof(radio)->jumps);
+	dwTime now;
+	if (IDECA.Iocntl(radio, dwGetSysTime, &now) != 0)
+		return 1;
+	dwTime ahead = dwTimeDelta(at, now);
+	return ahead < (kDwTimeMask >> 1) && ahead >= tdmaTicks(kTdmaMarginUs);
+	}
+
+////////////////////////////////////////////////////////////////////////////////
+// coordinator
+
+typedef struct
+	{
+	RADIO radio;			// (NULL if not coordinating)
+	word superframeMs;
+	wyde slots, slotUs;		// as beaconed
+	wyde superframe;		// #
+	byte exchanges;			// per slot
+	byte delayedTx;			// the driver has dwSetDelayedTx
+	word countdown;			// ms to the next beacon
+	volatile dwTime beaconTx;// last beacon's tx timestamp (see tdmaBeaconTx)
+	volatile byte beaconSeq;// bumped as each is written
+	UInt32 exchangeUs;		// exchange time the slots are sized for
+
+	// the slot being watched
+	UInt32 slot;			// # (0xFFFFFFFF for none yet)
+	dwTime start, end;		// its first frame's start & last frame's end (from the beacon)
+	byte polls;				// exchanges started in it
+	dwTime slowest;			// longest exchange this superframe
+
+	_frameRing ring;		// ranging frames seen on the channel (rxTs, len & header only)
+	TIMER timer;
+	EVENT event;			// frames waiting in ring
+	EVENT sent;				// beacon away
+	RADIO radios[kTdmaCoordRadios];	// those given our delegates (which stay once added)
+	DELEGATE rxReady[kTdmaCoordRadios], txDone[kTdmaCoordRadios];
+	_ssFrameTable frames;
+	} _ssTdmaCoordinator, *ssTdmaCoordinator;
+
+static _ssTdmaCoordinator coordinator;
+
+// the last beacon's tx timestamp, as the interrupt handler left it
+static dwTime tdmaBeaconTx(ssTdmaCoordinator c)
+	{
+	dwTime tx;
+	byte seq;
+	do
+		{
+		seq = c->beaconSeq;
+		tx = c->beaconTx;
+		} while (seq != c->beaconSeq);
+	return tx;
+	}
+
+// done with the slot being watched
+static void tdmaSlotEnd(ssTdmaCoordinator c)
+	{
+	if (c->polls)
+		{
+		dwTime exchange = (c->end - c->start) / c->polls;
+		if (exchange > c->slowest)
+			c->slowest = exchange;
+		}
+	c->slot = 0xFFFFFFFF;
+	c->polls = 0;
+	}
+
+static void tdmaSeen(frameRecord rec, ssTdmaCoordinator c)
+	{
+	// running in application context
+	dwTime beaconTx = tdmaBeaconTx(c);
+	if (!beaconTx)
+		return;
+	dwTime offset = dwTimeDelta(rec->rxTs, beaconTx);
+	if (offset < tdmaTicks(kTdmaFirstUs) || offset >= tdmaTicks((UInt32)c->superframeMs * 1000))
+		return;
+
+	// its slot (a frame a hair early for its slot is still in it)
+	offset -= tdmaTicks(kTdmaFirstUs);
+	UInt32 slot = (UInt32)((offset + tdmaTicks(kTdmaSkewUs)) / tdmaTicks(c->slotUs));
+	dwTime end = offset + tdmaTicks(kTdmaPhrUs + (rec->len * kTdmaByteNs + 999) / 1000);
+	if (slot != c->slot)
+		{
+		tdmaSlotEnd(c);
+		c->slot = slot;
+		c->start = offset;
+		}
+	c->end = end;
+	c->polls += rec->data[MSG_FUNC_IDX] == 0xE0 || rec->data[MSG_FUNC_IDX] == FUNC_DS_POLL;
+	}
+
+// slots for c->exchanges of c->exchangeUs, with an 1/8 margin
+static void tdmaSize(ssTdmaCoordinator c)
+	{
+	UInt32 slotUs = c->exchangeUs * c->exchanges * 8 / 7 + kTdmaGuardUs;
+	c->slotUs = (wyde)(slotUs < kTdmaMinSlotUs ? kTdmaMinSlotUs : slotUs > kTdmaMaxSlotUs ? kTdmaMaxSlotUs : slotUs);
+	}
+
+// size the next superframe's slots from the slowest exchange in the last
+static void tdmaAdapt(ssTdmaCoordinator c)
+	{
+	// running in application context
+	frameRingDrain(&c->ring, (FRAMEHANDLER) tdmaSeen, c, 0);
+	tdmaSlotEnd(c);
+	if (!c->slowest)
+		// nobody ranged - no news
+		return;
+
+	// follow a slower exchange at once, a quicker one gradually
+	UInt32 us = (UInt32)(c->slowest / kTdmaTicksPerUs);
+	c->exchangeUs = us > c->exchangeUs ? us : (7 * c->exchangeUs + us) / 8;
+	c->slowest = 0;
+	tdmaSize(c);
+	}
+
+static void tdmaBeacon(ssTdmaCoordinator c)
+	{
+	// running in application context
+	DWIFACE IDECA = *((DWIFACE *)typeof(c->radio)->jumps);
+
+	// as many slots as fit between the first slot and the lead time
+	UInt32 slots = ((UInt32)c->superframeMs * 1000 - kTdmaFirstUs - kTdmaLeadMs * 1000) / c->slotUs;
+	c->slots = (wyde)(!slots ? 1 : slots > 0xFFFF ? 0xFFFF : slots);
+	c->superframe++;
+
+	byte beacon[sizeof_ssTdmaBeaconMsg];
+	memcpy(beacon, ssRangeRequestMsg, sizeof_ssRangeRequestMsg);
+	beacon[MSG_SEQ_IDX] = (byte)c->superframe;
+	*((wyde *)&beacon[MSG_DST_IDX]) = BCAST_ADDR;
+	*((wyde *)&beacon[MSG_SRC_IDX]) = ((Dw3000)c->radio)->addr;
+	beacon[MSG_FUNC_IDX] = FUNC_TDMA_BEACON;
+	*((wyde *)&beacon[BEACON_MSG_SLOTS_IDX]) = c->slots;
+	*((wyde *)&beacon[BEACON_MSG_SLOT_US_IDX]) = c->slotUs;
+	*((wyde *)&beacon[BEACON_MSG_FIRST_US_IDX]) = kTdmaFirstUs;
+	*((wyde *)&beacon[BEACON_MSG_ROUND_IDX]) = c->superframe;
+
+	// a superframe after the last (the first goes at once, as does one we're too
+	// late to place - the next is placed from it)
+	dwTime beaconTx = tdmaBeaconTx(c);
+	if (beaconTx && c->delayedTx)
+		{
+		dwTime at = (beaconTx + tdmaTicks((UInt32)c->superframeMs * 1000)) & kDwTimeMask;
+		if (tdmaAhead(c->radio, at) && IDECA.Iocntl(c->radio, dwSetDelayedTx, &at) != 0)
+			c->delayedTx = 0;
+		}
+
+	// (keeps the receiver on, to watch the superframe)
+	IDECA.RangeTo(c->radio, beacon, sizeof_ssTdmaBeaconMsg);
+	}
+
+static void coordinatorTimerHandler(EVENT e, byte *buf, word len)
+	{
+	// running in application context, every kTdmaTickMs until the next beacon is due
+	ssTdmaCoordinator c = &coordinator;
+	if (!c->radio || --c->countdown)
+		// (or a tick queued before ssTdmaStop)
+		return;
+	cmStopTimer(c->timer);
+	tdmaAdapt(c);
+	tdmaBeacon(c);
+	}
+
+static void coordinatorSentHandler(EVENT e, ssTdmaCoordinator c, word len)
+	{
+	// running in application context
+	// count down to the next beacon from this one (so the mcu clock never drifts
+	// from the radio's), waking early enough to set up the delayed tx
+	if (!c->radio)
+		return;
+	c->countdown = c->superframeMs - (c->delayedTx ? kTdmaLeadMs : 0);
+	cmStartTimer(c->timer, 0);
+	}
+
+static void coordinatorEventHandler(EVENT e, ssTdmaCoordinator c, word len)
+	{
+	// running in application context
+	frameRingDrain(&c->ring, (FRAMEHANDLER) tdmaSeen, c, 0);
+	}
+
+// any ranging frame on the channel (E0..E5)
+static void coordinatorRx(byte *buf, word len, ssTdmaCoordinator c)
+	{
+	// running in the interrupt handler!! (from coordinatorRxReady)
+	frameRecord rec = frameRingReserve(&c->ring);
+	if (!rec)
+		return;
+
+	// when & how long is all that matters
+	DWIFACE IDECA = *((DWIFACE *)typeof(c->radio)->jumps);
+	IDECA.Iocntl(c->radio, dwGetRxTime, &rec->rxTs);
+	rec->len = (byte)len;
+	memcpy(rec->data, buf, kFrameHdrSize);
+	if (frameRingCommit(&c->ring))
+		PostEvent(c->event, (byte *)c, 0);
+	}
+
+// A radio's delegates stay once added, so those of a radio that has stopped
+// coordinating (or been left for another) are still called - each radio has its
+// own entry points, and anything from a radio that isn't c->radio is ignored.
+static void coordinatorRxReady(RADIO radio, byte *buf, word len)
+	{
+	// running in the interrupt handler!!
+	if (radio == coordinator.radio)
+		ssFrameDispatch(&coordinator.frames, buf, len);
+	}
+
+static void coordinatorTxDone(RADIO radio, byte *frame, word len)
+	{
+	// running in the interrupt handler!!
+	ssTdmaCoordinator c = &coordinator;
+	if (radio != c->radio || len < sizeof_ssRangeRequestMsg || (frame[MSG_FUNC_IDX] & 0xF0) != kFrameFuncBase)
+		return;
+	DWIFACE IDECA = *((DWIFACE *)typeof(radio)->jumps);
+	if (frame[MSG_FUNC_IDX] == FUNC_TDMA_BEACON)
+		{
+		IDECA.Iocntl(radio, dwGetTxTime, &c->beaconTx);
+		c->beaconSeq++;
+		PostEvent(c->sent, (byte *)c, 0);
+		return;
+		}
+
+	// our own ranging frames take up slot time too (e.g. our responses, as an anchor)
+	frameRecord rec = frameRingReserve(&c->ring);
+	if (!rec)
+		return;
+	IDECA.Iocntl(radio, dwGetTxTime, &rec->rxTs);
+	rec->len = (byte)len;
+	memcpy(rec->data, frame, kFrameHdrSize);
+	if (frameRingCommit(&c->ring))
+		PostEvent(c->event, (byte *)c, 0);
+	}
+
+static void coordRxReady0(byte *buf, word len)		{ coordinatorRxReady(coordinator.radios[0], buf, len); }
+static void coordTxDone0(byte *frame, word len)		{ coordinatorTxDone(coordinator.radios[0], frame, len); }
+#if kTdmaCoordRadios > 1
+static void coordRxReady1(byte *buf, word len)		{ coordinatorRxReady(coordinator.radios[1], buf, len); }
+static void coordTxDone1(byte *frame, word len)		{ coordinatorTxDone(coordinator.radios[1], frame, len); }
+#endif
+
+static const struct
+	{
+	void (*rxReady)(byte *buf, word len);
+	void (*txDone)(byte *frame, word len);
+	} coordinatorTasks[kTdmaCoordRadios] =
+	{
+	{coordRxReady0, coordTxDone0},
+#if kTdmaCoordRadios > 1
+	{coordRxReady1, coordTxDone1},
+#endif
+	};
+
+// beacon superframes of superframeMs from radio, with slots sized for exchanges
+// exchanges each (only one radio coordinates - calling again starts again, on radio)
+void ssTdmaCoordinate(RADIO radio, word superframeMs, byte exchanges)
+	{
+	ssTdmaCoordinator c = &coordinator;
+	assert(superframeMs * 1000UL > kTdmaFirstUs + kTdmaLeadMs * 1000 + kTdmaMinSlotUs);
+	if (c->radio)
+		cmStopTimer(c->timer);
+	if (!c->event)
+		{
+		objectCreate(c->timer, kIntervalTimer, TICKS(kTdmaTickMs));
+		OnEvent(c->timer, (HANDLER) coordinatorTimerHandler);
+		objectCreate(c->event);
+		OnEvent(c->event, (HANDLER) coordinatorEventHandler);
+		objectCreate(c->sent);
+		OnEvent(c->sent, (HANDLER) coordinatorSentHandler);
+		}
+	// (no frames are taken while the table is set up)
+	c->radio = NULL;
+
+	// delegates for the radio, unless it has them from before
+	byte i;
+	for (i = 0; i < kTdmaCoordRadios && c->radios[i] && c->radios[i] != radio; i++)
+		;
+	if (i == kTdmaCoordRadios)
+		sys.Fatal("ssTdmaCoordinate", __LINE__, "%s - too many coordinating radios!", typeof(radio)->Name);
+	if (!c->radios[i])
+		{
+		c->radios[i] = radio;
+		objectCreate(c->rxReady[i], delegateTask(coordinatorTasks[i].rxReady));
+		IRADIO.Iocntl(radio, kRadioAddRxReady, c->rxReady[i]);
+		objectCreate(c->txDone[i], delegateTask(coordinatorTasks[i].txDone));
+		IRADIO.Iocntl(radio, kRadioAddTxDone, c->txDone[i]);
+		}
+
+	c->superframeMs = superframeMs;
+	c->exchanges = exchanges ? exchanges : 1;
+	c->exchangeUs = kTdmaExchangeUs;
+	tdmaSize(c);
+	c->superframe = 0;
+	c->delayedTx = 1;
+	c->beaconTx = 0;
+	c->slot = 0xFFFFFFFF;
+	c->polls = 0;
+	c->slowest = 0;
+	frameRingInit(&c->ring);
+
+	// watch every ranging frame on our PAN (whoever it's to)
+	ssFrameInit(&c->frames, ssRangeRequestMsg);
+	if (ssFrameFiltered(radio))
+		debug("ssTdmaCoordinate: frame filtering is on - only our own exchanges size the slots\n");
+	else
+		ssFrameAnyDst(&c->frames);
+	for (byte func = 0xE0; func <= FUNC_DS_REPORT; func++)
+		ssFrameOn(&c->frames, func, kFrameAnyLen, (SSFRAMEHANDLER) coordinatorRx, c);
+
+	c->radio = radio;
+	tdmaBeacon(c);
+	}
+
+// stop beaconing from radio - its delegates stay, but take nothing more
+void ssTdmaStop(RADIO radio)
+	{
+	ssTdmaCoordinator c = &coordinator;
+	if (!radio || c->radio != radio)
+		return;
+	cmStopTimer(c->timer);
+	c->radio = NULL;
+	for (byte func = 0xE0; func <= FUNC_DS_REPORT; func++)
+		ssFrameOn(&c->frames, func, kFrameAnyLen, NULL, NULL);
+	}
+
+////////////////////////////////////////////////////////////////////////////////
+// tags
+
+typedef struct
+	{
+	RADIO radio;			// (NULL if this tag is free)
+	wyde *anchors;			// (NULL once we've left)
+	byte count;
+	byte first;				// anchor to start the next slot with
+	byte k;					// anchors started this slot
+	byte got;				// results this slot
+	byte busy;				// a slot is in progress
+	byte delayedTx;			// the driver has dwSetDelayedTx
+	ssRangeData results;
+	EVENT round;			// posted with the results after each slot
+
+	// the superframe, from the last beacon (written by the interrupt handler, which
+	// bumps beaconSeq after each - see tagBeaconHandler)
+	volatile dwTime beaconRx;
+	volatile wyde slots, slotUs, firstUs;
+	volatile byte beaconSeq;
+
+	dwTime slotStart, slotEnd;
+	dwTime lastT1;			// poll tx of the last exchange
+	UInt32 exchange;		// exchange time (device time units, 0 until measured)
+	word countdown;			// ms to the slot
+	TIMER timer;
+	EVENT beacon;			// beacon received
+	EVENT done;				// exchange complete (see ssRangeAsync)
+	DELEGATE rxReady;
+	_ssFrameTable frames;
+	} _ssTdmaTag, *ssTdmaTag;
+
+static _ssTdmaTag tags[kMaxTdmaTags];
+
+static ssTdmaTag tagOf(RADIO radio)
+	{
+	ssTdmaTag t = tags;
+	for (byte i = 0; i < kMaxTdmaTags; i++, t++)
+		if (t->radio == radio)
+			return t;
+	return NULL;
+	}
+
+static void tagEnd(ssTdmaTag t)
+	{
+	// running in application context
+	// the anchors we didn't get to go first next time
+	t->first = (byte)((t->first + t->k) % t->count);
+	t->busy = 0;
+	if (t->round)
+		PostEvent(t->round, (byte *)t->results, t->got);
+	}
+
+static void tagNext(ssTdmaTag t)
+	{
+	// running in application context
+	wyde anchor = t->anchors[(t->first + t->k) % t->count];
+	if (ssRangeAsync(t->radio, anchor, &t->results[t->got], t->done) < 0)
+		{
+		tagEnd(t);
+		return;
+		}
+	t->k++;
+	}
+
+// our slot has come - range to as many anchors as fit
+static void tagSlot(ssTdmaTag t)
+	{
+	// running in application context
+	t->busy = 1;
+	t->k =
+	t->got = 0;
+	if (t->delayedTx)
+		{
+		if (!tdmaAhead(t->radio, t->slotStart))
+			{
+			// held up past the start of the slot - sit this one out (round is still posted)
+			tagEnd(t);
+			return;
+			}
+		DWIFACE IDECA = *((DWIFACE *)typeof(t->radio)->jumps);
+		if (IDECA.Iocntl(t->radio, dwSetDelayedTx, &t->slotStart) != 0)
+			t->delayedTx = 0;
+		}
+	tagNext(t);
+	}
+
+// will another exchange, started now, be over by the end of the slot
+static byte tagFits(ssTdmaTag t)
+	{
+	// from the radio's time if it can tell us (we may have been held up since the
+	// last exchange), else from the last, which started at lastT1 and has taken
+	// (about) one exchange time already
+	DWIFACE IDECA = *((DWIFACE *)typeof(t->radio)->jumps);
+	dwTime now, need = t->exchange;
+	if (IDECA.Iocntl(t->radio, dwGetSysTime, &now) != 0)
+		{
+		now = t->lastT1;
+		need *= 2;
+		}
+	dwTime left = dwTimeDelta(t->slotEnd, now);
+	return left < (kDwTimeMask >> 1) && left > need;
+	}
+
+static void tagDoneHandler(EVENT e, ssRangeData result, word n)
+	{
+	// running in application context
+	ssTdmaTag t = tags;
+	byte i;
+	for (i = 0; i < kMaxTdmaTags && t->done != e; i++, t++)
+		;
+	if (i == kMaxTdmaTags || !t->busy)
+		return;
+	if (!n)
+		{
+		// timed out - the slot has (most likely) gone
+		tagEnd(t);
+		return;
+		}
+
+	// the exchange time is poll to poll - it includes getting round to the
+	// next one - but until there are two in a slot there is only the first's
+	// round trip to go on (doubled, for the rest of the exchange and the turnaround)
+	if (t->got)
+		{
+		UInt32 d = (UInt32)dwTimeDelta(result->t1, t->lastT1);
+		t->exchange = t->exchange - t->exchange / 4 + d / 4;
+		}
+	else if (!t->exchange)
+		t->exchange = 2 * (UInt32)dwTimeDelta(result->t4, result->t1);
+	t->lastT1 = result->t1;
+	t->got++;
+
+	if (t->anchors && t->k < t->count && tagFits(t))
+		tagNext(t);
+	else
+		tagEnd(t);
+	}
+
+static void tagTimerHandler(EVENT e, byte *buf, word len)
+	{
+	// running in application context, every kTdmaTickMs until our slot
+	ssTdmaTag t = tags;
+	for (byte i = 0; i < kMaxTdmaTags; i++, t++)
+		if ((EVENT)t->timer == e)
+			{
+			if (!--t->countdown)
+				{
+				cmStopTimer(t->timer);
+				if (t->anchors)
+					tagSlot(t);
+				}
+			return;
+			}
+	}
+
+static void tagBeaconHandler(EVENT e, ssTdmaTag t, word len)
+	{
+	// running in application context
+	// (posted with the tag as buf, see tagBeaconRx)
+	if (!t->anchors || t->busy || t->countdown)
+		// left, or still at the last superframe (the coordinator will see the
+		// slot overran, and lengthen them)
+		return;
+
+	// the superframe, as the last beacon has it (another may arrive as it's copied)
+	dwTime beaconRx;
+	wyde slots, slotUs, firstUs;
+	byte seq;
+	do
+		{
+		seq = t->beaconSeq;
+		beaconRx = t->beaconRx;
+		slots = t->slots;
+		slotUs = t->slotUs;
+		firstUs = t->firstUs;
+		} while (seq != t->beaconSeq);
+
+	// our slot, in device time from the beacon
+	UInt32 offsetUs = firstUs + (UInt32)ssTdmaSlot(((Dw3000)t->radio)->addr, slots) * slotUs;
+	t->slotStart = (beaconRx + tdmaTicks(offsetUs)) & kDwTimeMask;
+	t->slotEnd = (t->slotStart + tdmaTicks(slotUs - kTdmaGuardUs)) & kDwTimeMask;
+
+	// and in ms from now (to the ms, if there's no delayed tx to do the rest)
+	UInt32 waitMs = t->delayedTx ? offsetUs / 1000 : (offsetUs + 999) / 1000;
+	if (t->delayedTx)
+		waitMs = waitMs > kTdmaLeadMs ? waitMs - kTdmaLeadMs : 0;
+	if (!waitMs)
+		{
+		tagSlot(t);
+		return;
+		}
+	t->countdown = (word)waitMs;
+	cmStartTimer(t->timer, 0);
+	}
+
+// superframe beacon (E6) from the coordinator
+static void tagBeaconRx(byte *buf, word len, ssTdmaTag t)
+	{
+	// running in the interrupt handler!! (from tagRxReadyHandler)
+	if (len != sizeof_ssTdmaBeaconMsg || !*((wyde *)&buf[BEACON_MSG_SLOTS_IDX]))
+		return;
+	DWIFACE IDECA = *((DWIFACE *)typeof(t->radio)->jumps);
+	IDECA.Iocntl(t->radio, dwGetRxTime, &t->beaconRx);
+	t->slots = *((wyde *)&buf[BEACON_MSG_SLOTS_IDX]);
+	t->slotUs = *((wyde *)&buf[BEACON_MSG_SLOT_US_IDX]);
+	t->firstUs = *((wyde *)&buf[BEACON_MSG_FIRST_US_IDX]);
+	t->beaconSeq++;
+	PostEvent(t->beacon, (byte *)t, 0);
+	}
+
+static void tagRxReadyHandler(ssTdmaTag t, byte *buf, word len)
+	{
+	// running in the interrupt handler!!
+	ssFrameDispatch(&t->frames, buf, len);
+	}
+
+// Delegates are called with just the frame, so each tag has its own entry point
+// that hands on the frame along with the tag it belongs to.
+static void rxReady0(byte *buf, word len)	{ tagRxReadyHandler(&tags[0], buf, len); }
+#if kMaxTdmaTags > 1
+static void rxReady1(byte *buf, word len)	{ tagRxReadyHandler(&tags[1], buf, len); }
+#endif
+
+static void (* const tagTasks[kMaxTdmaTags])(byte *buf, word len) =
+	{
+	rxReady0,
+#if kMaxTdmaTags > 1
+	rxReady1,
+#endif
+	};
+
+// range from radio (a ranger, see ssInit) to anchors[0..count-1] in our slot of
+// each superframe, results[count] taking each slot's results (round is posted
+// with them and their count after each slot)
+// NOTE each anchor gets a kTdmaTimeoutMs timeout, without retries (see ssRangeConfig)
+void ssTdmaJoin(RADIO radio, wyde *anchors, byte count, ssRangeData results, EVENT round)
+	{
+	assert(anchors && count && results);
+
+	// take a tag for the radio (or reuse the one it has - its delegate stays)
+	ssTdmaTag t = tagOf(radio);
+	if (!t)
+		{
+		if (!(t = tagOf(NULL)))
+			sys.Fatal("ssTdmaJoin", __LINE__, "%s - too many TDMA radios!", typeof(radio)->Name);
+		byte index = (byte)(t - tags);
+		memset(t, 0, sizeof(_ssTdmaTag));
+		t->radio = radio;
+
+		objectCreate(t->timer, kIntervalTimer, TICKS(kTdmaTickMs));
+		OnEvent(t->timer, (HANDLER) tagTimerHandler);
+		objectCreate(t->beacon);
+		OnEvent(t->beacon, (HANDLER) tagBeaconHandler);
+		objectCreate(t->done);
+		OnEvent(t->done, (HANDLER) tagDoneHandler);
+
+		// accept beacons (broadcast)
+		byte hdr[sizeof_ssRangeRequestMsg];
+		memcpy(hdr, ssRangeRequestMsg, sizeof_ssRangeRequestMsg);
+		*((wyde *)&hdr[MSG_DST_IDX]) = ((Dw3000)radio)->addr;
+		ssFrameInit(&t->frames, hdr);
+		if (ssFrameFiltered(radio))
+			ssFrameTrustAddr(&t->frames);
+		ssFrameOn(&t->frames, FUNC_TDMA_BEACON, sizeof_ssTdmaBeaconMsg, (SSFRAMEHANDLER) tagBeaconRx, t);
+
+		objectCreate(t->rxReady, delegateTask(tagTasks[index]));
+		IRADIO.Iocntl(radio, kRadioAddRxReady, t->rxReady);
+		}
+	else
+		cmStopTimer(t->timer);
+
+	t->anchors = anchors;
+	t->count = count;
+	t->first =
+	t->countdown = 0;
+	t->results = results;
+	t->round = round;
+	t->delayedTx = 1;
+	t->exchange = 0;
+	for (byte i = 0; i < count; i++)
+		ssRangeConfig(anchors[i], kTdmaTimeoutMs, 0);
+	}
+
+// stop ranging from radio (a slot in progress is finished)
+void ssTdmaLeave(RADIO radio)
+	{
+	ssTdmaTag t = tagOf(radio);
+	if (!t)
+		return;
+	cmStopTimer(t->timer);
+	t->countdown = 0;
+	t->anchors = NULL;
+	}
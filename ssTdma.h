@@ -0,0 +1,50 @@
+/*
+ *	File: ssTdma.h
+ *
+ *	Contains: Scheduled (TDMA) ranging definitions
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __SSTDMA_H
+#define __SSTDMA_H
+
+#include "ssRange.h"
+
+// One node (usually an anchor) coordinates, beaconing the start of each
+// superframe; every tag ranges to its anchors in its own slot of it (see
+// ssTdma.c). On the 8051 (32 bit device time, see dwTime.h) superframes must be
+// shorter than 67ms.
+
+// the slot a tag uses
+//
+// NOTE nothing stops two tags sharing a slot - tags whose addrs are the same
+// modulo the # of slots collide in every superframe (and the # of slots follows
+// the exchange time, see ssTdma.c). Addrs that run consecutively, with no more
+// tags than slots, never share; otherwise offer comfortably more slots than
+// tags. Two radios of one node share its addr (and so its slot) unless given
+// their own (see ssRangerInit).
+#define ssTdmaSlot(addr, slots)	((addr) % (slots))
+
+// coordinator - beacon every superframeMs, with slots long enough for exchanges
+// exchanges each (as measured)
+void ssTdmaCoordinate(RADIO radio, word superframeMs, byte exchanges);
+void ssTdmaStop(RADIO radio);
+
+// tag - range to anchors[0..count-1] in our slot of each superframe, round is
+// posted after each slot with the results and their count
+void ssTdmaJoin(RADIO radio, wyde *anchors, byte count, ssRangeData results, EVENT round);
+void ssTdmaLeave(RADIO radio);
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ *	File: ssTof.c
+ *
+ *	Contains: Single sided time of flight calculations
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "interface/dw3000.h"
+
+#include "ssRange.h"
+#include "ssTof.h"
+
+// distance in metres (the reference calculation)
+double ssTofDistance(dwTime rtdInit, dwTime rtdResp, Int32 corQ26)
+	{
+	double ratio = corQ26 / (double)((teta)1 << 26);
+
+	// clock offset ratio corrects for differing local and remote clock rates
+	double tof = (((double)rtdInit - rtdResp * (1 - ratio)) / 2.0) * DWT_TIME_UNITS;
+	return tof * SPEED_OF_LIGHT;
+	}
+
+// tof2 (twice the tof, in time units with fracBits below the point) in mm
+static Int32 tof2Mm(Int32 tof2, byte fracBits)
+	{
+	// tof2 * mm per time unit / 2
+	//    split the Q16 constant into integer (4) and fraction parts and the
+	//    whole units into 16 bit halves, then recombine at Q16 and round (the
+	//    fraction of a unit, if any, is added on separately)
+	UInt32 mag = tof2 < 0 ? -tof2 : tof2;
+	UInt32 whole = mag >> fracBits, part = mag & ((1UL << fracBits) - 1);
+	if (whole > ((UInt32)1 << 28))
+		whole = (UInt32)1 << 28;	// ~1200km, well beyond any real range
+	UInt32 frac = kTofMmPerTickQ16 & 0xFFFF;
+	UInt32 x = whole * (kTofMmPerTickQ16 >> 16) + (whole >> 16) * frac;
+	x += ((whole & 0xFFFF) * frac + 0x8000) >> 16;
+	x += (part * kTofMmPerTickQ16 + (1UL << (15 + fracBits))) >> (16 + fracBits);
+	Int32 mm = (Int32)((x + 1) >> 1);
+	return tof2 < 0 ? -mm : mm;
+	}
+
+// distance in mm, using only 32 bit integer arithmetic
+//
+// NOTE
+// This has to run on parts with no fpu _and_ no 64 bit integer support (8051),
+// so every product is split into 16 bit halves small enough not to overflow;
+//
+//    rtdInit - rtdResp * (1 - ratio) = (rtdInit - rtdResp) + rtdResp * ratio
+//
+// (rtdInit - rtdResp) is twice the tof plus the clock drift over the reply time,
+// which is small, and rtdResp * ratio is the (small) correction for that drift.
+// The deltas themselves may be 40 bits; the top 8 are taken separately.
+Int32 ssTofMm(dwTime rtdInit, dwTime rtdResp, Int32 corQ26)
+	{
+	// rtdResp * ratio, in time units (rounded)
+	UInt32 cor = corQ26 < 0 ? -corQ26 : corQ26;
+	if (cor > 0x8000)
+		cor = 0x8000;	// +/-488ppm - beyond any sane crystal
+	UInt32 resp = (UInt32)rtdResp;
+	UInt32 hi = (resp >> 16) * cor;		// < 2^31
+	UInt32 lo = (resp & 0xFFFF) * cor;	// < 2^31
+	Int32 drift = (Int32)((hi + (lo >> 16) + (1 << 9)) >> 10);
+	drift += (Int32)(((UInt32)dwTimeHi(rtdResp) * cor) << 6);	// bits 32..39 (< 2^29)
+	if (corQ26 < 0)
+		drift = -drift;
+
+	// twice the tof, in time units
+	Int32 tof2 = (Int32)(rtdInit - rtdResp) + drift;
+
+	return tof2Mm(tof2, 0);
+	}
+
+// DS-TWR distance in metres (the reference calculation)
+//
+// NOTE
+// The textbook form, (round1 * round2 - reply1 * reply2) / sum, subtracts two
+// products of up to 64 bits that agree in all but their last few, which loses
+// everything to rounding in a double once the reply times get long. Writing
+// round1 = reply1 + d1 and round2 = reply2 + d2 gives
+//
+//    round1 * round2 - reply1 * reply2 = round1 * d2 + reply2 * d1
+//
+// where d1 and d2 are small (twice the tof plus the clock drift over the reply).
+double ssDsTofDistance(dwTime round1, dwTime reply1, dwTime round2, dwTime reply2)
+	{
+	Int32 d1 = (Int32)(round1 - reply1), d2 = (Int32)(round2 - reply2);
+	double sum = (double)round1 + round2 + reply1 + reply2;
+	double tof = ((double)round1 * d2 + (double)reply2 * d1) / sum * DWT_TIME_UNITS;
+	return tof * SPEED_OF_LIGHT;
+	}
+
+// n / (d * 2^shift) as a Q32 fraction, for n < d * 2^shift and d < 2^28 - long
+// division four bits at a time, in 32 bit divides rather than a 64 bit one (bar
+// the whole part, for a delta of more than 32 bits)
+static UInt32 fracQ32(dwTime n, UInt32 d, byte shift)
+	{
+	// the whole part of n / d (< 2^shift), then the remainder's fraction
+	UInt32 whole = (UInt32)(n / d), q = 0;
+	if (whole >> shift)
+		return 0xFFFFFFFFUL;
+	UInt32 r = (UInt32)(n % d);
+	byte i;
+	for (i = 0; i < 8; i++)
+		{
+		r <<= 4;
+		q = q << 4 | r / d;
+		r %= d;
+		}
+	return shift ? whole << (32 - shift) | q >> shift : q;
+	}
+
+// scales sum (with hi carried out of the top of it) down until it fits 28 bits
+// - returns the bits shifted out
+static byte fit28(dwTime *sum, byte hi)
+	{
+	byte shift = 0;
+	while (hi || *sum >= ((dwTime)1 << 28))
+		{
+		*sum = *sum >> 1 | (dwTime)(hi & 1) << (sizeof(dwTime) * 8 - 1);
+		hi >>= 1;
+		shift++;
+		}
+	return shift;
+	}
+
+// x * q / 2^32 rounded, for x < 2^31 and a Q32 fraction q - from 16 bit halves,
+// as 32 bits won't hold the product
+static UInt32 mulQ32(UInt32 x, UInt32 q)
+	{
+	UInt32 xh = x >> 16, xl = x & 0xFFFF, qh = q >> 16, ql = q & 0xFFFF;
+	UInt32 m1 = xh * ql, m2 = xl * qh;
+	return xh * qh + (m1 >> 16) + (m2 >> 16) + (((m1 & 0xFFFF) + (m2 & 0xFFFF) + ((xl * ql) >> 16) + 0x8000) >> 16);
+	}
+
+// DS-TWR distance in mm, with no product wider than 32 bits
+//
+// As above, tof = a * d2 + b * d1 where a = round1 / sum and b = reply2 / sum are
+// both fractions, worked out in Q32 (from 28 bits of the sum) and each product
+// taken in halves. d1 and d2 carry the clock drift over the replies, which can
+// be a few hundred thousand time units, so 16 bit fractions won't do.
+Int32 ssDsTofMm(dwTime round1, dwTime reply1, dwTime round2, dwTime reply2)
+	{
+	Int32 d1 = (Int32)(round1 - reply1), d2 = (Int32)(round2 - reply2);
+
+	// the sum (which may carry out of a 32 bit dwTime), then scaled down until
+	// it fits 28 bits
+	dwTime sum = round1 + reply1;
+	byte hi = sum < round1;
+	sum += round2;
+	hi += sum < round2;
+	sum += reply2;
+	hi += sum < reply2;
+	byte shift = fit28(&sum, hi);
+	if (!sum)
+		return 0;
+	UInt32 a = fracQ32(round1, (UInt32)sum, shift), b = fracQ32(reply2, (UInt32)sum, shift);
+
+	// twice the tof, in quarter time units
+	UInt32 m1 = d1 < 0 ? -d1 : d1, m2 = d2 < 0 ? -d2 : d2;
+	if (m1 > ((UInt32)1 << 28))
+		m1 = (UInt32)1 << 28;
+	if (m2 > ((UInt32)1 << 28))
+		m2 = (UInt32)1 << 28;
+	Int32 p1 = (Int32)mulQ32(m1 << 3, b), p2 = (Int32)mulQ32(m2 << 3, a);
+	return tof2Mm((d1 < 0 ? -p1 : p1) + (d2 < 0 ? -p2 : p2), 2);
+	}
+
+// DS-TWR clock offset ratio (rangee relative to ranger) in Q26, from the same
+// four deltas;
+//
+//    ratio = ((reply1 + round2) - (round1 + reply2)) / (round1 + reply2)
+//
+// ie. the rangee's span from poll rx to final rx against the ranger's from poll
+// tx to final tx. The difference is the drift over the span, a few ppm of it,
+// so it fits 32 bits; the quotient is a Q32 fraction (as in ssDsTofMm) cut to
+// Q26.
+Int32 ssDsCorQ26(dwTime round1, dwTime reply1, dwTime round2, dwTime reply2)
+	{
+	Int32 diff = (Int32)((reply1 + round2) - (round1 + reply2));
+	dwTime sum = round1 + reply2;
+	byte shift = fit28(&sum, sum < round1);
+	if (!sum)
+		return 0;
+	UInt32 mag = diff < 0 ? -diff : diff;
+	UInt32 q = fracQ32(mag, (UInt32)sum, shift);
+	Int32 cor = (Int32)((q + (1 << 5)) >> 6);
+	return diff < 0 ? -cor : cor;
+	}
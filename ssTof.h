@@ -0,0 +1,73 @@
+/*
+ *	File: ssTof.h
+ *
+ *	Contains: Single sided time of flight calculations
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __SSTOF_H
+#define __SSTOF_H
+
+#include "Koliada.h"
+#include "dwTime.h"
+
+// SS-TWR distance from the two round trip deltas (in DW time units);
+//    rtdInit = t4 - t1 (ranger clock)
+//    rtdResp = t3 - t2 (rangee clock)
+// and the clock offset ratio of the rangee relative to the ranger in Q26 (ie. the
+// carrier integrator value read via dwGetClockOffset, ratio * 2^26)
+//
+//    tof = (rtdInit - rtdResp * (1 - ratio)) / 2 * DWT_TIME_UNITS
+//
+// Both deltas are taken with dwTimeDelta, so the timestamps themselves may wrap,
+// and may be up to 40 bits (replies as long as ~17s).
+
+// mm per DW time unit in Q16 (DWT_TIME_UNITS * SPEED_OF_LIGHT * 1000 * 2^16)
+#define kTofMmPerTickQ16	307387L
+
+// Error bound of ssTofMm against ssTofDistance (the double calculation),
+// for |ratio| < 2^-11 (488ppm) and distances up to 600km;
+//
+//    |error| <= 2mm + 7.5e-7 * distance
+//
+// ie. 1.2mm from rounding the clock offset correction to a whole time unit,
+// 0.75mm from rounding the result, and the remainder from kTofMmPerTickQ16
+// being 0.23/65536 mm short per time unit (<1mm at 1km). TestSsTof checks this.
+#define kTofMmErrorBound	2		// mm
+#define kTofMmErrorPpm		0.75	// per million of the distance
+
+double ssTofDistance(dwTime rtdInit, dwTime rtdResp, Int32 corQ26);
+Int32 ssTofMm(dwTime rtdInit, dwTime rtdResp, Int32 corQ26);
+
+// Asymmetric DS-TWR distance from the four deltas (in DW time units);
+//    round1 = t4 - t1 (ranger: poll tx to response rx)
+//    reply1 = t3 - t2 (rangee: poll rx to response tx)
+//    round2 = t6 - t3 (rangee: response tx to final rx)
+//    reply2 = t5 - t4 (ranger: response rx to final tx)
+//
+//    tof = (round1 * round2 - reply1 * reply2) / (round1 + round2 + reply1 + reply2)
+//
+// No clock offset is needed - the drift cancels to first order whatever the
+// reply times - so replies may be as slow as the 40 bit deltas allow. The
+// integer form meets the same error bound as ssTofMm (TestSsTof checks this).
+double ssDsTofDistance(dwTime round1, dwTime reply1, dwTime round2, dwTime reply2);
+Int32 ssDsTofMm(dwTime round1, dwTime reply1, dwTime round2, dwTime reply2);
+
+// The clock offset ratio of the rangee relative to the ranger that the same DS
+// exchange measures, in Q26 (as dwGetClockOffset's), with integer arithmetic
+// only (see ssTof.c).
+Int32 ssDsCorQ26(dwTime round1, dwTime reply1, dwTime round2, dwTime reply2);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ *	File: ssTofBatch.c
+ *
+ *	Contains: Batch (SIMD) SS-TWR distances - host side
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+#include "interface/dw3000.h"
+
+#include "ssRange.h"
+#include "ssTofBatch.h"
+
+// NOTE
+// The calculation is ssTofDistance's, rearranged as ssTofMm's is;
+//
+//    rtdInit - rtdResp * (1 - ratio) = (rtdInit - rtdResp) + rtdResp * ratio
+//
+// (rtdInit - rtdResp) is small (twice the tof, plus the drift over the reply),
+// so it is taken exactly, in 64 bit integers, and only then converted - to a
+// double from its low 32 bits, as there's no vector conversion from 64 bits
+// short of AVX-512. rtdResp (< 2^40) is converted by the usual trick of making
+// it the mantissa of 2^52 and subtracting 2^52 back off. Only the (small)
+// correction is worked out in floating point, where ssTofDistance rounds at
+// the full 2^40 scale; kTofBatchErrorM bounds the difference.
+//
+// The instructions are chosen as built (-mavx2, say, for AVX2; any x64 build has
+// SSE2) - define USE_SCALAR_TOF to build without either. The lanes left over at
+// the end of a batch go one at a time.
+
+#ifdef CC8051
+#error host only - see ssTof.c for the node calculations
+#endif
+
+// metres per time unit of tof2 (ie. half the tof)
+#define kMetresPerTof2	(DWT_TIME_UNITS * SPEED_OF_LIGHT / 2.0)
+
+// 1 / 2^26 (Q26 to a ratio)
+#define kCorScale		(1.0 / (1L << 26))
+
+#if defined(__AVX2__) && !defined(USE_SCALAR_TOF)
+	#include <immintrin.h>
+	const byte ssTofBatchPath = kTofBatchAVX2;
+#elif (defined(__SSE2__) || defined(_M_X64)) && !defined(USE_SCALAR_TOF)
+	#include <emmintrin.h>
+	const byte ssTofBatchPath = kTofBatchSSE2;
+#else
+	const byte ssTofBatchPath = kTofBatchScalar;
+#endif
+
+void ssTofBatchScalar(ssTofBatch batch, UInt32 n, double *distance)
+	{
+	for (UInt32 i = 0; i < n; i++)
+		{
+		dwTime init = dwTimeDelta(batch->t4[i], batch->t1[i]);
+		dwTime resp = dwTimeDelta(batch->t3[i], batch->t2[i]);
+		double tof2 = (Int32)(init - resp) + (double)resp * (batch->cor[i] * kCorScale);
+		distance[i] = tof2 * kMetresPerTof2;
+		}
+	}
+
+void ssTofBatchDistance(ssTofBatch batch, UInt32 n, double *distance)
+	{
+	UInt32 i = 0;
+
+#if defined(__AVX2__) && !defined(USE_SCALAR_TOF)
+	const __m256i mask = _mm256_set1_epi64x(kDwTimeMask);
+	const __m256i exp52 = _mm256_set1_epi64x(0x4330000000000000LL);	// 2^52, as a double
+	const __m256d two52 = _mm256_set1_pd(4503599627370496.0);
+	const __m256i low32 = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	const __m256d corScale = _mm256_set1_pd(kCorScale);
+	const __m256d metres = _mm256_set1_pd(kMetresPerTof2);
+	for (; i + 4 <= n; i += 4)
+		{
+		__m256i init = _mm256_and_si256(_mm256_sub_epi64(
+			_mm256_loadu_si256((__m256i *)&batch->t4[i]), _mm256_loadu_si256((__m256i *)&batch->t1[i])), mask);
+		__m256i resp = _mm256_and_si256(_mm256_sub_epi64(
+			_mm256_loadu_si256((__m256i *)&batch->t3[i]), _mm256_loadu_si256((__m256i *)&batch->t2[i])), mask);
+
+		// (init - resp) from its low 32 bits, resp from its 40
+		__m128i diff = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_sub_epi64(init, resp), low32));
+		__m256d respD = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(resp, exp52)), two52);
+		__m256d ratio = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((__m128i *)&batch->cor[i])), corScale);
+
+		__m256d tof2 = _mm256_add_pd(_mm256_cvtepi32_pd(diff), _mm256_mul_pd(respD, ratio));
+		_mm256_storeu_pd(&distance[i], _mm256_mul_pd(tof2, metres));
+		}
+#elif (defined(__SSE2__) || defined(_M_X64)) && !defined(USE_SCALAR_TOF)
+	const __m128i mask = _mm_set1_epi64x(kDwTimeMask);
+	const __m128i exp52 = _mm_set1_epi64x(0x4330000000000000LL);
+	const __m128d two52 = _mm_set1_pd(4503599627370496.0);
+	const __m128d corScale = _mm_set1_pd(kCorScale);
+	const __m128d metres = _mm_set1_pd(kMetresPerTof2);
+	for (; i + 2 <= n; i += 2)
+		{
+		__m128i init = _mm_and_si128(_mm_sub_epi64(
+			_mm_loadu_si128((__m128i *)&batch->t4[i]), _mm_loadu_si128((__m128i *)&batch->t1[i])), mask);
+		__m128i resp = _mm_and_si128(_mm_sub_epi64(
+			_mm_loadu_si128((__m128i *)&batch->t3[i]), _mm_loadu_si128((__m128i *)&batch->t2[i])), mask);
+
+		__m128i diff = _mm_shuffle_epi32(_mm_sub_epi64(init, resp), _MM_SHUFFLE(2, 0, 2, 0));
+		__m128d respD = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(resp, exp52)), two52);
+		__m128d ratio = _mm_mul_pd(_mm_cvtepi32_pd(_mm_loadl_epi64((__m128i *)&batch->cor[i])), corScale);
+
+		__m128d tof2 = _mm_add_pd(_mm_cvtepi32_pd(diff), _mm_mul_pd(respD, ratio));
+		_mm_storeu_pd(&distance[i], _mm_mul_pd(tof2, metres));
+		}
+#endif
+
+	// the rest (or all, if there are no vectors)
+	if (i < n)
+		{
+		_ssTofBatch rest = {&batch->t1[i], &batch->t2[i], &batch->t3[i], &batch->t4[i], &batch->cor[i]};
+		ssTofBatchScalar(&rest, n - i, &distance[i]);
+		}
+	}
@@ -0,0 +1,63 @@
+/*
+ *	File: ssTofBatch.h
+ *
+ *	Contains: Batch (SIMD) SS-TWR distance definitions - host side
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __SSTOFBATCH_H
+#define __SSTOFBATCH_H
+
+#include "Koliada.h"
+#include "dwTime.h"
+
+// SS-TWR distances for many exchanges at once (a host solving for its nodes,
+// see ssOffload.h) - the ssTofDistance calculation, four (AVX2) or two (SSE2)
+// exchanges to an instruction where the build allows, else one at a time.
+//
+// The exchanges are given structure-of-arrays - each field (as in
+// _ssRangeData) an array of its own, element i of each making up exchange i -
+// so each field loads straight into a vector.
+
+// Error bound against ssTofDistance (metres) - the same calculation, rounded
+// differently (see ssTofBatch.c), for deltas up to the 40 bit limit and
+// distances up to 600km. TestTofBatch checks this.
+#define kTofBatchErrorM		1e-6
+
+typedef struct
+	{
+	dwTime *t1;		// poll tx       (ranger clock)
+	dwTime *t2;		// poll rx       (rangee clock)
+	dwTime *t3;		// response tx   (rangee clock)
+	dwTime *t4;		// response rx   (ranger clock)
+	Int32 *cor;		// clock offset ratio (rangee relative to ranger, Q26)
+	} _ssTofBatch, *ssTofBatch;
+
+// kTofBatchXxx - the instructions ssTofBatchDistance uses (as built)
+enum
+	{
+	kTofBatchScalar,
+	kTofBatchSSE2,
+	kTofBatchAVX2
+	};
+extern const byte ssTofBatchPath;
+
+// distance (metres) for exchanges [0..n-1] - distance may not overlap the batch
+void ssTofBatchDistance(ssTofBatch batch, UInt32 n, double *distance);
+
+// ... one at a time (whatever the build)
+void ssTofBatchScalar(ssTofBatch batch, UInt32 n, double *distance);
+
+#endif
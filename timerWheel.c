@@ -0,0 +1,133 @@
+/*
+ *	File: timerWheel.c
+ *
+ *	Contains: Hierarchical timer wheel
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "timerWheel.h"
+
+// NOTE
+// Level 0 has a slot per tick for the next kWheelSlots ticks. Each level above
+// has a slot per kWheelSlots ticks of the level below, so a timer lives in the
+// lowest level whose span reaches its deadline. Each time a level below wraps
+// round, the current slot of the level above is emptied back down (cascaded) -
+// a timer moves at most kWheelLevels - 1 times in its life, however long it is.
+//
+// Slots are unordered lists; a timer keeps a pointer to whatever points at it,
+// so it can be unlinked without searching and without a list head sentinel.
+
+#define levelShift(l)	((l) * kWheelBits)
+#define slotIndex(t, l)	(((t) >> levelShift(l)) & (kWheelSlots - 1))
+
+static void timerLink(wheelTimer *slot, wheelTimer timer)
+	{
+	timer->next = *slot;
+	if (timer->next)
+		timer->next->link = &timer->next;
+	timer->link = slot;
+	*slot = timer;
+	}
+
+static void timerUnlink(wheelTimer timer)
+	{
+	*timer->link = timer->next;
+	if (timer->next)
+		timer->next->link = timer->link;
+	timer->link = NULL;
+	}
+
+static void timerPlace(timerWheel wheel, wheelTimer timer)
+	{
+	// the lowest level in which the deadline is less than a full turn away
+	byte l;
+	for (l = 0; l < kWheelLevels - 1; l++)
+		if ((timer->expires >> levelShift(l)) - (wheel->now >> levelShift(l)) < kWheelSlots)
+			break;
+	timerLink(&wheel->slot[l][slotIndex(timer->expires, l)], timer);
+	}
+
+void timerWheelInit(timerWheel wheel)
+	{
+	memset(wheel, 0, sizeof(_timerWheel));
+	}
+
+void wheelTimerInit(wheelTimer timer, WHEELHANDLER expired, void *context)
+	{
+	timer->next = NULL;
+	timer->link = NULL;
+	timer->expired = expired;
+	timer->context = context;
+	}
+
+// (re)start timer to expire after ticks (at least 1, at most kWheelMaxTicks)
+void timerWheelAdd(timerWheel wheel, wheelTimer timer, UInt32 ticks)
+	{
+	if (timer->link)
+		timerUnlink(timer);
+	else
+		wheel->count++;
+
+	// the current tick has already been handled
+	if (!ticks)
+		ticks = 1;
+	if (ticks > kWheelMaxTicks)
+		ticks = kWheelMaxTicks;
+	timer->expires = wheel->now + ticks;
+	timerPlace(wheel, timer);
+	}
+
+// stop timer (harmless if it isn't running)
+void timerWheelCancel(timerWheel wheel, wheelTimer timer)
+	{
+	if (!timer->link)
+		return;
+	timerUnlink(timer);
+	wheel->count--;
+	}
+
+// advance the wheel one tick, calling the handler of every timer that expires
+// handlers may add or cancel any timer (including their own)
+void timerWheelTick(timerWheel wheel)
+	{
+	UInt32 now = ++wheel->now;
+
+	// find the highest level due a cascade, then empty each level's current slot
+	// downwards (from the top, so a timer can drop more than one level at once)
+	byte l;
+	for (l = 1; l < kWheelLevels && !(now & ((1UL << levelShift(l)) - 1)); l++)
+		;
+	while (--l)
+		{
+		wheelTimer *slot = &wheel->slot[l][slotIndex(now, l)];
+		wheelTimer timer;
+		while ((timer = *slot))
+			{
+			timerUnlink(timer);
+			timerPlace(wheel, timer);
+			}
+		}
+
+	// expire everything in the current slot (taken one at a time, as a handler
+	// may cancel the next one)
+	wheelTimer *slot = &wheel->slot[0][slotIndex(now, 0)];
+	wheelTimer timer;
+	while ((timer = *slot))
+		{
+		timerUnlink(timer);
+		wheel->count--;
+		timer->expired(timer, timer->context);
+		}
+	}
@@ -0,0 +1,70 @@
+/*
+ *	File: timerWheel.h
+ *
+ *	Contains: Hierarchical timer wheel definitions
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __TIMERWHEEL_H
+#define __TIMERWHEEL_H
+
+#include "Koliada.h"
+
+// Any number of deadlines, each added and cancelled in constant time, driven by
+// a single periodic tick (one wheel per tick source, not one timer per deadline).
+// Timers are embedded in whatever they time, so the wheel itself never allocates.
+//
+// Runs in application context only - nothing here is interrupt safe.
+
+// sizes are build wide (override in the board config, not per module)
+#ifndef kWheelBits
+#define kWheelBits 5	// log2 of the slots per level
+#endif
+#ifndef kWheelLevels
+#define kWheelLevels 3	// longest delay is 2^(kWheelBits * kWheelLevels) - 1 ticks
+#endif
+
+#define kWheelSlots		(1 << kWheelBits)
+#define kWheelMaxTicks	((1UL << (kWheelBits * kWheelLevels)) - 1)
+
+struct _wheelTimer;
+typedef void (*WHEELHANDLER)(struct _wheelTimer *timer, void *context);
+
+typedef struct _wheelTimer
+	{
+	struct _wheelTimer *next;
+	struct _wheelTimer **link;	// whatever points at us (NULL when not running)
+	UInt32 expires;				// wheel tick due
+	WHEELHANDLER expired;
+	void *context;
+	} _wheelTimer, *wheelTimer;
+
+typedef struct
+	{
+	UInt32 now;		// ticks so far
+	word count;		// timers running
+	wheelTimer slot[kWheelLevels][kWheelSlots];
+	} _timerWheel, *timerWheel;
+
+void timerWheelInit(timerWheel wheel);
+void wheelTimerInit(wheelTimer timer, WHEELHANDLER expired, void *context);
+
+void timerWheelAdd(timerWheel wheel, wheelTimer timer, UInt32 ticks);
+void timerWheelCancel(timerWheel wheel, wheelTimer timer);
+void timerWheelTick(timerWheel wheel);
+
+#define wheelTimerRunning(timer)	((timer)->link != NULL)
+
+#endif
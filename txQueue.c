@@ -0,0 +1,193 @@
+/*
+ *	File: txQueue.c
+ *
+ *	Contains: txDone paced transmit queue for radio and UDP sends
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+#include "interface/radio.h"
+#include "interface/udp.h"
+
+#include "txQueue.h"
+
+// NOTE
+// Calling Send once a turn of the event loop leaves the transmitter idle for
+// however long the application takes to come round again. Here the application
+// only queues (a copy of) each frame, and the next one is started from the
+// txDone interrupt the moment the last has gone, so a burst goes out back to
+// back at the PHY rate.
+//
+// head and tail are free running, as in frameRing.c. head is only written by
+// the application. tail (and busy) belong to whichever side starts the sends;
+// txDone while busy, and the application only while not - when nothing is on
+// its way out there is no txDone to come and race it. The application fills a
+// slot and publishes head _before_ looking at busy, so either the interrupt
+// sees the new head (and sends it), or it has already gone idle and the
+// application sees that (and starts it); a frame can't be left behind.
+//
+// txDone hands back the frame as it was given to Send, so frames others send on
+// the same device (a ranger's polls, say) are told apart from ours and ignored.
+// The device must raise txDone for every frame Send accepts, or the queue stalls.
+
+#if kTxQueues > 2
+#error add txDone entry points for the extra queues (see txQueueTasks)
+#endif
+
+#if defined(__GNUC__)
+	#define queueBarrier() __asm__ __volatile__("" ::: "memory")
+#else
+	#define queueBarrier()
+#endif
+
+static txQueue queues[kTxQueues];
+
+static int txSend(txQueue q, txSlot s)
+	{
+	if (q->kind == kTxQueueUdp)
+		return IUDP.Send((UDP)q->dev, s->buf, s->len);
+	return IRADIO.Send((RADIO)q->dev, s->buf, s->len);
+	}
+
+// sends the slot at tail (and on past any the device refuses) - busy is left
+// set while a frame is out, clear once there are none left to send
+static void txStart(txQueue q)
+	{
+	while (q->tail != q->head)
+		{
+		byte tail = q->tail;
+		q->busy = 1;
+		queueBarrier();
+		if (txSend(q, &q->slot[tail & q->mask]) >= 0)
+			return;
+		q->errors++;
+		q->tail = tail + 1;
+		}
+	q->busy = 0;
+	}
+
+static void txDoneHandler(txQueue q, byte *frame, word len)
+	{
+	// running in the interrupt handler!!
+	// called each time a frame is sent (ours or not)
+	byte tail = q->tail;
+	if (!q->busy || frame != q->slot[tail & q->mask].buf)
+		return;
+	byte full = txQueueCount(q) > q->mask;
+	q->sent++;
+	q->tail = tail + 1;
+	txStart(q);
+	if (full && q->space)
+		PostEvent(q->space, q, txQueueFree(q));
+	}
+
+// Delegates are called with just the frame, so each queue has its own entry
+// point that hands on the frame along with the queue it belongs to.
+static void txDone0(byte *frame, word len)	{ txDoneHandler(queues[0], frame, len); }
+#if kTxQueues > 1
+static void txDone1(byte *frame, word len)	{ txDoneHandler(queues[1], frame, len); }
+#endif
+
+static void (* const txQueueTasks[kTxQueues])(byte *frame, word len) =
+	{
+	txDone0,
+#if kTxQueues > 1
+	txDone1,
+#endif
+	};
+
+byte txQueueInit(txQueue q, void *dev, byte kind, txSlot slot, byte count)
+	{
+	assert(count && count <= 128 && !(count & (count - 1)));
+	byte index;
+	for (index = 0; index < kTxQueues && queues[index] && queues[index] != q; index++)
+		;
+	if (index == kTxQueues)
+		return 0;
+	if (queues[index] && (q->dev != dev || q->kind != kind))
+		// (its txDone delegate stays on the device it was first given - moved,
+		// the queue would never hear its frames go)
+		return 0;
+	q->dev = dev;
+	q->kind = kind;
+	q->index = index;
+	q->head =
+	q->tail = 0;
+	q->mask = count - 1;
+	q->busy = 0;
+	q->high = 0;
+	q->drops =
+	q->errors = 0;
+	q->sent = 0;
+	q->space = NULL;
+	q->slot = slot;
+
+	if (!queues[index])
+		{
+		queues[index] = q;
+		objectCreate(q->txDone, delegateTask(txQueueTasks[index]));
+		if (kind == kTxQueueUdp)
+			IUDP.Iocntl((UDP)dev, kUdpAddTxDone, q->txDone);
+		else
+			IRADIO.Iocntl((RADIO)dev, kRadioAddTxDone, q->txDone);
+		}
+	return 1;
+	}
+
+byte txQueueSend(txQueue q, byte *frame, word len)
+	{
+	byte head = q->head;
+	txSlot s = &q->slot[head & q->mask];
+	if ((byte)(head - q->tail) > q->mask || len > s->size)
+		{
+		q->drops++;
+		return 0;
+		}
+	memcpy(s->buf, frame, len);
+	s->len = len;
+	queueBarrier();
+	q->head = head + 1;
+	queueBarrier();
+
+	byte count = txQueueCount(q);
+	if (count > q->high)
+		q->high = count;
+	if (!q->busy)
+		txStart(q);
+	return 1;
+	}
+
+byte txQueueSendWait(txQueue q, byte *frame, word len)
+	{
+	if (len > q->slot[q->head & q->mask].size)
+		{
+		q->drops++;
+		return 0;
+		}
+	while (!txQueueFree(q))
+		EventYield();
+	return txQueueSend(q, frame, len);
+	}
+
+void txQueueOnSpace(txQueue q, EVENT space)
+	{
+	q->space = space;
+	}
+
+void txQueueFlush(txQueue q)
+	{
+	while (txQueueCount(q))
+		EventYield();
+	}
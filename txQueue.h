@@ -0,0 +1,83 @@
+/*
+ *	File: txQueue.h
+ *
+ *	Contains: txDone paced transmit queue for radio and UDP sends
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __TXQUEUE_H
+#define __TXQUEUE_H
+
+#include "Koliada.h"
+#include "interface/radio.h"
+#include "interface/udp.h"
+
+// Frames queued by the application and sent one after another, the next
+// started from the txDone interrupt as each goes out - see txQueue.c.
+
+#ifndef kTxQueues
+#define kTxQueues 2		// queues at once (each has its own txDone entry point)
+#endif
+
+// the device behind a queue
+#define kTxQueueRadio	0	// IRADIO.Send
+#define kTxQueueUdp		1	// IUDP.Send
+
+typedef struct
+	{
+	byte *buf;		// the caller's
+	word size;		// ... room for
+	word len;		// ... queued
+	} _txSlot, *txSlot;
+
+typedef struct
+	{
+	void *dev;			// RADIO or UDP
+	byte kind;			// kTxQueueXxx
+	byte index;			// entry point (see txQueue.c)
+	volatile byte head;	// next slot to fill - written by the application only
+	volatile byte tail;	// next slot to send - written by whichever side starts a send (see txQueue.c)
+	byte mask;			// slots - 1
+	volatile byte busy;	// a frame is on its way out
+	byte high;			// most ever queued at once
+	volatile word drops;// frames turned away (the queue full, or too long for a slot)
+	volatile word errors;// frames the device refused (Send < 0)
+	volatile UInt32 sent;
+	EVENT space;		// posted (if set) as a full queue frees a slot
+	DELEGATE txDone;
+	txSlot slot;
+	} _txQueue, *txQueue;
+
+// slot[0..count-1] (count a power of 2, <= 128) with their buf & size set; dev
+// is a RADIO or UDP (kind) - returns 0 if all kTxQueues are in use, or q is in
+// use on another device (it may be started again, emptied, on its own)
+byte txQueueInit(txQueue q, void *dev, byte kind, txSlot slot, byte count);
+
+// copies frame into the next slot and sends it as soon as those ahead of it
+// have gone - returns 0 (counting a drop) if there is no room (async), or
+// waits in EventYield for room (blocking)
+byte txQueueSend(txQueue q, byte *frame, word len);
+byte txQueueSendWait(txQueue q, byte *frame, word len);
+
+// posts space (buf = q, len = free slots) each time a full queue frees a slot
+void txQueueOnSpace(txQueue q, EVENT space);
+
+// waits in EventYield until everything queued has gone
+void txQueueFlush(txQueue q);
+
+#define txQueueCount(q)	((byte)((q)->head - (q)->tail))
+#define txQueueFree(q)	((byte)((q)->mask + 1 - txQueueCount(q)))
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ *	File: udpRing.c
+ *
+ *	Contains: Batched UDP receive ring and datagram header view
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#include "Koliada.h"
+#include "interface/udp.h"
+
+#include "udpRing.h"
+
+// NOTE
+// Taking one datagram a turn of the event loop, a burst bigger than the
+// adapter's own buffer (a few KB on a wiznet) is lost before the application
+// gets back to it. udpRecvBatch empties the adapter in one go instead, each
+// datagram straight into the next free descriptor's buffer (IUDP.Recv writes
+// the header and data there - nothing is copied after), and the application
+// then works through them at its own pace.
+//
+// head and tail are free running, as in frameRing.c, so the ring is empty when
+// they are equal and full when they are count apart. Both are only written in
+// application context (the adapter is polled), so there is nothing to guard.
+
+void udpRingInit(udpRing ring, udpDesc desc, byte count)
+	{
+	assert(count && count <= 128 && !(count & (count - 1)));
+	ring->head =
+	ring->tail = 0;
+	ring->mask = count - 1;
+	ring->truncated = 0;
+	ring->desc = desc;
+	}
+
+word udpRecvBatch(UDP udp, udpRing ring)
+	{
+	word n = 0;
+	while ((byte)(ring->head - ring->tail) <= ring->mask)
+		{
+		udpDesc d = &ring->desc[ring->head & ring->mask];
+		if (IUDP.Recv(udp, d->buf, d->size) == (word)-1)
+			break;
+
+		// (as much as fit, if it was longer)
+		word len = sizeof_udpHeader + udpLen((udpHeader)d->buf);
+		if (len > d->size)
+			{
+			len = d->size;
+			ring->truncated++;
+			}
+		d->len = len;
+		ring->head++;
+		n++;
+		}
+	return n;
+	}
+
+udpDesc udpRingPeek(udpRing ring)
+	{
+	if (ring->tail == ring->head)
+		return NULL;
+	return &ring->desc[ring->tail & ring->mask];
+	}
+
+void udpRingRelease(udpRing ring)
+	{
+	ring->tail++;
+	}
+
+word udpRingDrain(udpRing ring, UDPHANDLER handler, void *context, word max)
+	{
+	word n = 0;
+	udpDesc d;
+	while ((!max || n < max) && (d = udpRingPeek(ring)))
+		{
+		handler((udpHeader)d->buf, d->len - sizeof_udpHeader, context);
+		udpRingRelease(ring);
+		n++;
+		}
+	return n;
+	}
@@ -0,0 +1,82 @@
+/*
+ *	File: udpRing.h
+ *
+ *	Contains: Batched UDP receive ring and datagram header view
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ *  Copyright © 1989-2023 by Guy McIlroy.
+ *  All rights reserved.
+ *
+ *  This module contains confidential, unpublished, proprietary source code.
+ *  The copyright notice above does not evidence any actual or intended
+ *  publication of such source code.
+ *
+ *  This code may only be used under licence from Koliada, LLC - www.koliada.com
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ */
+#ifndef __UDPRING_H
+#define __UDPRING_H
+
+#include "Koliada.h"
+#include "interface/udp.h"
+
+// Every datagram IUDP.Recv delivers is preceded by the sender's endpoint and
+// the data length - the header below, viewed in place.
+#pragma pack(1)
+typedef struct
+	{
+	byte ip[4];		// sender's address (in_struct_addr)
+	wyde port;		// ... and port (network order)
+	wyde len;		// user data bytes (network order)
+	} _udpHeader, *udpHeader;
+#pragma pack()
+
+#define sizeof_udpHeader	8
+
+#define udpPort(h)			Swap16((h)->port)
+#define udpLen(h)			Swap16((h)->len)
+#define udpData(h)			((byte *)(h) + sizeof_udpHeader)
+
+// A ring of datagram descriptors, each with a buffer of the caller's, filled
+// as many at a time as have arrived (udpRecvBatch) and drained in order - see
+// udpRing.c.
+
+typedef struct
+	{
+	byte *buf;		// header & data (the caller's, at least sizeof_udpHeader bytes)
+	word size;		// ... room for
+	word len;		// ... received (the header included, and the data as far as it fit)
+	} _udpDesc, *udpDesc;
+
+typedef struct
+	{
+	byte head;		// next descriptor to fill (free running)
+	byte tail;		// next to drain
+	byte mask;		// descriptors - 1
+	word truncated;	// datagrams cut short (longer than their descriptor's buf)
+	udpDesc desc;
+	} _udpRing, *udpRing;
+
+// called for each datagram drained (see udpRingDrain) - h is its header (the
+// data follows), len the bytes of data that fit
+typedef void (*UDPHANDLER)(udpHeader h, word len, void *context);
+
+// desc[0..count-1] (count a power of 2, <= 128) with their buf & size set
+void udpRingInit(udpRing ring, udpDesc desc, byte count);
+
+// everything that has arrived, as far as the ring has room - returns the # received
+word udpRecvBatch(UDP udp, udpRing ring);
+
+// the oldest datagram's descriptor (NULL if none), and handing it back
+udpDesc udpRingPeek(udpRing ring);
+void udpRingRelease(udpRing ring);
+
+// passes up to max datagrams (0 for all) to handler, oldest first - returns the #
+word udpRingDrain(udpRing ring, UDPHANDLER handler, void *context, word max);
+
+#define udpRingCount(ring)	((byte)((ring)->head - (ring)->tail))
+
+#endif